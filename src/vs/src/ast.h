@@ -0,0 +1,725 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <memory_resource>
+#include <cassert>
+#include "concepts.h"
+#include "tokens.h"
+#include "precedence.h"
+#include "code.h"
+
+namespace re {
+    /////////////////////////////////////////////////////////////////////////////////////
+    // re_ast is what a syntax builds as it parses: a tree of the expression, laid out
+    // as code in one pass once all of it is known (see generate()). the syntaxes used
+    // to store straight into the code, and wrapping something that was already there
+    // (x*, a|b, x{2,3}) inserted jumps in front of it; each insert moved everything
+    // after it, so long expressions took quadratic time to compile.
+    //
+    // the leaves (CODE) are runs of instructions that don't jump out of themselves.
+    // the other nodes have their children in order, and the jumps a node adds are
+    // leaves of their own:
+    //
+    //	GROUP	(x), (?>x) and a possessive x*+; the OP_BACKREF_BEGIN or
+    //		OP_ATOMIC_BEGIN and its _END are the first and last children, arg is
+    //		the group (0 for an atomic one)
+    //	REPEAT	x? x* x+, arg is the operator, arg2 is 1 when it's lazy (x*?)
+    //	CLOSURE	x{n,m} between its OP_CLOSURE and OP_CLOSURE_INC, arg is n and
+    //		arg2 m
+    //	ALTERNATE	the BRANCHes and then the last alternative
+    //	BRANCH	an alternative between its failure point and the jump past the
+    //		rest of them, arg is that jump's op (a class's alternatives have an
+    //		OP_POP_FAILURE_GOTO)
+    //	CONCATENATE	the tests of a negated class that couldn't be a bitmap, one
+    //		after another (see store_class)
+    //
+    // the nodes and their words are kept in a few vectors out of the compile's arena
+    // (see compile_state), sized up front from the length of the pattern.
+    //
+    // the syntaxes still think in code offsets: offset() is where the next thing goes
+    // in the code, and prec_stack keeps offsets for what gets wrapped. a wrap never
+    // moves what's in front of it, so those stay good; a jump's displacement is from
+    // the jump, so the code of a node is the same wherever it ends up.
+
+    template<class traitsT>
+    class re_ast {
+    public:
+        typedef traitsT traits_type;
+        typedef typename traits_type::char_type char_type;
+        typedef typename traits_type::int_type int_type;
+        typedef compiled_code_vector<traits_type> code_vector_type;
+        typedef typename code_vector_type::code_type code_type;
+        typedef typename code_vector_type::operands_type operands_type;
+        typedef compile_state<traits_type> compile_state_type;
+
+        enum node_kind { CODE, GROUP, REPEAT, CLOSURE, ALTERNATE, BRANCH, CONCATENATE };
+
+        struct node {
+            node_kind kind;
+            int arg;
+            int arg2;
+            int first; // where its words are, or its children
+            int count; // how many of them
+            int size; // code words, with its children's
+        };
+
+        explicit re_ast(std::pmr::memory_resource *arena = std::pmr::get_default_resource())
+            : _nodes(arena), _children(arena), _words(arena), _top(arena), _at(arena), _groups(arena),
+              _pending(arena), _offset(0), _closures(0), _too_long(false), _leaf(-1) {
+        }
+
+        // room for a pattern of length characters with classes [...] in it. x*
+        // is four nodes, so there are up to about two a character; the code is
+        // up to about four words a character, and a bitmap for each class.
+        void reserve(const size_t length, const size_t classes) {
+            _nodes.reserve(2 * length + 4);
+            _children.reserve(2 * length + 4);
+            _words.reserve(4 * length + classes * (1 + code_vector_type::CLASS_BITMAP) + 4);
+            _top.reserve(length / 2 + 4);
+            _at.reserve(length / 2 + 4);
+        }
+
+        // the bytes reserve() asks for.
+        static size_t reserved(const size_t length, const size_t classes) {
+            return (2 * length + 4) * (sizeof(node) + sizeof(int)) +
+                   (4 * length + classes * (1 + code_vector_type::CLASS_BITMAP) + 4) * sizeof(code_type) +
+                   (length / 2 + 4) * 2 * sizeof(int);
+        }
+
+        // the nodes at the top, in order.
+        const std::pmr::vector<int> &top() const { return _top; }
+
+        const node &operator[](const int n) const { return _nodes[n]; }
+
+        const int *children(const node &n) const { return _children.data() + n.first; }
+
+        const code_type *words(const node &n) const { return _words.data() + n.first; }
+
+        int offset() const { return _offset; }
+
+        int closures() const { return _closures; }
+
+        bool too_long() const { return _too_long; }
+
+        // code for the end of the last leaf, or a new one after a node.
+        int store(const code_type t) {
+            if (_leaf < 0) {
+                open();
+            }
+            _words.push_back(t);
+            _nodes[_leaf].count++;
+            _nodes[_leaf].size++;
+            return _offset++;
+        }
+
+        int store(const code_type op, const code_type flag) {
+            if (_leaf < 0) {
+                open();
+            }
+            _words.push_back(op);
+            _words.push_back(flag);
+            _nodes[_leaf].count += 2;
+            _nodes[_leaf].size += 2;
+            _offset += 2;
+            return _offset - 2;
+        }
+
+        // a number's two code words.
+        int store_number(const int n) {
+            code_type cp[2];
+            number(cp, n);
+            const int start = store(cp[0]);
+            store(cp[1]);
+            return start;
+        }
+
+        // the code from at on, once the expression ends there; what's left of it
+        // to patch goes too.
+        void truncate(const int at) {
+            const int i = split(at);
+            _top.resize(i);
+            _at.resize(i);
+            _offset = at;
+            _leaf = -1;
+            while (!_pending.empty() && _pending.back().at >= at) {
+                _pending.pop_back();
+            }
+        }
+
+        // the code from at to the end, which has to be in the last leaf.
+        const code_type *code_at(const int at) const {
+            if (at == _offset) {
+                return _words.data() + _words.size();
+            }
+            const node &n = _nodes[_top.back()];
+            assert(_leaf == _top.back() && at >= _at.back());
+            return _words.data() + n.first + (at - _at.back());
+        }
+
+        // x?, x* and x+ of the code from at on, greedy or lazy; the same code the
+        // jumps in front of it always were.
+        void store_repeat(const int at, const int op, const bool lazy) {
+            const int s = _offset - at;
+            code_type before[6], after[3];
+            int nb = 3, na = 0;
+            switch (op) {
+                case '?':
+                    if (lazy) {
+                        jump(before, OP_PUSH_FAILURE, 3);
+                        jump(before + 3, OP_GOTO, s);
+                        nb = 6;
+                    } else {
+                        jump(before, OP_PUSH_FAILURE, s);
+                    }
+                    break;
+
+                case '*':
+                    if (lazy) {
+                        jump(before, OP_FAKE_FAILURE_GOTO, s + 3);
+                        jump(before + 3, OP_PUSH_FAILURE, s + 3);
+                        jump(after, OP_PUSH_FAILURE, -s - 6);
+                        nb = 6;
+                    } else {
+                        jump(before, OP_PUSH_FAILURE, s + 3);
+                        jump(after, OP_GOTO, -s - 6);
+                    }
+                    na = 3;
+                    break;
+
+                default:
+                    jump(before, OP_FAKE_FAILURE_GOTO, 3);
+                    jump(before + 3, OP_PUSH_FAILURE, s + 3);
+                    jump(after, lazy ? OP_PUSH_FAILURE : OP_GOTO, -s - 6);
+                    nb = 6;
+                    na = 3;
+                    break;
+            }
+            const int n = wrap(at, REPEAT, before, nb, after, na);
+            _nodes[n].arg = op;
+            _nodes[n].arg2 = lazy;
+        }
+
+        // makes the code from at on an atomic group; once it's matched nothing
+        // inside it is tried again. (a possessive x*+ is (?>x*).)
+        void store_atomic(const int at) {
+            const code_type begin = OP_ATOMIC_BEGIN;
+            const code_type end = OP_ATOMIC_END;
+            wrap(at, GROUP, &begin, 1, &end, 1);
+        }
+
+        // ( and ); what's between them is wrapped when the group's closed. group
+        // 0 is an atomic group.
+        int store_group_begin(const int group) {
+            _leaf = -1;
+            const int start = group ? store(OP_BACKREF_BEGIN, group) : store(OP_ATOMIC_BEGIN);
+            _leaf = -1;
+            _groups.push_back(start);
+            return start;
+        }
+
+        void store_group_end(const int group) {
+            _leaf = -1;
+            if (group) {
+                store(OP_BACKREF_END, group);
+            } else {
+                store(OP_ATOMIC_END);
+            }
+            if (!_groups.empty()) {
+                _nodes[wrap(_groups.back(), GROUP, nullptr, 0, nullptr, 0)].arg = group;
+                _groups.pop_back();
+            }
+        }
+
+        int store_alternate(compile_state_type &cs) {
+            return store_branch(cs, OP_GOTO);
+        }
+
+        int store_class_alternate(compile_state_type &cs) {
+            return store_branch(cs, OP_POP_FAILURE_GOTO);
+        }
+
+        // the jumps at the ends of the alternatives left open at the current
+        // precedence level or above go to here; each run of them (the ones of a
+        // class and of a | can end at the same time) is an ALTERNATE.
+        void close_alternates(compile_state_type &cs) {
+            int from = -1;
+            int op = 0;
+            while (!cs.jump_stack.empty() && cs.jump_stack.top() >= cs.prec_stack.start()) {
+                const int at = cs.jump_stack.top();
+                cs.jump_stack.pop();
+                auto it = _pending.end();
+                while (it != _pending.begin() && (it - 1)->at != at) {
+                    --it;
+                }
+                assert(it != _pending.begin());
+                const pending p = *--it;
+                _pending.erase(it);
+
+                address(_words.data() + p.word, _offset - at - 2);
+                if (from >= 0 && _nodes[p.branch].arg != op) {
+                    alternate(from);
+                }
+                from = p.start;
+                op = _nodes[p.branch].arg;
+            }
+            if (from >= 0) {
+                alternate(from);
+            }
+        }
+
+        // a negated class that isn't a bitmap; each member is a test that's backed
+        // up over, then the one character they all left alone is gone over.
+        int store_concatenate(compile_state_type &cs) {
+            const int at = cs.prec_stack.start();
+            code_type before[3];
+            const code_type after[2] = {OP_FORWARD, OP_POP_FAILURE};
+            jump(before, OP_PUSH_FAILURE2, _offset - at + 1);
+            wrap(at, CONCATENATE, before, 3, after, 2);
+            cs.prec_stack.start(_offset - 1);
+            return 0;
+        }
+
+        int store_class(compile_state_type &cs);
+
+        int store_closure(compile_state_type &cs);
+
+        // lays the code out, once; it's at the offsets it was built with.
+        void generate(code_vector_type &out) const {
+            std::pmr::vector<std::pair<int, int> > stack(_nodes.get_allocator()); // a node, and its next child
+            out.reserve(_offset);
+            for (const int t: _top) {
+                stack.emplace_back(t, 0);
+                while (!stack.empty()) {
+                    const node &n = _nodes[stack.back().first];
+                    if (n.kind == CODE) {
+                        out.store_words(words(n), n.count);
+                        stack.pop_back();
+                    } else if (stack.back().second == n.count) {
+                        stack.pop_back();
+                    } else {
+                        const int child = children(n)[stack.back().second++];
+                        stack.emplace_back(child, 0);
+                    }
+                }
+            }
+            out.closures(_closures);
+            out.too_long(_too_long);
+        }
+
+    private:
+        // a goto at the end of an alternative, until close_alternates says where
+        // the alternatives end.
+        struct pending {
+            int at; // the offset of its address
+            int word; // the same in _words
+            int start; // where its BRANCH is
+            int branch;
+        };
+
+        // a member of a class, as store_class stored it.
+        struct class_item {
+            code_type op;
+            int_type lo, hi;
+
+            bool test(const int_type ch) const {
+                switch (op) {
+                    case OP_CHAR:
+                    case OP_BIN_CHAR:
+                        return ch == lo;
+                    case OP_RANGE_CHAR:
+                        return ch >= lo && ch <= hi;
+                    case OP_DIGIT:
+                        return traits_type::isdigit(ch) != 0;
+                    case OP_SPACE:
+                        return traits_type::isspace(ch) != 0;
+                    default:
+                        return traits_type::isalnum(ch) != 0;
+                }
+            }
+
+            // false if the code isn't one member that can go in a bitmap. the
+            // members of a negated class are stored negated (OP_NOT_CHAR), they
+            // go in as the characters they leave out. an escaped character
+            // (OP_BIN_CHAR) isn't negated when it's stored, but it's left out
+            // all the same.
+            static bool decode(const code_type *cp, const int length, const bool complement,
+                               std::pmr::vector<class_item> &members) {
+                switch (length == 0 ? static_cast<code_type>(OP_END) : *cp) {
+                    case OP_CHAR:
+                    case OP_BIN_CHAR:
+                    case OP_NOT_CHAR:
+                        if ((*cp == OP_CHAR && complement) || (*cp == OP_NOT_CHAR && !complement)) {
+                            return false;
+                        }
+                        members.push_back(class_item{static_cast<code_type>(*cp == OP_BIN_CHAR ? OP_BIN_CHAR : OP_CHAR),
+                                                     static_cast<char_type>(cp[1]), 0});
+                        return length == 2;
+                    case OP_RANGE_CHAR:
+                    case OP_NOT_RANGE_CHAR:
+                        members.push_back(class_item{OP_RANGE_CHAR, static_cast<int_type>(cp[1]),
+                                                     static_cast<int_type>(cp[2])});
+                        return length == 3 && (*cp == OP_NOT_RANGE_CHAR) == complement;
+                    case OP_DIGIT:
+                    case OP_SPACE:
+                    case OP_WORD:
+                        members.push_back(class_item{cp[0], 0, 0});
+                        return length == 2 && (cp[1] != 0) == complement;
+                    default:
+                        return false;
+                }
+            }
+        };
+
+        void open() {
+            _leaf = leaf(nullptr, 0);
+            _top.push_back(_leaf);
+            _at.push_back(_offset);
+        }
+
+        // a leaf that isn't at the top (the jumps of a node); returns it.
+        int leaf(const code_type *cp, const int n) {
+            _nodes.push_back(node{CODE, 0, 0, static_cast<int>(_words.size()), n, n});
+            _words.insert(_words.end(), cp, cp + n);
+            return static_cast<int>(_nodes.size()) - 1;
+        }
+
+        void address(code_type *cp, const long long dsp) {
+            if (dsp < -operands_type::ADDRESS_LIMIT || dsp >= operands_type::ADDRESS_LIMIT) {
+                _too_long = true;
+            }
+            operands_type::put(cp, dsp);
+        }
+
+        void number(code_type *cp, const int n) {
+            if (n < 0 || n > operands_type::NUMBER_LIMIT) {
+                _too_long = true;
+            }
+            operands_type::put(cp, n);
+        }
+
+        // a jump with its displacement, from the end of its address.
+        void jump(code_type *cp, const opcodes op, const int dsp) {
+            cp[0] = static_cast<code_type>(op);
+            address(cp + 1, dsp);
+        }
+
+        // where the node at offset at is in _top; a leaf it's in the middle of is
+        // split there. at the end it's the size of _top.
+        int split(const int at) {
+            const int i = static_cast<int>(std::lower_bound(_at.begin(), _at.end(), at) - _at.begin());
+            if (i == static_cast<int>(_at.size()) ? at == _offset : _at[i] == at) {
+                return i;
+            }
+            assert(i > 0 && _nodes[_top[i - 1]].kind == CODE);
+            const int k = at - _at[i - 1];
+            const node &n = _nodes[_top[i - 1]];
+            const node tail{CODE, 0, 0, n.first + k, n.count - k, n.count - k};
+            _nodes[_top[i - 1]].count = k;
+            _nodes[_top[i - 1]].size = k;
+            _nodes.push_back(tail);
+            if (_leaf == _top[i - 1]) {
+                _leaf = static_cast<int>(_nodes.size()) - 1;
+            }
+            _top.insert(_top.begin() + i, static_cast<int>(_nodes.size()) - 1);
+            _at.insert(_at.begin() + i, at);
+            return i;
+        }
+
+        // a new node with the ones from at on for its children, between the
+        // leaves before and after; returns it.
+        int wrap(const int at, const node_kind kind, const code_type *before, const int nb,
+                 const code_type *after, const int na) {
+            const int i = split(at);
+            const int first = static_cast<int>(_children.size());
+            if (nb) {
+                _children.push_back(leaf(before, nb));
+            }
+            _children.insert(_children.end(), _top.begin() + i, _top.end());
+            if (na) {
+                _children.push_back(leaf(after, na));
+            }
+            _offset += nb + na;
+            _nodes.push_back(node{kind, 0, 0, first, static_cast<int>(_children.size()) - first, _offset - at});
+            _top.resize(i);
+            _at.resize(i);
+            _top.push_back(static_cast<int>(_nodes.size()) - 1);
+            _at.push_back(at);
+            _leaf = -1;
+            return _top.back();
+        }
+
+        void alternate(const int from) {
+            wrap(from, ALTERNATE, nullptr, 0, nullptr, 0);
+        }
+
+        int store_branch(compile_state_type &cs, const opcodes op) {
+            const int at = cs.prec_stack.start();
+            code_type before[3], after[3];
+            jump(before, OP_PUSH_FAILURE, _offset - at + 3);
+            jump(after, op, 0); // close_alternates knows where to
+            const int n = wrap(at, BRANCH, before, 3, after, 3);
+            _nodes[n].arg = op;
+
+            const node &last = _nodes[children(_nodes[n])[_nodes[n].count - 1]];
+            _pending.push_back(pending{_offset - 2, last.first + 1, at, n});
+            cs.jump_stack.push(_offset - 2);
+            cs.prec_stack.start(_offset);
+            return 0;
+        }
+
+        // a negated class with one member is just the one negated test.
+        void store_not_class_item(const class_item &m);
+
+        void store_class_bitmap(const std::pmr::vector<class_item> &members, bool negated);
+
+        std::pmr::vector<node> _nodes;
+        std::pmr::vector<int> _children;
+        std::pmr::vector<code_type> _words;
+        std::pmr::vector<int> _top;
+        std::pmr::vector<int> _at; // the offset of each node at the top
+        std::pmr::vector<int> _groups; // where the open ones start
+        std::pmr::vector<pending> _pending;
+        int _offset;
+        int _closures;
+        bool _too_long;
+        int _leaf; // the last leaf, when store() can add to it
+    };
+
+    /////////////////////////////////////////////////////////////////////////
+    // a class with more than one member is stored as one instruction instead
+    // of a failure point for each member (or the OP_BACKUP/OP_FORWARD dance
+    // for a negated one); see compiled_code_vector for the bitmap. the members
+    // are stored the old way first, and taken back when they all fit in it.
+
+    template<class traitsT>
+    int re_ast<traitsT>::store_class(compile_state_type &cs) {
+        int start_offset = _offset;
+        cs.prec_stack.start(_offset);
+        cs.prec_stack.current(NUM_LEVELS - 1);
+        cs.prec_stack.start(_offset);
+
+        if (cs.input.get(cs.ch)) {
+            return -1;
+        }
+
+        cs.cclass_complement = false;
+        if (cs.ch == '^') {
+            cs.cclass_complement = true;
+            if (cs.input.get(cs.ch)) {
+                return -1;
+            }
+        }
+
+        std::pmr::vector<class_item> members(_nodes.get_allocator());
+        bool bitmap = true;
+        bool first_time_thru = true;
+        do {
+            if (!first_time_thru && !cs.cclass_complement) {
+                store_class_alternate(cs);
+            } else {
+                first_time_thru = false;
+            }
+            const int member_offset = _offset;
+
+            if (cs.ch == '\\') {
+                cs.input.get(cs.ch);
+                if (cs.syntax.translate_char_class_escaped_op(cs)) {
+                    return SYNTAX_ERROR;
+                }
+            } else if (cs.ch == '-' && cs.input.peek() != ']') {
+                store((cs.cclass_complement ? OP_NOT_CHAR : OP_CHAR), '-');
+            } else {
+                if (cs.input.peek() == '-') {
+                    code_type first_ch = cs.ch;
+                    if (cs.input.get(cs.ch)) {
+                        return -1;
+                    }
+                    if (cs.input.peek() == ']') {
+                        cs.input.unget(cs.ch);
+                        store((cs.cclass_complement ? OP_NOT_CHAR : OP_CHAR), first_ch);
+                    } else {
+                        if (cs.input.get(cs.ch)) {
+                            return -1;
+                        }
+                        store((cs.cclass_complement ? OP_NOT_RANGE_CHAR : OP_RANGE_CHAR));
+                        store(first_ch);
+                        store(cs.ch);
+                    }
+                } else {
+                    store((cs.cclass_complement ? OP_NOT_CHAR : OP_CHAR), cs.ch);
+                }
+            }
+
+            if (bitmap) {
+                bitmap = class_item::decode(code_at(member_offset), _offset - member_offset,
+                                            cs.cclass_complement, members);
+            }
+
+            if (cs.cclass_complement) {
+                store(OP_BACKUP);
+            }
+
+            if (cs.input.get(cs.ch)) {
+                return -1;
+            }
+        } while (cs.ch != ']');
+
+        if (bitmap && (members.size() > 1 || cs.cclass_complement)) {
+            // the alternatives' gotos go with them.
+            while (!cs.jump_stack.empty() && cs.jump_stack.top() >= start_offset) {
+                cs.jump_stack.pop();
+            }
+            truncate(start_offset);
+            if (members.size() > 1) {
+                store_class_bitmap(members, cs.cclass_complement);
+            } else {
+                store_not_class_item(members[0]);
+            }
+        } else if (cs.cclass_complement) {
+            store_concatenate(cs);
+        }
+
+        cs.prec_stack.start(start_offset);
+        return 0;
+    }
+
+    template<class traitsT>
+    void re_ast<traitsT>::store_not_class_item(const class_item &m) {
+        switch (m.op) {
+            case OP_CHAR:
+                store(OP_NOT_CHAR, static_cast<code_type>(m.lo));
+                break;
+            case OP_BIN_CHAR:
+                store(OP_NOT_BIN_CHAR, static_cast<code_type>(m.lo));
+                break;
+            case OP_RANGE_CHAR:
+                store(OP_NOT_RANGE_CHAR);
+                store(static_cast<code_type>(m.lo));
+                store(static_cast<code_type>(m.hi));
+                break;
+            default:
+                store(m.op, 1);
+                break;
+        }
+    }
+
+    template<class traitsT>
+    void re_ast<traitsT>::store_class_bitmap(const std::pmr::vector<class_item> &members, const bool negated) {
+        int bits[code_vector_type::CLASS_BITMAP] = {};
+        for (int c = 0; c < 256; c++) {
+            const int_type ch = static_cast<char_type>(c);
+            const bool in = std::any_of(members.begin(), members.end(), [ch](const class_item &m) {
+                return m.test(ch);
+            });
+            if (in != negated) {
+                bits[c / operands_type::BITS] |= 1 << (c % operands_type::BITS);
+            }
+        }
+
+        // wide characters need the ranges and flags when something is past
+        // the bitmap.
+        int flags = negated ? code_vector_type::CLASS_NOT : 0;
+        std::pmr::vector<class_item> ranges(_nodes.get_allocator());
+        for (const class_item &m: members) {
+            switch (m.op) {
+                case OP_DIGIT:
+                    flags |= code_vector_type::CLASS_DIGIT;
+                    break;
+                case OP_SPACE:
+                    flags |= code_vector_type::CLASS_SPACE;
+                    break;
+                case OP_WORD:
+                    flags |= code_vector_type::CLASS_WORD;
+                    break;
+                default:
+                    ranges.push_back(class_item{m.op, m.lo, m.op == OP_RANGE_CHAR ? m.hi : m.lo});
+                    break;
+            }
+        }
+        const bool wide = sizeof(char_type) > 1 && ((flags & ~code_vector_type::CLASS_NOT) != 0 || std::any_of(
+                              ranges.begin(), ranges.end(), [](const class_item &m) {
+                                  return m.lo < 0 || m.hi > 255;
+                              }));
+
+        if (!wide) {
+            store(negated ? OP_NOT_CLASS : OP_CLASS);
+        } else {
+            store(OP_RANGE_CLASS);
+            store_number(static_cast<int>(ranges.size()));
+            store(static_cast<code_type>(flags));
+        }
+        for (const int b: bits) {
+            store(static_cast<code_type>(b));
+        }
+        if (wide) {
+            for (const class_item &m: ranges) {
+                store(static_cast<code_type>(m.lo));
+                store(static_cast<code_type>(m.hi));
+            }
+        }
+    }
+
+    /////////////////////////////////////////////////////////////////////////
+    // x{n,m}, x{n,} and x{n}; the {n,m} is read here. the closure gets the
+    // next count slot.
+
+    template<class traitsT>
+    int re_ast<traitsT>::store_closure(compile_state_type &cs) {
+        int_type ch = 0;
+        if (cs.input.get(ch)) {
+            return -1;
+        }
+
+        int minimum = -1, maximum = -1;
+        if (ch == ',') {
+            if (cs.input.get(ch)) {
+                return -1;
+            }
+            minimum = 0;
+            maximum = cs.input.get_number(ch);
+        } else {
+            minimum = cs.input.get_number(ch);
+            maximum = 0;
+            if (ch == ',') {
+                if (cs.input.get(ch)) {
+                    return -1;
+                }
+                if (ch != '}') {
+                    maximum = cs.input.get_number(ch);
+                }
+            } else {
+                maximum = minimum;
+            }
+        }
+        if (!(minimum >= 0 && maximum >= 0)) {
+            return -1;
+        }
+
+        if (ch != '}') {
+            return -1;
+        }
+
+        // OP_CLOSURE goes past the OP_CLOSURE_INC, which goes back to what's
+        // after the OP_CLOSURE; the displacements are from the ends of their
+        // addresses.
+        const int at = cs.prec_stack.start();
+        const int s = _offset - at;
+        const int slot = _closures++;
+        code_type before[9], after[9];
+        jump(before, OP_CLOSURE, s + 9);
+        jump(after, OP_CLOSURE_INC, -s - 9);
+        for (code_type *cp: {before + 3, after + 3}) {
+            number(cp, minimum);
+            number(cp + 2, maximum);
+            number(cp + 4, slot);
+        }
+        const int n = wrap(at, CLOSURE, before, 9, after, 9);
+        _nodes[n].arg = minimum;
+        _nodes[n].arg2 = maximum;
+
+        cs.prec_stack.start(_offset);
+        return 0;
+    }
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include "traits.h"
+#include "engine.h"
+#include "syntax_perl.h"
+
+// times the backtracking matcher, in nanoseconds for each character of text.
+// bench.bin is built with the computed goto dispatch and bench_switch.bin with
+// -DRE_NO_COMPUTED_GOTO, run both to compare them.
+//
+// exec_match with partial matches always backtracks (the dfa, pike vm and
+// the rest only do full matches), and the texts are short enough that the
+// failure stack doesn't run out.
+
+using namespace re;
+using my_traits = re_char_traits<char>;
+using target_syntax = syntax_perl<my_traits>;
+
+struct bench_case {
+    const char *name;
+    const char *pattern;
+    std::string text;
+    bool caseless = false;
+};
+
+static std::string repeat(const std::string &s, size_t n) {
+    std::string out;
+    while (out.size() < n) {
+        out += s;
+    }
+    return out.substr(0, n);
+}
+
+static double time_case(const bench_case &bc, int rounds) {
+    re_engine<target_syntax> r;
+    if (r.exec_compile(bc.pattern) != 0) {
+        std::cout << "can't compile " << bc.pattern << std::endl;
+        return 0;
+    }
+    r.exec_caseless(bc.caseless, false);
+
+    re_match_vector matches;
+    int found = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        ctext<my_traits> text(bc.text.c_str(), bc.text.size());
+        found += r.exec_match(text, true, matches);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (found <= 0) {
+        std::cout << "no match for " << bc.pattern << std::endl;
+    }
+    const double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    return ns / (static_cast<double>(rounds) * bc.text.size());
+}
+
+int main(const int argc, char *argv[]) {
+    const int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    const bench_case cases[] = {
+        {"alternation", "(a|b|c)*d", repeat("abc", 1000) + "d"},
+        {"classes", "([a-z]+ [0-9]+,)*$", repeat("abc 123,", 1000)},
+        {"fields", "([^,]*,)*$", repeat("abc def,", 1000)},
+        {"identifiers", "([a-zA-Z_][a-zA-Z0-9_]* )*$", repeat("ident_1 Foo bar42 ", 18 * 200)},
+        {"counted", "(\\w{1,4}-)*\\.", repeat("wxyz-", 600) + "."},
+        {"literals", "(hello|help) (world|work)", "help work"},
+        {"groups", "((a)(b)(c))*x", repeat("abc", 900) + "x"},
+        {"runs", "(.*)=(\\w+) *$", repeat("key: value ", 3000) + "=value"},
+        {"short", "(\\w+)@(\\w+)\\.com", "joe@example.com"},
+        {"captures", "((\\d+)-(\\d+)-(\\d+) (\\w+) (\\w+) (\\w+) (\\w+) (\\w+),)*$",
+         repeat("2024-01-02 host app warn disk full,", 35 * 100)},
+        {"caseless", "((error|warning): [a-z]+ *,)*$", repeat("ErRoR: dIsK ,", 13 * 80), true},
+    };
+
+#if RE_COMPUTED_GOTO
+    std::cout << "dispatch: computed goto" << std::endl;
+#else
+    std::cout << "dispatch: switch" << std::endl;
+#endif
+    for (const auto &bc: cases) {
+        std::cout << std::left << std::setw(12) << bc.name << std::right << std::setw(8) << std::fixed
+                << std::setprecision(2) << time_case(bc, rounds) << " ns/char" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "program.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// re_bitstate backtracks through a re_program the same way exec_match does,
+	// but remembers every (key, position) it has been at in a bitset. getting
+	// back to one of those means getting to the same failure again, so it's
+	// never tried twice; the time is bounded by the number of keys times the
+	// length of the text, and the groups are the ones exec_match would find.
+	//
+	// the bitset is one bit for each key and position, so this is for short
+	// text; fits() says if it's short enough. it's only cleared as far into the
+	// text as the last exec got, a start that fails straight away costs next to
+	// nothing.
+
+	template<class traitsT>
+	class re_bitstate {
+	public:
+		typedef traitsT traits_type;
+		typedef typename traits_type::char_type char_type;
+		typedef re_program<traitsT> program_type;
+
+		enum { NO_MATCH = -1, GAVE_UP = -2 };
+
+		enum { LIMIT = 256 * 1024 * 8 }; // most bits
+
+		// the text this is for. when that doesn't fit (the program has too many
+		// keys) exec_match has the pike vm do it instead of backtracking.
+		enum { SHORT = 4096 };
+
+	private:
+		typedef typename program_type::node node;
+		typedef typename program_type::frame frame;
+
+	public:
+		// what exec works in, kept from call to call like re_pike::buffers. the
+		// words of visited past used are always clear.
+		struct buffers {
+			std::vector<uint64_t> visited;
+			size_t used = 0;
+			std::vector<frame> stack;
+			std::vector<int> regs;
+		};
+
+		explicit re_bitstate(const program_type &program) : _program(program) {}
+
+		// is the bitset for text from pos to end small enough?
+		bool fits(int pos, int end) const {
+			return _program.valid()
+			       && static_cast<long long>(_program.keys()) * (end - pos + 1) <= LIMIT;
+		}
+
+		// the same as re_pike::exec.
+		int exec(const char_type *buffer, int pos, int last, int end, bool caseless,
+		         buffers &work, std::vector<int> &slots) const;
+
+		int exec(const char_type *buffer, int pos, int last, int end, bool caseless,
+		         std::vector<int> &slots) const {
+			buffers work;
+			return exec(buffer, pos, last, end, caseless, work, slots);
+		}
+
+	private:
+		const program_type &_program;
+	};
+
+	template<class traitsT>
+	int re_bitstate<traitsT>::exec(const char_type *buffer, const int pos, const int last, const int end,
+	                               const bool caseless, buffers &work, std::vector<int> &slots) const {
+		if (!fits(pos, end)) {
+			return GAVE_UP;
+		}
+
+		const int nregs = _program.registers();
+		const int nslots = _program.slots();
+		const size_t keys = _program.keys();
+		std::vector<uint64_t> &visited = work.visited;
+		std::fill(visited.begin(), visited.begin() + work.used, 0);
+		work.used = 0;
+		std::vector<frame> &stack = work.stack;
+		std::vector<int> &regs = work.regs;
+		regs.resize(nregs);
+
+		// a failure from a key and position is the same failure whatever the
+		// start, so the bitset is kept from one start to the next.
+		for (int start = pos; start <= last; start++) {
+			std::fill(regs.begin(), regs.begin() + nslots, -1);
+			std::fill(regs.begin() + nslots, regs.end(), 0);
+			regs[0] = start;
+			stack.assign(1, frame{0, start, 0, 0});
+			while (!stack.empty()) {
+				const frame f = stack.back();
+				stack.pop_back();
+				if (f.pc < 0) {
+					regs[f.reg] = f.value;
+					continue;
+				}
+				for (int pc = f.pc, at = f.at; pc >= 0;) {
+					const size_t bit = (at - pos) * keys + _program.key(pc, regs.data());
+					const uint64_t mask = uint64_t(1) << (bit % 64);
+					if (bit / 64 >= work.used) {
+						work.used = ((at - pos + 1) * keys + 63) / 64;
+						if (work.used > visited.size()) {
+							visited.resize(work.used, 0);
+						}
+					} else if (visited[bit / 64] & mask) {
+						break;
+					}
+					visited[bit / 64] |= mask;
+
+					const node &nd = _program[pc];
+					switch (nd.what) {
+						case program_type::MATCH:
+							slots.assign(regs.begin(), regs.begin() + nslots);
+							slots[1] = at;
+							return start;
+
+						case program_type::TEST:
+						case program_type::CHAR:
+							if (at < end && _program.test(nd, buffer[at], caseless)) {
+								++at;
+								pc = nd.next;
+							} else {
+								pc = -1;
+							}
+							break;
+
+						default:
+							pc = _program.step(pc, regs.data(), buffer, at, end, stack);
+							break;
+					}
+				}
+			}
+		}
+		return NO_MATCH;
+	}
+}
@@ -1,17 +1,72 @@
 
 #pragma once
 
+#include <climits>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
 #include "tokens.h"
 
 namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// the code is made of code words, the character type unless the traits say
+	// otherwise (a code_type typedef, see re_wide_code_traits). jumps and numbers
+	// are two code words each; with char code words that's 16 bits, big enough
+	// for most things and compact. wider code words hold 16 bits each, so 32 bit
+	// jumps and counts, for huge expressions. the instructions are the same
+	// length either way.
+
+	template<class traitsT, class = void>
+	struct code_word {
+		typedef typename traitsT::char_type type;
+	};
+
+	template<class traitsT>
+	struct code_word<traitsT, std::void_t<typename traitsT::code_type> > {
+		typedef typename traitsT::code_type type;
+	};
+
+	template<class codeT>
+	struct code_operands {
+		typedef typename std::make_unsigned<codeT>::type unsigned_type;
+		typedef typename std::make_signed<codeT>::type signed_type;
+
+		enum { BITS = (sizeof(codeT) > 1) ? 16 : 8 }; // in each code word
+
+		static constexpr long long ADDRESS_LIMIT = 1LL << (2 * BITS - 1); // jumps are -limit..limit-1
+		static constexpr long long NUMBER_LIMIT = (2 * BITS < 32) ? (1LL << (2 * BITS)) - 1 : INT_MAX;
+
+		// a code word that's a number on its own (a group), not a character.
+		static int unit(const codeT c) {
+			return static_cast<int>(static_cast<unsigned_type>(c));
+		}
+
+		static void put(codeT *cp, const long long n) {
+			cp[0] = static_cast<codeT>(n & ((1 << BITS) - 1));
+			cp[1] = static_cast<codeT>(n >> BITS);
+		}
+
+		static int address(const codeT *&cp) {
+			const int lo = unit(*cp++) & ((1 << BITS) - 1);
+			const long long hi = static_cast<signed_type>(*cp++);
+			return static_cast<int>(hi * (1LL << BITS) + lo);
+		}
+
+		static int number(const codeT *&cp) {
+			const int lo = unit(*cp++) & ((1 << BITS) - 1);
+			const long long hi = unit(*cp++);
+			return static_cast<int>(std::min<long long>(hi << BITS | lo, INT_MAX));
+		}
+	};
+
 	template<class traitsT>
 	class compiled_code_vector {
 	public:
 		typedef traitsT traits_type;
 		typedef typename traits_type::char_type char_type;
 		typedef typename traits_type::int_type int_type;
-		typedef typename traits_type::char_type code_type;
-		typedef compile_state<traitsT> compile_state_type;
+		typedef typename code_word<traitsT>::type code_type;
+		typedef code_operands<code_type> operands_type;
 
 		compiled_code_vector() {
 			initialize();
@@ -31,6 +86,8 @@ namespace re {
 	private:
 		void initialize() {
 			_offset = 0;
+			_closures = 0;
+			_too_long = false;
 			std::fill(_code_vector.begin(), _code_vector.end(), 0);
 		}
 
@@ -50,8 +107,23 @@ namespace re {
 			return start;
 		}
 
+		void reserve(const int n) {
+			_code_vector.reserve(n);
+		}
+
+		// n code words at once; re_ast lays all of the compiled code out this way.
+		int store_words(const code_type *cp, const int n) {
+			const auto start = _offset;
+			_code_vector.insert(_code_vector.end(), cp, cp + n);
+			_offset += n;
+			return start;
+		}
+
 		void put_address(int off, const int addr) {
 			const int dsp = addr - off - 2;
+			if (dsp < -operands_type::ADDRESS_LIMIT || dsp >= operands_type::ADDRESS_LIMIT) {
+				_too_long = true;
+			}
 
 #if 0
 			std::cout << "put_address " << " count=" << _code_vector.size() << std::endl;
@@ -61,8 +133,7 @@ namespace re {
 					<< " [" << off << "]:" << static_cast<unsigned int>(dsp & 0xFF)
 					<< " [" << off+1 << "]:" << static_cast<unsigned int>((dsp >> 8) & 0xFF) << std::endl;
 #endif
-			_code_vector[off] = static_cast<code_type>(dsp & 0xFF);
-			_code_vector[off + 1] = static_cast<code_type>((dsp >> 8) & 0xFF);
+			operands_type::put(_code_vector.data() + off, dsp);
 #if 0
 			dump_code(std::cout);
 			std::cout << " end put_address" << std::endl << std::endl;
@@ -79,184 +150,207 @@ namespace re {
 			return _offset;
 		}
 
-		const code_type *code() const {
-			return _code_vector.data();
+		// did a jump or a number not fit in its code words? the code is no
+		// good then; exec_compile says EXPRESSION_TOO_LONG.
+		bool too_long() const {
+			return _too_long;
 		}
 
-		int store_alternate(compile_state_type &cs) {
-			store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE, offset() + 6);
-			store(OP_GOTO);
-			cs.jump_stack.push(offset());
-			store(0);
-			store(0);
-			cs.prec_stack.start(offset());
-			return 0;
+		void too_long(const bool b) {
+			_too_long = _too_long || b;
 		}
 
-		int store_class_alternate(compile_state_type &cs) {
-			store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE, offset() + 6);
-			store(OP_POP_FAILURE_GOTO);
-			cs.jump_stack.push(offset());
-			store(0);
-			store(0);
-			cs.prec_stack.start(offset());
-			return 0;
+		// how many {n,m} closures there are; each has a count slot, numbered
+		// from 0, stored with its OP_CLOSURE and OP_CLOSURE_INC.
+		int closures() const {
+			return _closures;
 		}
 
-		int store_concatenate(compile_state_type &cs) {
-			store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE2, _offset + 4);
-			store(OP_FORWARD);
-			cs.prec_stack.start(offset());
-			store(OP_POP_FAILURE);
-			return 0;
+		void closures(const int n) {
+			_closures = std::max(_closures, n);
 		}
 
-		int store_class(compile_state_type &cs) {
-			int start_offset = _offset;
-			cs.prec_stack.start(_offset);
-			cs.prec_stack.current(NUM_LEVELS - 1);
-			cs.prec_stack.start(_offset);
-
-			if (cs.input.get(cs.ch)) {
-				return -1;
-			}
+		const code_type *code() const {
+			return _code_vector.data();
+		}
 
-			cs.cclass_complement = false;
-			if (cs.ch == '^') {
-				cs.cclass_complement = true;
-				if (cs.input.get(cs.ch)) {
-					return -1;
-				}
+		/////////////////////////////////////////////////////////////////////////
+		// a class with more than one member is stored (see re_ast::store_class)
+		// as one instruction instead of a failure point for each member (or the
+		// OP_BACKUP/OP_FORWARD dance for a negated one); a bitmap of the
+		// characters 0..255, so testing a character is one load:
+		//
+		//	OP_CLASS, OP_NOT_CLASS	bitmap
+		//	OP_RANGE_CLASS	count (a number), flags, bitmap, count ranges (lo, hi)
+		//
+		// there are BITS bits in each code word of the bitmap, and a negated
+		// class has it turned around already. OP_RANGE_CLASS is for wide
+		// characters, the ones past the bitmap are looked for in the ranges and
+		// the \d, \s, \w flags (and CLASS_NOT turns that around).
+
+		enum { CLASS_BITMAP = 256 / operands_type::BITS };
+
+		enum { CLASS_DIGIT = 1, CLASS_SPACE = 2, CLASS_WORD = 4, CLASS_NOT = 8 };
+
+		static int class_length(const code_type *cp) {
+			if (*cp != OP_RANGE_CLASS) {
+				return 1 + CLASS_BITMAP;
 			}
+			const code_type *np = cp + 1;
+			return 4 + CLASS_BITMAP + 2 * operands_type::number(np);
+		}
 
-			bool first_time_thru = true;
-			do {
-				if (!first_time_thru && !cs.cclass_complement) {
-					store_class_alternate(cs);
-				} else {
-					first_time_thru = false;
-				}
-
-				if (cs.ch == '\\') {
-					cs.input.get(cs.ch);
-					if (cs.syntax.translate_char_class_escaped_op(cs)) {
-						return SYNTAX_ERROR;
-					}
-				} else if (cs.ch == '-' && cs.input.peek() != ']') {
-					store((cs.cclass_complement ? OP_NOT_CHAR : OP_CHAR), '-');
-				} else {
-					if (cs.input.peek() == '-') {
-						code_type first_ch = cs.ch;
-						if (cs.input.get(cs.ch)) {
-							return -1;
-						}
-						if (cs.input.peek() == ']') {
-							cs.input.unget(cs.ch);
-							store((cs.cclass_complement ? OP_NOT_CHAR : OP_CHAR), first_ch);
-						} else {
-							if (cs.input.get(cs.ch)) {
-								return -1;
-							}
-							store((cs.cclass_complement ? OP_NOT_RANGE_CHAR : OP_RANGE_CHAR));
-							store(first_ch);
-							store(cs.ch);
-						}
-					} else {
-						store((cs.cclass_complement ? OP_NOT_CHAR : OP_CHAR), cs.ch);
-					}
-				}
-
-				if (cs.cclass_complement) {
-					store(OP_BACKUP);
-				}
+		static bool class_negated(const code_type *cp) {
+			return *cp == OP_NOT_CLASS || (*cp == OP_RANGE_CLASS && (operands_type::unit(cp[3]) & CLASS_NOT));
+		}
 
-				if (cs.input.get(cs.ch)) {
-					return -1;
+		// does the class accept ch? cp is the OP_CLASS, OP_NOT_CLASS or
+		// OP_RANGE_CLASS.
+		static bool class_member(const code_type *cp, const int_type ch) {
+			const auto c = static_cast<typename std::make_unsigned<char_type>::type>(ch);
+			const code_type *bits = cp + ((*cp == OP_RANGE_CLASS) ? 4 : 1);
+			if (c < 256) {
+				return (operands_type::unit(bits[c / operands_type::BITS]) >> (c % operands_type::BITS)) & 1;
+			}
+			if (*cp != OP_RANGE_CLASS) {
+				return *cp == OP_NOT_CLASS;
+			}
+			const code_type *np = cp + 1;
+			const int count = operands_type::number(np);
+			const int flags = operands_type::unit(*np);
+			const bool negated = (flags & CLASS_NOT) != 0;
+			if (((flags & CLASS_DIGIT) && traits_type::isdigit(ch))
+			    || ((flags & CLASS_SPACE) && traits_type::isspace(ch))
+			    || ((flags & CLASS_WORD) && traits_type::isalnum(ch))) {
+				return !negated;
+			}
+			const code_type *rp = bits + CLASS_BITMAP;
+			for (int i = 0; i < count; i++, rp += 2) {
+				if (ch >= static_cast<int_type>(rp[0]) && ch <= static_cast<int_type>(rp[1])) {
+					return !negated;
 				}
-			} while (cs.ch != ']');
-
-			if (cs.cclass_complement) {
-				store_concatenate(cs);
 			}
-
-			cs.prec_stack.start(start_offset);
-			return 0;
+			return negated;
 		}
 
-		void store_closure_count(compile_state_type &cs, int pos, const int addr, const int mi, const int mx) {
-			constexpr int skip = 7;
-			_code_vector.insert(_code_vector.begin() + pos, skip, 0);
-			_code_vector[pos++] = static_cast<code_type>(OP_CLOSURE);
-			put_address(pos, addr);
-			pos += 2;
-			put_number(pos, mi);
-			pos += 2;
-			put_number(pos, mx);
-			_offset += skip;
-
-			store_jump(_offset, OP_CLOSURE_INC, cs.prec_stack.start() + 3);
-			put_number(_offset, mi);
-			_offset += 2;
-			put_number(_offset, mx);
-			_offset += 2;
+		// the same, with caseless compares: a class accepts ch when it has one
+		// of its cases (lower caseless ones only go from upper case to lower),
+		// a negated class when it has none of them.
+		static bool class_test(const code_type *cp, const int_type ch, const bool caseless,
+		                       const bool lower_caseless) {
+			const bool negated = class_negated(cp);
+			auto has = [&](const int_type c) { return class_member(cp, c) != negated; };
+			bool found = has(ch);
+			if (!found && caseless) {
+				found = has(traits_type::toupper(ch)) || has(traits_type::tolower(ch));
+			} else if (!found && lower_caseless) {
+				found = traits_type::tolower(ch) != ch && has(traits_type::tolower(ch));
+			}
+			return found != negated;
+		}
 
-			cs.prec_stack.start(_offset); // is this right? look at other that place this earlier
+		// does the pattern character c accept ch? the same cases as class_test,
+		// so "a" takes "A" with lower caseless compares and "A" doesn't take "a".
+		static bool char_test(const int_type c, const int_type ch, const bool caseless, const bool lower_caseless) {
+			if (ch == c) {
+				return true;
+			}
+			if (caseless) {
+				return traits_type::toupper(ch) == traits_type::toupper(c);
+			}
+			return lower_caseless && traits_type::tolower(ch) == c;
 		}
 
-		int store_closure(compile_state_type &cs) {
-			int_type ch = 0;
-			if (cs.input.get(ch)) {
-				return -1;
+		// and a range of them, lo..hi.
+		static bool range_test(const int_type lo, const int_type hi, const int_type ch, const bool caseless,
+		                       const bool lower_caseless) {
+			auto in = [lo, hi](const int_type c) { return c >= lo && c <= hi; };
+			if (in(ch)) {
+				return true;
+			}
+			if (caseless) {
+				return in(traits_type::toupper(ch)) || in(traits_type::tolower(ch));
 			}
+			return lower_caseless && traits_type::tolower(ch) != ch && in(traits_type::tolower(ch));
+		}
 
-			int minimum = -1, maximum = -1;
-			if (ch == ',') {
-				if (cs.input.get(ch)) {
-					return -1;
-				}
-				minimum = 0;
-				maximum = cs.input.get_number(ch);
-			} else {
-				minimum = cs.input.get_number(ch);
-				maximum = 0;
-				if (ch == ',') {
-					if (cs.input.get(ch)) {
-						return -1;
-					}
-					if (ch != '}') {
-						maximum = cs.input.get_number(ch);
-					}
+		// the members of a class for dump_code, like "0-9_a-z" or "^,".
+		static std::string class_string(const code_type *cp) {
+			const bool negated = class_negated(cp);
+			std::string out = negated ? "^" : "";
+			auto put = [&out](const long c) {
+				if (c >= ' ' && c < 127) {
+					out += static_cast<char>(c);
 				} else {
-					maximum = minimum;
+					std::string hex;
+					for (unsigned long v = c; hex.empty() || v != 0; v >>= 4) {
+						hex.insert(hex.begin(), "0123456789abcdef"[v & 15]);
+					}
+					out += "\\x" + hex;
 				}
+			};
+			for (int c = 0; c < 256;) {
+				int last = c;
+				while (last < 256 && class_member(cp, static_cast<char_type>(last)) != negated) {
+					last++;
+				}
+				if (last == c) {
+					c++;
+					continue;
+				}
+				put(c);
+				if (last - c > 2) {
+					out += '-';
+				}
+				if (last - c > 1) {
+					put(last - 1);
+				}
+				c = last;
 			}
-			if (!(minimum >= 0 && maximum >= 0)) {
-				return -1;
-			}
-
-			if (ch != '}') {
-				return -1;
+			if (*cp == OP_RANGE_CLASS) {
+				const code_type *np = cp + 1;
+				const int count = operands_type::number(np);
+				const int flags = operands_type::unit(*np);
+				out += (flags & CLASS_DIGIT) ? "\\d" : "";
+				out += (flags & CLASS_SPACE) ? "\\s" : "";
+				out += (flags & CLASS_WORD) ? "\\w" : "";
+				for (const code_type *rp = np + 1 + CLASS_BITMAP; rp < np + 1 + CLASS_BITMAP + 2 * count; rp += 2) {
+					out += " ";
+					put(rp[0]);
+					out += '-';
+					put(rp[1]);
+				}
 			}
+			return out;
+		}
 
-			store_closure_count(cs, cs.prec_stack.start(), _offset + 10, minimum, maximum);
-			return 0;
+		// an OP_CLOSURE or OP_CLOSURE_INC with room for its address (put_address
+		// at the returned offset + 1), for code that's put together rather than
+		// compiled (see optimizer.h).
+		int store_closure_op(opcodes op, const int mi, const int mx, const int slot) {
+			const int start = store(op);
+			store(0);
+			store(0);
+			_code_vector.insert(_code_vector.end(), 6, 0);
+			put_number(_offset, mi);
+			put_number(_offset + 2, mx);
+			put_number(_offset + 4, slot);
+			_offset += 6;
+			_closures = std::max(_closures, slot + 1);
+			return start;
 		}
 
-		static int decode_address_and_advance(const char *&cp) {
-			short r = *cp++;
-			r |= *cp++ << 8;
-			return r;
+		static int decode_address_and_advance(const code_type *&cp) {
+			return operands_type::address(cp);
 		}
 
-		static int decode_address_and_advance(const wchar_t *&cp) {
-			wint_t r = *cp++;
-			r |= *cp++ << 8;
-			return r;
+		static int decode_number_and_advance(const code_type *&cp) {
+			return operands_type::number(cp);
 		}
 
 		void dump_code(std::ostream &out) const {
 			auto code = *this;
-			const char_type *cp = code.code();
+			const code_type *cp = code.code();
 			int pos = 0;
 			while ((pos = cp - code.code()) < code.offset()) {
 				out << '\t' << pos << '\t';
@@ -307,6 +401,14 @@ namespace re {
 						out << "OP_CHAR (" << static_cast<char>(*cp++) << ")\n";
 						break;
 
+					case OP_STRING: {
+						const int n = *cp++;
+						out << "OP_STRING (" << n << ", ";
+						out << std::basic_string<char_type>(cp, n) << ")\n";
+						cp += n;
+						break;
+					}
+
 					case OP_NOT_CHAR:
 						out << "OP_NOT_CHAR (" << static_cast<char>(*cp++) << ")\n";
 						break;
@@ -325,16 +427,23 @@ namespace re {
 						out << ',' << static_cast<char>(*cp++) << ")\n";
 						break;
 
+					case OP_CLASS:
+					case OP_NOT_CLASS:
+					case OP_RANGE_CLASS:
+						out << opcode_to_string(cp[-1]) << " (" << class_string(cp - 1) << ")\n";
+						cp += class_length(cp - 1) - 1;
+						break;
+
 					case OP_BACKREF_BEGIN:
-						out << "OP_BACKREF_BEGIN (" << static_cast<int>(*cp++) << ")\n";
+						out << "OP_BACKREF_BEGIN (" << operands_type::unit(*cp++) << ")\n";
 						break;
 
 					case OP_BACKREF_END:
-						out << "OP_BACKREF_END (" << static_cast<int>(*cp++) << ")\n";
+						out << "OP_BACKREF_END (" << operands_type::unit(*cp++) << ")\n";
 						break;
 
 					case OP_BACKREF:
-						out << "OP_BACKREF (" << static_cast<int>(*cp++) << ")\n";
+						out << "OP_BACKREF (" << operands_type::unit(*cp++) << ")\n";
 						break;
 
 					case OP_BACKREF_FAIL:
@@ -343,14 +452,16 @@ namespace re {
 
 					case OP_CLOSURE:
 						out << "OP_CLOSURE (" << decode_address_and_advance(cp) << ") ";
-						out << "{" << decode_address_and_advance(cp) << ",";
-						out << decode_address_and_advance(cp) << "}" << std::endl;
+						out << "{" << decode_number_and_advance(cp) << ",";
+						out << decode_number_and_advance(cp) << "}";
+						out << " [" << decode_number_and_advance(cp) << "]" << std::endl;
 						break;
 
 					case OP_CLOSURE_INC:
 						out << "OP_CLOSURE_INC (" << decode_address_and_advance(cp) << ")";
-						out << " {" << decode_address_and_advance(cp) << ",";
-						out << decode_address_and_advance(cp) << "}" << std::endl;
+						out << " {" << decode_number_and_advance(cp) << ",";
+						out << decode_number_and_advance(cp) << "}";
+						out << " [" << decode_number_and_advance(cp) << "]" << std::endl;
 						break;
 
 					case OP_TEST_CLOSURE:
@@ -393,6 +504,14 @@ namespace re {
 						out << "OP_NOOP" << std::endl;
 						break;
 
+					case OP_ATOMIC_BEGIN:
+						out << "OP_ATOMIC_BEGIN" << std::endl;
+						break;
+
+					case OP_ATOMIC_END:
+						out << "OP_ATOMIC_END" << std::endl;
+						break;
+
 					default:
 						out << "BAD CASE" << std::endl;
 						break;
@@ -402,13 +521,17 @@ namespace re {
 
 	private:
 		void put_number(int pos, const int n) {
-			_code_vector[pos++] = static_cast<code_type>(n & 0xFF);
-			_code_vector[pos] = static_cast<code_type>((n >> 8) & 0xFF);
+			if (n < 0 || n > operands_type::NUMBER_LIMIT) {
+				_too_long = true;
+			}
+			operands_type::put(_code_vector.data() + pos, n);
 		}
 
 	public:
 		std::vector<code_type> _code_vector;
 		int _offset = 0;
+		int _closures = 0;
+		bool _too_long = false;
 		int _character_class_org = 0;
 	};
 }
@@ -0,0 +1,575 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include "tokens.h"
+#include "code.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// code_graph is a compiled expression turned into a flow graph, one node per
+	// instruction, for the analysis done by re_engine::exec_study (and the
+	// reversed code it keeps for exec_search). failure points
+	// are edges just like gotos are, because when matching either path can be the
+	// one that's taken.
+	//
+	// a negated class (OP_PUSH_FAILURE2 ... OP_FORWARD, OP_POP_FAILURE) is
+	// treated as a single node that consumes one character and continues at the
+	// OP_POP_FAILURE; the OP_NOT_xxx/OP_BACKUP pairs inside are left unreachable.
+	// (store_class only leaves these for classes it can't make into an
+	// OP_NOT_CLASS.)
+	//
+	// node 0 is always the first instruction.
+
+	template<class traitsT>
+	class code_graph {
+	public:
+		typedef traitsT traits_type;
+		typedef typename traits_type::char_type char_type;
+		typedef typename traits_type::int_type int_type;
+		typedef compiled_code_vector<traitsT> code_vector_type;
+		typedef typename code_vector_type::code_type code_type;
+
+		static constexpr int UNBOUNDED = -1;
+
+		explicit code_graph(const code_vector_type &code);
+
+		// false if a jump lands somewhere that isn't an instruction.
+		bool valid() const { return _valid; }
+
+		int size() const { return static_cast<int>(_offset.size()); }
+
+		int offset(const int n) const { return _offset[n]; }
+
+		// node for an offset into the code, or -1 if it's not the start of an instruction.
+		int node(const int off) const {
+			return (off >= 0 && off < static_cast<int>(_node.size())) ? _node[off] : -1;
+		}
+
+		code_type op(const int n) const { return _code[_offset[n]]; }
+
+		const code_type *code(const int n) const { return _code + _offset[n]; }
+
+		const std::vector<int> &successors(const int n) const { return _succ[n]; }
+
+		const std::vector<int> &predecessors(const int n) const { return _pred[n]; }
+
+		bool reachable(const int n) const { return _reachable[n]; }
+
+		// the (reachable) OP_END node, -1 if there isn't one.
+		int end() const { return _end; }
+
+		// characters consumed by the node, UNBOUNDED for a backref.
+		int consumes(int n) const;
+
+		// immediate dominator of every node, entry is its own; -1 for unreachable nodes.
+		std::vector<int> dominators() const;
+
+		// least and most characters consumed on the way from the entry to the node.
+		int min_distance(int to) const;
+
+		int max_distance(int to) const;
+
+		// nodes that can get to "to" without going through it, and "to" itself.
+		std::vector<bool> leads_to(int to) const;
+
+		// store code that runs the part of the graph in front of "to" backwards;
+		// it starts just in front of "to" and gets to its OP_END when it's back
+		// at the entry. false if something in there can't be run backwards, like
+		// closures, backrefs and anchors.
+		bool reverse(int to, code_vector_type &out) const;
+
+		static int instruction_length(const code_type *cp);
+
+		// does the instruction accept ch? 1 or 0, -1 if it doesn't test a single
+		// character.
+		static int char_test(const code_type *cp, int_type ch);
+
+		static int jump_target(const code_type *base, int off);
+
+	private:
+		void link(int from, int to_offset);
+
+		const code_type *_code;
+		std::vector<int> _offset;
+		std::vector<int> _node;
+		std::vector<std::vector<int> > _succ;
+		std::vector<std::vector<int> > _pred;
+		std::vector<bool> _reachable;
+		int _end;
+		bool _valid;
+	};
+
+	template<class traitsT>
+	int code_graph<traitsT>::instruction_length(const code_type *cp) {
+		switch (*cp) {
+			case OP_STRING:
+				return 2 + cp[1];
+
+			case OP_BIN_CHAR:
+			case OP_NOT_BIN_CHAR:
+			case OP_CHAR:
+			case OP_NOT_CHAR:
+			case OP_BACKREF_BEGIN:
+			case OP_BACKREF_END:
+			case OP_BACKREF:
+			case OP_EXT_BEGIN:
+			case OP_EXT_END:
+			case OP_EXT:
+			case OP_NOT_EXT:
+			case OP_DIGIT:
+			case OP_SPACE:
+			case OP_WORD:
+			case OP_WORD_BOUNDARY:
+				return 2;
+
+			case OP_RANGE_CHAR:
+			case OP_NOT_RANGE_CHAR:
+			case OP_GOTO:
+			case OP_PUSH_FAILURE:
+			case OP_PUSH_FAILURE2:
+			case OP_POP_FAILURE_GOTO:
+			case OP_FAKE_FAILURE_GOTO:
+				return 3;
+
+			case OP_CLOSURE:
+			case OP_CLOSURE_INC:
+				return 9;
+
+			case OP_CLASS:
+			case OP_NOT_CLASS:
+			case OP_RANGE_CLASS:
+				return code_vector_type::class_length(cp);
+
+			default:
+				return 1;
+		}
+	}
+
+	// mirrors the tests in exec_match. a negated class (OP_PUSH_FAILURE2 up to the
+	// OP_FORWARD) accepts whatever passes all of its members.
+	template<class traitsT>
+	int code_graph<traitsT>::char_test(const code_type *cp, const int_type ch) {
+		switch (*cp) {
+			case OP_CHAR:
+			case OP_BIN_CHAR:
+				return ch == static_cast<char_type>(cp[1]);
+			case OP_NOT_CHAR:
+			case OP_NOT_BIN_CHAR:
+				return ch != static_cast<char_type>(cp[1]);
+			case OP_RANGE_CHAR:
+				return ch >= cp[1] && ch <= cp[2];
+			case OP_NOT_RANGE_CHAR:
+				return !(ch >= cp[1] && ch <= cp[2]);
+			case OP_CLASS:
+			case OP_NOT_CLASS:
+			case OP_RANGE_CLASS:
+				return code_vector_type::class_member(cp, ch);
+			case OP_ANY_CHAR:
+				return ch != '\n';
+			case OP_DIGIT:
+				return cp[1] ? !traits_type::isdigit(ch) : traits_type::isdigit(ch) != 0;
+			case OP_SPACE:
+				return cp[1] ? !traits_type::isspace(ch) : traits_type::isspace(ch) != 0;
+			case OP_WORD:
+				return cp[1] ? !traits_type::isalnum(ch) : traits_type::isalnum(ch) != 0;
+			case OP_PUSH_FAILURE2:
+				for (cp += 3; *cp != OP_FORWARD;) {
+					const int r = char_test(cp, ch);
+					if (r <= 0) {
+						return r;
+					}
+					cp += instruction_length(cp);
+					if (*cp++ != OP_BACKUP) {
+						return -1;
+					}
+				}
+				return 1;
+			default:
+				return -1;
+		}
+	}
+
+	// the address a goto, failure point or closure refers to. displacements are
+	// relative to the end of the instruction (closures decode all three operands
+	// before jumping).
+	template<class traitsT>
+	int code_graph<traitsT>::jump_target(const code_type *base, const int off) {
+		const code_type *cp = base + off + 1;
+		const int dsp = code_vector_type::decode_address_and_advance(cp);
+		return off + instruction_length(base + off) + dsp;
+	}
+
+	template<class traitsT>
+	code_graph<traitsT>::code_graph(const code_vector_type &code)
+		: _code(code.code()), _node(code.offset() + 1, -1), _end(-1), _valid(true) {
+		const int code_end = code.offset();
+		for (int at = 0; at < code_end; at += instruction_length(_code + at)) {
+			_node[at] = size();
+			_offset.push_back(at);
+		}
+
+		_succ.resize(size());
+		_pred.resize(size());
+		for (int n = 0; n < size(); n++) {
+			const code_type *cp = _code + _offset[n];
+			const int next = _offset[n] + instruction_length(cp);
+			switch (*cp) {
+				case OP_END:
+					break;
+
+				case OP_GOTO:
+				case OP_POP_FAILURE_GOTO:
+				case OP_FAKE_FAILURE_GOTO: // the failure point it pushes is never used.
+				case OP_PUSH_FAILURE2: // a whole negated class.
+					link(n, jump_target(_code, _offset[n]));
+					break;
+
+				case OP_PUSH_FAILURE:
+					link(n, next);
+					link(n, jump_target(_code, _offset[n]));
+					break;
+
+				case OP_CLOSURE: {
+					const code_type *mp = cp + 3;
+					link(n, next);
+					if (code_vector_type::decode_number_and_advance(mp) == 0) {
+						link(n, jump_target(_code, _offset[n])); // {0,n} can be skipped
+					}
+					break;
+				}
+
+				case OP_CLOSURE_INC:
+					link(n, jump_target(_code, _offset[n]));
+					link(n, next);
+					break;
+
+				default:
+					link(n, next);
+					break;
+			}
+		}
+
+		_reachable.assign(size(), false);
+		if (size() == 0) {
+			_valid = false;
+			return;
+		}
+		std::vector<int> pending(1, 0);
+		_reachable[0] = true;
+		while (!pending.empty()) {
+			const int n = pending.back();
+			pending.pop_back();
+			if (op(n) == OP_END && _end == -1) {
+				_end = n;
+			}
+			for (int s: _succ[n]) {
+				if (!_reachable[s]) {
+					_reachable[s] = true;
+					pending.push_back(s);
+				}
+			}
+		}
+	}
+
+	template<class traitsT>
+	void code_graph<traitsT>::link(const int from, const int to_offset) {
+		const int to = node(to_offset);
+		if (to < 0) {
+			_valid = false;
+			return;
+		}
+		_succ[from].push_back(to);
+		_pred[to].push_back(from);
+	}
+
+	template<class traitsT>
+	int code_graph<traitsT>::consumes(const int n) const {
+		switch (op(n)) {
+			case OP_STRING:
+				return code(n)[1];
+
+			case OP_BIN_CHAR:
+			case OP_NOT_BIN_CHAR:
+			case OP_ANY_CHAR:
+			case OP_CHAR:
+			case OP_NOT_CHAR:
+			case OP_RANGE_CHAR:
+			case OP_NOT_RANGE_CHAR:
+			case OP_CLASS:
+			case OP_NOT_CLASS:
+			case OP_RANGE_CLASS:
+			case OP_DIGIT:
+			case OP_SPACE:
+			case OP_WORD:
+			case OP_PUSH_FAILURE2:
+				return 1;
+
+			case OP_BACKREF:
+			case OP_EXT:
+			case OP_NOT_EXT:
+				return UNBOUNDED;
+
+			default:
+				return 0;
+		}
+	}
+
+	// cooper, harvey and kennedy's "a simple, fast dominance algorithm"; iterate
+	// over the nodes in reverse postorder until nothing changes.
+	template<class traitsT>
+	std::vector<int> code_graph<traitsT>::dominators() const {
+		std::vector<int> order;
+		std::vector<int> rank(size(), -1);
+		{
+			std::vector<bool> seen(size(), false);
+			std::vector<std::pair<int, size_t> > stack(1, std::make_pair(0, 0));
+			seen[0] = true;
+			while (!stack.empty()) {
+				auto &top = stack.back();
+				if (top.second < _succ[top.first].size()) {
+					const int s = _succ[top.first][top.second++];
+					if (!seen[s]) {
+						seen[s] = true;
+						stack.emplace_back(s, 0);
+					}
+				} else {
+					order.push_back(top.first);
+					stack.pop_back();
+				}
+			}
+			std::reverse(order.begin(), order.end());
+			for (size_t i = 0; i < order.size(); i++) {
+				rank[order[i]] = i;
+			}
+		}
+
+		std::vector<int> idom(size(), -1);
+		idom[0] = 0;
+		auto intersect = [&](int a, int b) {
+			while (a != b) {
+				while (rank[a] > rank[b]) a = idom[a];
+				while (rank[b] > rank[a]) b = idom[b];
+			}
+			return a;
+		};
+
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (size_t i = 1; i < order.size(); i++) {
+				const int b = order[i];
+				int new_idom = -1;
+				for (int p: _pred[b]) {
+					if (idom[p] != -1) {
+						new_idom = (new_idom == -1) ? p : intersect(p, new_idom);
+					}
+				}
+				if (idom[b] != new_idom) {
+					idom[b] = new_idom;
+					changed = true;
+				}
+			}
+		}
+		return idom;
+	}
+
+	template<class traitsT>
+	int code_graph<traitsT>::min_distance(const int to) const {
+		std::vector<int> dist(size(), -1);
+		typedef std::pair<int, int> item; // distance, node
+		std::priority_queue<item, std::vector<item>, std::greater<item> > pending;
+		pending.emplace(0, 0);
+		while (!pending.empty()) {
+			const item i = pending.top();
+			pending.pop();
+			if (dist[i.second] != -1) {
+				continue;
+			}
+			dist[i.second] = i.first;
+			if (i.second == to) {
+				return i.first;
+			}
+			const int w = std::max(consumes(i.second), 0);
+			for (int s: _succ[i.second]) {
+				if (dist[s] == -1) {
+					pending.emplace(i.first + w, s);
+				}
+			}
+		}
+		return UNBOUNDED; // can't get there
+	}
+
+	// longest path from the entry to the node, unbounded if there's a loop (or a
+	// backref) along the way.
+	template<class traitsT>
+	int code_graph<traitsT>::max_distance(const int to) const {
+		const std::vector<bool> leads = leads_to(to);
+		if (!leads[0]) {
+			return UNBOUNDED;
+		}
+
+		// longest path over the nodes in topological order; if some never get
+		// there then they're in a loop.
+		std::vector<int> incoming(size(), 0);
+		for (int n = 0; n < size(); n++) {
+			if (!leads[n] || n == to) {
+				continue;
+			}
+			if (consumes(n) == UNBOUNDED) {
+				return UNBOUNDED;
+			}
+			for (int s: _succ[n]) {
+				if (leads[s]) ++incoming[s];
+			}
+		}
+
+		if (incoming[0] != 0) {
+			return UNBOUNDED; // looping back to the entry.
+		}
+
+		std::vector<int> longest(size(), 0);
+		std::vector<int> pending(1, 0);
+		while (!pending.empty()) {
+			const int n = pending.back();
+			pending.pop_back();
+			if (n == to) {
+				continue;
+			}
+			for (int s: _succ[n]) {
+				if (!leads[s]) {
+					continue;
+				}
+				longest[s] = std::max(longest[s], longest[n] + consumes(n));
+				if (--incoming[s] == 0) {
+					pending.push_back(s);
+				}
+			}
+		}
+		return (incoming[to] == 0) ? longest[to] : UNBOUNDED;
+	}
+
+	template<class traitsT>
+	std::vector<bool> code_graph<traitsT>::leads_to(const int to) const {
+		std::vector<bool> leads(size(), false);
+		std::vector<int> pending(1, to);
+		leads[to] = true;
+		while (!pending.empty()) {
+			const int n = pending.back();
+			pending.pop_back();
+			for (int p: _pred[n]) {
+				if (!leads[p] && p != to) {
+					leads[p] = true;
+					pending.push_back(p);
+				}
+			}
+		}
+		return leads;
+	}
+
+	// every edge in front of "to" gets turned around: each instruction is
+	// followed by failure points to all of the instructions that could have run
+	// before it. the instructions are laid out last to first so most of the
+	// time the one before is the next one and doesn't need a goto.
+	template<class traitsT>
+	bool code_graph<traitsT>::reverse(const int to, code_vector_type &out) const {
+		if (to <= 0 || to >= size()) {
+			return false;
+		}
+		const std::vector<bool> region = leads_to(to);
+
+		std::vector<int> order;
+		for (int n = size() - 1; n >= 0; n--) {
+			if (n != to && region[n] && _reachable[n]) {
+				order.push_back(n);
+			}
+		}
+
+		std::vector<int> label(size(), -1);
+		std::vector<std::pair<int, int> > fixups; // address, node (-1 for the OP_END)
+		auto jump = [&](opcodes op, int target) {
+			const int at = out.store(op);
+			out.store(0);
+			out.store(0);
+			fixups.emplace_back(at + 1, target);
+		};
+
+		// jump to everything that comes before n; the entry comes before node 0.
+		auto before = [&](int n, int next) {
+			std::vector<int> targets;
+			for (int p: _pred[n]) {
+				if (p != to && region[p] && _reachable[p]
+				    && std::find(targets.begin(), targets.end(), p) == targets.end()) {
+					targets.push_back(p);
+				}
+			}
+			if (n == 0) {
+				targets.push_back(-1);
+			}
+			if (targets.empty()) {
+				return false;
+			}
+			for (size_t i = 0; i + 1 < targets.size(); i++) {
+				jump(OP_PUSH_FAILURE, targets[i]);
+			}
+			if (targets.back() != next) {
+				jump(OP_GOTO, targets.back());
+			}
+			return true;
+		};
+
+		if (!before(to, order.empty() ? -1 : order[0])) {
+			return false;
+		}
+		for (size_t i = 0; i < order.size(); i++) {
+			const int n = order[i];
+			const code_type *cp = code(n);
+			label[n] = out.offset();
+			switch (*cp) {
+				case OP_GOTO:
+				case OP_POP_FAILURE_GOTO:
+				case OP_FAKE_FAILURE_GOTO:
+				case OP_PUSH_FAILURE:
+				case OP_POP_FAILURE:
+				case OP_BACKREF_BEGIN:
+				case OP_BACKREF_END:
+				case OP_NOOP:
+					break; // only the edges matter going backwards.
+
+				case OP_STRING:
+					for (int k = cp[1]; k > 0; k--) {
+						out.store(OP_CHAR, cp[1 + k]);
+					}
+					break;
+
+				case OP_PUSH_FAILURE2: {
+					// the whole negated class, up to and including its OP_POP_FAILURE.
+					const int stop = jump_target(_code, _offset[n]);
+					for (int at = _offset[n]; at <= stop; at++) {
+						out.store(_code[at]);
+					}
+					break;
+				}
+
+				default:
+					if (consumes(n) != 1) {
+						return false;
+					}
+					for (int k = 0; k < instruction_length(cp); k++) {
+						out.store(cp[k]);
+					}
+					break;
+			}
+			if (!before(n, (i + 1 < order.size()) ? order[i + 1] : -1)) {
+				return false;
+			}
+		}
+
+		const int accept = out.store(OP_END);
+		for (const auto &f: fixups) {
+			out.put_address(f.first, (f.second == -1) ? accept : label[f.second]);
+		}
+		return true;
+	}
+}
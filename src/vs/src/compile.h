@@ -3,6 +3,7 @@
 #include "concepts.h"
 #include "precedence.h"
 #include "code.h"
+#include "ast.h"
 #include "input_string.h"
 
 namespace re {
@@ -15,6 +16,10 @@ namespace re {
     // by lengthening the function parameter lists, instead i have this class with a
     // bunch of public members (and lengthening parameter lists using vc++ is a dangerous
     // undertaking -- especially in templates).
+    //
+    // everything here is scratch, thrown away when the compile's done; it all comes out of
+    // arena, a monotonic buffer is what it's for (see re_engine::exec_compile). only the
+    // code it generates is allocated for keeps.
 
     template<typename traitsType>
         requires IsReCharTraits<traitsType>
@@ -25,10 +30,12 @@ namespace re {
         typedef typename traitsType::int_type int_type;
         typedef syntax_base<traitsType> syntax_type;
         typedef compiled_code_vector<traitsType> code_vector_type;
+        typedef re_ast<traitsType> ast_type;
         typedef input_string<traitsType> source_vector_type;
-        typedef std::stack<int> open_backref_stack;
+        typedef std::stack<int, std::pmr::vector<int> > open_backref_stack;
 
-        compile_state(const syntax_type &syn, code_vector_type &out, source_vector_type &in)
+        compile_state(const syntax_type &syn, code_vector_type &out, source_vector_type &in,
+                      std::pmr::memory_resource *arena = std::pmr::get_default_resource())
             : op(0),
               ch(0),
               beginning_context(1),
@@ -37,9 +44,30 @@ namespace re {
               group_nesting(0),
               number_of_backrefs(0),
               next_backref(1),
+              backref_stack(typename open_backref_stack::container_type(arena)),
+              jump_stack(re_future_jump_stack::container_type(arena)),
+              prec_stack(arena),
               syntax(syn),
               input(in),
-              output(out) {
+              output(arena),
+              code(out) {
+            output.reserve(in.length(), classes(in));
+        }
+
+        // about how many bytes of arena compiling the pattern takes; a buffer
+        // this big usually does it without going back for more.
+        static size_t arena_size(const source_vector_type &in) {
+            return ast_type::reserved(in.length(), classes(in)) + 1024;
+        }
+
+    private:
+        // how many [...] there might be, for the bitmaps.
+        static size_t classes(const source_vector_type &in) {
+            size_t n = 0;
+            for (int i = 0; i < in.length(); i++) {
+                n += in[i] == '[';
+            }
+            return n;
         }
 
     public:
@@ -59,6 +87,7 @@ namespace re {
 
         const syntax_type &syntax; // what is our syntax object
         source_vector_type &input; // ref to the input character stream.
-        code_vector_type &output; // ref to where the output code is going.
+        ast_type output; // what's been parsed so far.
+        code_vector_type &code; // ref to where the output code is going.
     };
 }
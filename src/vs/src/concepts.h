@@ -7,7 +7,9 @@ namespace re {
     // Define the concept
     template <typename T>
     concept IsReCharTraits = std::is_same_v<T, re_char_traits<char>> ||
-                             std::is_same_v<T, re_char_traits<wchar_t>>;
+                             std::is_same_v<T, re_char_traits<wchar_t>> ||
+                             std::is_same_v<T, re_wide_code_traits<char>> ||
+                             std::is_same_v<T, re_wide_code_traits<wchar_t>>;
 
     template <typename traitsType> requires IsReCharTraits<traitsType> class compile_state;
 
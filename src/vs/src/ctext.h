@@ -33,6 +33,10 @@ namespace re {
 			return _text;
 		}
 
+		const char_type *data() const {
+			return _str1;
+		}
+
 		void text(const char_type *p) {
 			assert(_str1 != nullptr);
 			assert(p >= _str1 && p <= _str1_end);
@@ -41,6 +45,19 @@ namespace re {
 
 		void reset();
 
+		// where the current match attempt began; exec_search moves this along the
+		// buffer, exec_match measures the match length from here.
+		int start() const;
+
+		void start(int pos);
+
+		// walking backwards; next() reads the character in front of the cursor
+		// and stops at the floor (a position) instead of the end, unget() undoes
+		// that. exec_search uses this to run reversed code from a literal.
+		bool backward() const { return _backward; }
+
+		void backward(bool b, int floor = 0);
+
 		int next(int_type &ch);
 
 		void current(int &ch) const;
@@ -64,9 +81,12 @@ namespace re {
 
 	private:
 		const char_type *_str1;
+		const char_type *_start;
 		const char_type *_text;
 		const char_type *_text_end;
 		const char_type *_str1_end;
+		const char_type *_floor;
+		bool _backward;
 
 		size_t _len1;
 	};
@@ -92,15 +112,13 @@ namespace re {
 		if (len != static_cast<size_t>(-1) && len > 0) {
 			if (len < l1) {
 				l1 = len;
-			} else {
-				s1 = nullptr;
-				l1 = 0;
 			}
 		}
 
-		_text = _str1 = s1;
+		_text = _start = _floor = _str1 = s1;
 		_len1 = l1;
 		_text_end = _str1_end = _str1 + _len1;
+		_backward = false;
 	}
 
 	template<class traitsType>
@@ -119,7 +137,26 @@ namespace re {
 
 	template<class traitsType>
 	void ctext<traitsType>::reset() {
-		_text = _str1;
+		_text = _start = _floor = _str1;
+		_backward = false;
+	}
+
+	template<class traitsType>
+	int ctext<traitsType>::start() const {
+		return _start - _str1;
+	}
+
+	template<class traitsType>
+	void ctext<traitsType>::start(const int pos) {
+		assert(pos >= 0 && static_cast<size_t>(pos) <= _len1);
+		_text = _start = _str1 + pos;
+	}
+
+	template<class traitsType>
+	void ctext<traitsType>::backward(const bool b, const int floor) {
+		assert(floor >= 0 && _str1 + floor <= _text);
+		_backward = b;
+		_floor = _str1 + floor;
 	}
 
 	template<class traitsType>
@@ -128,14 +165,24 @@ namespace re {
 	}
 
 	template<class traitsType>
+	// like input_string::get, non-zero means there was nothing left to read.
 	int ctext<traitsType>::next(int_type &ch) {
-		if (_text == _text_end) return 0;
+		if (_backward) {
+			if (_text == _floor) return 1;
+			ch = *--_text;
+			return 0;
+		}
+		if (_text == _text_end) return 1;
 		ch = *_text++;
-		return 1;
+		return 0;
 	}
 
 	template<class traitsType>
 	void ctext<traitsType>::unget(int_type &ch) {
+		if (_backward) {
+			ch = (_text == _text_end) ? 0 : *_text++;
+			return;
+		}
 		ch = (_text == _str1) ? 0 : *--_text;
 	}
 
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <bitset>
+#include "tokens.h"
+#include "code.h"
+#include "code_graph.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// re_dfa is a dfa built lazily from the compiled code, for when all anyone
+	// wants to know is if (and where) something matches. the instructions are
+	// the nfa; a dfa state is the list of instructions waiting for the next
+	// character, and the states are only worked out when the text gets there.
+	//
+	// the list is kept in the order exec_match would try the instructions (a
+	// failure point's fall through before its target), and everything after an
+	// OP_END is dropped, so the match found is the same one the backtracking
+	// would find. it just never goes back over the text.
+	//
+	// the states are cached up to a memory limit, then the cache is thrown away
+	// and it starts over. if that keeps happening the dfa gives up and the
+	// caller should use exec_match.
+	//
+	// it can't do closures, backrefs or word tests (valid() is false), and only
+	// works on single byte characters.
+
+	template<class traitsT>
+	class re_dfa {
+	public:
+		typedef traitsT traits_type;
+		typedef typename traits_type::char_type char_type;
+		typedef typename traits_type::int_type int_type;
+		typedef compiled_code_vector<traitsT> code_vector_type;
+		typedef typename code_vector_type::code_type code_type;
+
+		enum { NO_MATCH = -1, GAVE_UP = -2 };
+
+		// unanchored looks for a match starting anywhere, not just at pos.
+		re_dfa(const code_vector_type &code, bool unanchored, size_t memory = 1 << 20);
+
+		bool valid() const { return _valid; }
+
+		// anchored: the end of the match starting at pos. unanchored: the end of
+		// the first match to end, starting at or after pos. either NO_MATCH or
+		// GAVE_UP.
+		int exec(const char_type *buffer, int pos, int end);
+
+		// how many states are cached right now.
+		int states() const { return static_cast<int>(_states.size()); }
+
+	private:
+		enum kind { TEST, MATCH, JUMP, SPLIT, LINE_BEGIN, BUFFER_BEGIN, LINE_END, BUFFER_END };
+
+		enum { UNKNOWN = -1, DEAD = 0 };
+
+		struct node {
+			kind what;
+			int next;
+			int alt; // the failure point's target
+			int set; // for TEST, index into _sets
+		};
+
+		struct state {
+			std::vector<int> threads;
+			bool match;
+		};
+
+		static int index(int_type c) { return static_cast<unsigned char>(c); }
+
+		void add(int pc, bool line_begin, bool buffer_begin, bool at_end,
+		         std::vector<int> &threads, bool &match);
+
+		int intern(const std::vector<int> &threads, bool match);
+
+		int start_state(bool line_begin, bool buffer_begin);
+
+		int transition(int s, int c);
+
+		bool matches_at_end(int s, bool line_begin, bool buffer_begin);
+
+		void flush();
+
+		std::vector<node> _node; // by code offset
+		std::vector<std::bitset<256> > _sets;
+
+		std::vector<state> _states;
+		std::vector<int> _table; // 256 transitions per state
+		std::map<std::vector<int>, int> _index;
+		int _start[3];
+
+		std::vector<int> _mark;
+		int _stamp;
+		std::vector<int> _pending;
+		std::vector<int> _threads;
+
+		size_t _memory;
+		size_t _used;
+		bool _unanchored;
+		bool _valid;
+	};
+
+	template<class traitsT>
+	re_dfa<traitsT>::re_dfa(const code_vector_type &code, const bool unanchored, const size_t memory)
+		: _stamp(0), _memory(memory), _used(0), _unanchored(unanchored), _valid(false) {
+		typedef code_graph<traitsT> code_graph_type;
+
+		if (sizeof(char_type) != 1) {
+			return;
+		}
+		const code_graph_type graph(code);
+		if (!graph.valid() || graph.end() < 0) {
+			return;
+		}
+
+		// one node per instruction, and one for each character of an OP_STRING.
+		_node.assign(code.offset() + 1, node{MATCH, 0, 0, -1});
+		for (int n = 0; n < graph.size(); n++) {
+			if (!graph.reachable(n)) {
+				continue;
+			}
+			const int off = graph.offset(n);
+			const code_type *cp = graph.code(n);
+			node &nd = _node[off];
+			nd.next = off + code_graph_type::instruction_length(cp);
+			switch (*cp) {
+				case OP_END:
+					nd.what = MATCH;
+					break;
+
+				case OP_GOTO:
+				case OP_POP_FAILURE_GOTO:
+				case OP_FAKE_FAILURE_GOTO:
+					nd.what = JUMP;
+					nd.next = code_graph_type::jump_target(code.code(), off);
+					break;
+
+				case OP_PUSH_FAILURE:
+					nd.what = SPLIT;
+					nd.alt = code_graph_type::jump_target(code.code(), off);
+					break;
+
+				case OP_POP_FAILURE:
+				case OP_BACKREF_BEGIN:
+				case OP_BACKREF_END:
+				case OP_NOOP:
+					nd.what = JUMP;
+					break;
+
+				case OP_BEGIN_OF_LINE:
+					nd.what = LINE_BEGIN;
+					break;
+
+				case OP_BEGIN_OF_BUFFER:
+					nd.what = BUFFER_BEGIN;
+					break;
+
+				case OP_END_OF_LINE:
+					nd.what = LINE_END;
+					break;
+
+				case OP_END_OF_BUFFER:
+					nd.what = BUFFER_END;
+					break;
+
+				case OP_STRING:
+					for (int i = 0; i < cp[1]; i++) {
+						node &ch = _node[off + 2 + i];
+						ch.what = TEST;
+						ch.next = (i + 1 < cp[1]) ? off + 3 + i : nd.next;
+						ch.set = _sets.size();
+						_sets.emplace_back();
+						_sets.back().set(index(cp[2 + i]));
+					}
+					if (cp[1] == 0) {
+						nd.what = JUMP;
+					} else {
+						nd = _node[off + 2];
+					}
+					break;
+
+				default: {
+					if (graph.consumes(n) != 1) {
+						return; // closures, backrefs, word tests.
+					}
+					std::bitset<256> set;
+					for (int c = 0; c < 256; c++) {
+						const int r = code_graph_type::char_test(cp, static_cast<char_type>(c));
+						if (r < 0) {
+							return;
+						}
+						set[c] = r;
+					}
+					if (*cp == OP_PUSH_FAILURE2) {
+						nd.next = code_graph_type::jump_target(code.code(), off);
+					}
+					nd.what = TEST;
+					nd.set = _sets.size();
+					_sets.push_back(set);
+					break;
+				}
+			}
+		}
+		_mark.assign(_node.size(), 0);
+		flush();
+		_valid = true;
+	}
+
+	// throw away every state but the dead one.
+	template<class traitsT>
+	void re_dfa<traitsT>::flush() {
+		_states.clear();
+		_table.clear();
+		_index.clear();
+		_used = 0;
+		intern(std::vector<int>(), false);
+		_start[0] = _start[1] = _start[2] = UNKNOWN;
+	}
+
+	// follow everything that doesn't consume a character from pc, adding the
+	// instructions that do to threads in the order exec_match would get to them.
+	// nothing after an OP_END gets added.
+	template<class traitsT>
+	void re_dfa<traitsT>::add(const int pc, const bool line_begin, const bool buffer_begin,
+	                          const bool at_end, std::vector<int> &threads, bool &match) {
+		_pending.assign(1, pc);
+		while (!_pending.empty()) {
+			const int at = _pending.back();
+			_pending.pop_back();
+			if (_mark[at] == _stamp) {
+				continue;
+			}
+			_mark[at] = _stamp;
+
+			const node &nd = _node[at];
+			switch (nd.what) {
+				case TEST:
+					threads.push_back(at);
+					break;
+
+				case MATCH:
+					threads.push_back(at);
+					match = true;
+					_pending.clear();
+					return;
+
+				case JUMP:
+					_pending.push_back(nd.next);
+					break;
+
+				case SPLIT:
+					_pending.push_back(nd.alt);
+					_pending.push_back(nd.next);
+					break;
+
+				case LINE_BEGIN:
+					if (line_begin) _pending.push_back(nd.next);
+					break;
+
+				case BUFFER_BEGIN:
+					if (buffer_begin) _pending.push_back(nd.next);
+					break;
+
+				case LINE_END:
+				case BUFFER_END:
+					// both mean the end of the text; wait and see if that's next.
+					if (at_end) {
+						_pending.push_back(nd.next);
+					} else {
+						threads.push_back(at);
+					}
+					break;
+			}
+		}
+	}
+
+	template<class traitsT>
+	int re_dfa<traitsT>::intern(const std::vector<int> &threads, const bool match) {
+		auto it = _index.find(threads);
+		if (it != _index.end()) {
+			return it->second;
+		}
+		const int s = _states.size();
+		_states.push_back(state{threads, match});
+		_table.resize(_table.size() + 256, UNKNOWN);
+		_index.emplace(threads, s);
+		_used += sizeof(state) + 2 * threads.size() * sizeof(int) + 256 * sizeof(int) + 64;
+		return s;
+	}
+
+	template<class traitsT>
+	int re_dfa<traitsT>::start_state(const bool line_begin, const bool buffer_begin) {
+		int &s = _start[buffer_begin ? 2 : (line_begin ? 1 : 0)];
+		if (s == UNKNOWN) {
+			bool match = false;
+			_threads.clear();
+			++_stamp;
+			add(0, line_begin, buffer_begin, false, _threads, match);
+			s = intern(_threads, match);
+		}
+		return s;
+	}
+
+	template<class traitsT>
+	int re_dfa<traitsT>::transition(const int s, const int c) {
+		const bool line_begin = (c == '\n');
+		bool match = false;
+		_threads.clear();
+		++_stamp;
+		for (int pc: _states[s].threads) {
+			const node &nd = _node[pc];
+			if (nd.what == TEST && _sets[nd.set].test(c)) {
+				add(nd.next, line_begin, false, false, _threads, match);
+				if (match) {
+					break;
+				}
+			}
+		}
+		if (_unanchored && !match) {
+			// and a new match could start after this character.
+			add(0, line_begin, false, false, _threads, match);
+		}
+		const int t = intern(_threads, match);
+		_table[s * 256 + c] = t;
+		return t;
+	}
+
+	// do any of the instructions waiting for the end of the text (ahead of an
+	// OP_END) get to a match?
+	template<class traitsT>
+	bool re_dfa<traitsT>::matches_at_end(const int s, const bool line_begin, const bool buffer_begin) {
+		bool match = false;
+		std::vector<int> unused;
+		++_stamp;
+		for (int pc: _states[s].threads) {
+			const node &nd = _node[pc];
+			if (nd.what == MATCH) {
+				return true;
+			}
+			if (nd.what == LINE_END || nd.what == BUFFER_END) {
+				add(nd.next, line_begin, buffer_begin, true, unused, match);
+				if (match) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	template<class traitsT>
+	int re_dfa<traitsT>::exec(const char_type *buffer, int pos, const int end) {
+		if (!_valid) {
+			return GAVE_UP;
+		}
+
+		int s = start_state(pos == 0 || buffer[pos - 1] == '\n', pos == 0);
+		int found = _states[s].match ? pos : NO_MATCH;
+		if (_unanchored && found != NO_MATCH) {
+			return found;
+		}
+
+		int scanned = 0; // since the cache was last thrown away
+		for (; pos < end && s != DEAD; pos++) {
+			const int c = index(buffer[pos]);
+			int t = _table[s * 256 + c];
+			if (t == UNKNOWN) {
+				if (_used > _memory) {
+					// the cache is full, start it over from this state; unless it's
+					// filling up too fast for the cache to be any use.
+					if (scanned < 10 * states()) {
+						return GAVE_UP;
+					}
+					const state keep = _states[s];
+					flush();
+					s = intern(keep.threads, keep.match);
+					scanned = 0;
+				}
+				t = transition(s, c);
+			}
+			s = t;
+			++scanned;
+			if (_states[s].match) {
+				found = pos + 1;
+				if (_unanchored) {
+					return found;
+				}
+			}
+		}
+
+		if (pos == end && s != DEAD && matches_at_end(s, end == 0 || buffer[end - 1] == '\n', end == 0)) {
+			found = end;
+		}
+		return found;
+	}
+}
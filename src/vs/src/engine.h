@@ -1,12 +1,28 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <bitset>
+#include <limits>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 
 #include "concepts.h"
 #include "traits.h"
 #include "ctext.h"
 #include "compile.h"
+#include "code_graph.h"
+#include "dfa.h"
+#include "pike.h"
+#include "bitstate.h"
+#include "glushkov.h"
+#include "onepass.h"
+#include "instruction.h"
+#include "optimizer.h"
 #include "syntax_base.h"
 #include "syntax_grep.h"
 #include "syntax_egrep.h"
@@ -80,27 +96,151 @@ namespace re {
 
 		re_engine();
 
-		int exec_compile(const char_type *s, size_t slen = -1, int *err = nullptr);
+		// the compile's scratch comes from arena (a monotonic buffer over memory
+		// of the caller's is what it's for), or from a buffer on the stack.
+		int exec_compile(const char_type *s, size_t slen = -1, int *err = nullptr,
+		                 std::pmr::memory_resource *arena = nullptr);
+
+		// the buffers a match works in, kept from one match to the next (see
+		// below). without one the thread's own is used.
+		struct match_context;
 
 		int exec_match(ctext_type &text, bool partial_matches = false,
 		               re_match_vector &m = const_cast<re_match_vector &>(default_matches)) const;
 
+		int exec_match(ctext_type &text, match_context &context, bool partial_matches = false,
+		               re_match_vector &m = const_cast<re_match_vector &>(default_matches)) const;
+
 		int exec_optimize();
 
+		void exec_caseless(bool caseless, bool lower_caseless);
+
 		int exec_search(ctext_type &text, int range = 0,
 		                re_match_vector &m = const_cast<re_match_vector &>(default_matches)) const;
 
+		int exec_search(ctext_type &text, match_context &context, int range = 0,
+		                re_match_vector &m = const_cast<re_match_vector &>(default_matches)) const;
+
 		void dump_code(std::ostream& out) const;
 
+	private:
+		// for the caseless and closure stack settings.
+		template<class> friend class basic_regular_expression;
+
+		typedef typename code_vector_type::code_type code_type;
+		typedef instruction<traits_type> instruction_type;
+
+		void exec_study();
+
+		void exec_study_anchor(const code_graph<traits_type> &graph);
+
+		void exec_study_inner(const code_graph<traits_type> &graph);
+
+		void exec_study_suffix(const code_graph<traits_type> &graph);
+
+		bool study_map_test(int_type ch) const;
+
+		int exec_reverse(ctext_type &text, match_context &context) const;
+
+		int exec_dfa(ctext_type &text, bool unanchored) const;
+
+		static match_context &thread_context();
+
+		int exec_pike(ctext_type &text, int last, match_context &context, re_match_vector &matches) const;
+
+		int exec_bitstate(ctext_type &text, int last, match_context &context, re_match_vector &matches) const;
+
+		int exec_onepass(ctext_type &text, match_context &context, re_match_vector &matches) const;
+
+		void exec_slots(ctext_type &text, int found, const std::vector<int> &slots,
+		                re_match_vector &matches) const;
+
+		int exec_backtrack(ctext_type &text, bool partial_matches, match_context &context,
+		                   re_match_vector &matches) const;
+
+		bool exec_string(const code_type *cp, const char_type *tp, size_t n) const;
+
+		bool exec_test(const instruction_type &in, int_type ch) const;
+
+		size_t exec_run(const instruction_type &in, const char_type *tp, size_t left) const;
+
+		bool exec_run_follows(const instruction_type *next, int_type &ch) const;
+
 	public:
 		code_vector_type code;
 	private:
-		short anchor;
+		short anchor; // ANCHOR_xxx, set by exec_study.
 		int syntax_error_state;
+		// the caseless compares that are asked for (see exec_caseless), and the
+		// ones that are left for the matching to do; those are off when the code
+		// could be folded.
+		bool caseless_wanted;
+		bool lower_caseless_wanted;
 		bool caseless_cmps;
 		bool lower_caseless_cmps;
+		bool linear_matching; // always use the pike vm when it can do the code.
 		int using_backrefs;
-		size_t maximum_closure_stack;
+		size_t maximum_closure_stack; // in bytes, of the failure stack's entries
+
+		// the "study map" (todo 7b); the set of characters that can begin a match,
+		// only valid when every path through the code has to consume a character.
+		std::bitset<256> study_map;
+		bool study_map_valid;
+
+		// literal that every match starts with, and which character of it is the
+		// rarest (that's the one we memchr for). if the whole expression is just
+		// the literal we don't need exec_match at all.
+		typename traits_type::string_type prefix;
+		size_t prefix_rare;
+		bool prefix_only;
+
+		// when there's no prefix, the longest literal that every match has to
+		// contain, and how far into the match it can be found.
+		typename traits_type::string_type inner;
+		int inner_min;
+		int inner_max;
+
+		// literal every match ends with, when nothing in front of it can consume
+		// its first character, and the code in front of it reversed (so it can be
+		// run backwards from the literal, see exec_reverse). suffix_min is the
+		// least number of characters in front of it.
+		typename traits_type::string_type suffix;
+		int suffix_min;
+		code_vector_type reverse_code;
+
+		// the lazy dfas (see dfa.h) for when nobody wants the match vector. the
+		// states are built while matching, so they're behind a lock; copies of the
+		// engine share them.
+		struct dfa_cache {
+			re_dfa<traits_type> anchored;
+			re_dfa<traits_type> unanchored;
+			std::mutex lock;
+
+			explicit dfa_cache(const code_vector_type &code) : anchored(code, false), unanchored(code, true) {
+			}
+		};
+
+		std::shared_ptr<dfa_cache> dfa;
+
+		// the code for the pike vm (see pike.h), for linear_matching and for when
+		// exec_match runs out of failure stack, and for re_bitstate (short text).
+		std::shared_ptr<const re_program<traits_type> > program;
+
+		// short expressions as a bit-parallel position automaton (see glushkov.h),
+		// for exec_search to find where the first match ends.
+		std::shared_ptr<const re_glushkov<traits_type> > glushkov;
+
+		// code where a character never leaves more than one way to go (see
+		// onepass.h); exec_match gets the groups in one pass, no failure stack.
+		std::shared_ptr<const re_onepass<traits_type> > onepass;
+
+		// the code with the caseless compares folded into it (see optimizer.h),
+		// what the studies are done on when there are any.
+		code_vector_type folded;
+
+		// the code with the operands decoded and the jumps resolved (see
+		// instruction.h); this is what exec_backtrack runs.
+		std::shared_ptr<const linked_code<traits_type> > linked;
 
 		syntax_type syntax;
 	};
@@ -113,10 +253,19 @@ namespace re {
 	re_engine<syntaxType>::re_engine() : code() {
 		anchor = ANCHOR_NONE;
 		syntax_error_state = 1; // default, no compiled expression.
+		caseless_wanted = false;
+		lower_caseless_wanted = false;
 		caseless_cmps = false;
 		lower_caseless_cmps = false;
+		linear_matching = false;
 		using_backrefs = 0;
-		maximum_closure_stack = 4096;
+		maximum_closure_stack = 128 * 1024; // 8k entries
+		study_map_valid = false;
+		prefix_rare = 0;
+		prefix_only = false;
+		inner_min = 0;
+		inner_max = code_graph<traits_type>::UNBOUNDED;
+		suffix_min = 0;
 	}
 
 #if 0
@@ -148,7 +297,7 @@ namespace re {
 	/////////////////////////////////////////////////////////////////////////////
 	// compile a regular expression.
 	// always will delete old code, by reinitializing the code object. will always
-	// reset to the anchor to 0.
+	// reset to the anchor to 0, exec_study works it out again.
 	//
 	// does not reinitialize case less comparison flags.
 	//
@@ -157,7 +306,8 @@ namespace re {
 	//
 
 	template<class syntaxType>
-	int re_engine<syntaxType>::exec_compile(const char_type *s, size_t slen, int *err_pos) {
+	int re_engine<syntaxType>::exec_compile(const char_type *s, size_t slen, int *err_pos,
+	                                        std::pmr::memory_resource *arena) {
 		anchor = 0; // allow for repeat calls to ::exec_compile
 		code = code_vector_type();
 
@@ -172,7 +322,21 @@ namespace re {
 		traits_type::check(s, slen); // calculate slen if user passed default
 
 		source_vector_type source(s, slen);
-		compile_state_type cs(syntax, code, source); // let syntax obj do the work.
+
+		// the buffer does for most patterns; a long one gets a block of its
+		// own, as big as it should need.
+		alignas(std::max_align_t) std::byte buffer[8192];
+		std::optional<std::pmr::monotonic_buffer_resource> scratch;
+		if (arena == nullptr) {
+			const size_t size = compile_state_type::arena_size(source);
+			if (size <= sizeof(buffer)) {
+				scratch.emplace(buffer, sizeof(buffer));
+			} else {
+				scratch.emplace(size);
+			}
+			arena = &*scratch;
+		}
+		compile_state_type cs(syntax, code, source, arena); // let syntax obj do the work.
 
 		syntax_error_state = cs.syntax.compile(cs); // perform the compilation
 		if (syntax_error_state) {
@@ -182,20 +346,29 @@ namespace re {
 			}
 			return syntax_error_state; // return pos in string where error occurred
 		}
+		if (code.too_long()) {
+			// a jump or a count that doesn't fit; a wider code_type would do it.
+			syntax_error_state = EXPRESSION_TOO_LONG;
+			code = code_vector_type();
+			if (err_pos) {
+				*err_pos = cs.input.offset();
+			}
+			return syntax_error_state;
+		}
 		assert(cs.jump_stack.size() == 0);
 		using_backrefs = cs.number_of_backrefs; // remember number of back-refs.
+		exec_study();
 		return 0; // no error
 	}
 
 
 	/////////////////////////////////////////////////////////////////////////////
 	// optimize a compiled regular expression.
-	// this member function is constantly changing, but, right now, this will take
-	// simple character sequences and turn it into a single string operation.
+	// the peephole passes in optimizer.h: runs of characters become strings,
+	// jumps to jumps are threaded, and no-ops, dead code and failure points that
+	// can't be used go. the studies are done again on the new code.
 	//
-	// we try to avoid resizing the code memory, since everything we are doing
-	// should shorten the number of code operations. but, for now, i'm creating
-	// a new code object and assigning it to the existing code object.
+	// returns 1 if the code changed, 0 if it didn't (or couldn't be).
 	//
 
 	template<class syntaxType>
@@ -203,111 +376,601 @@ namespace re {
 		if (syntax_error_state) {
 			return -3;
 		}
+		if (code.offset() == 0) {
+			return 0;
+		}
 
-		bool continue_work = true;
-		typename code_vector_type::code_type char_count = 0;
-		int i = 0;
-		while (continue_work && code[i] != OP_END) {
-			if (code[i++] == OP_CHAR) {
-				++i; // skip the operator
-				++char_count;
-			} else {
-				continue_work = false;
+		const code_optimizer<traits_type> optimizer(code);
+		if (!optimizer.valid() || optimizer.changes() == 0) {
+			return 0;
+		}
+		code = optimizer.code();
+		exec_study();
+		return 1;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// turn the caseless compares on/off. the code is folded for them again (see
+	// exec_study), so it's not something to do between every match.
+	//
+
+	template<class syntaxType>
+	void re_engine<syntaxType>::exec_caseless(const bool caseless, const bool lower_caseless) {
+		if (caseless == caseless_wanted && lower_caseless == lower_caseless_wanted) {
+			return;
+		}
+		caseless_wanted = caseless;
+		lower_caseless_wanted = lower_caseless;
+		exec_study();
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// build the study map.
+	// walk every path from the start of the code, following the failure points
+	// and gotos, until each path reaches something that consumes a character; the
+	// characters that can be consumed there go into the map. if any path can
+	// reach the end without consuming anything (or we find something we don't
+	// understand, like a backref) then the map is useless and left invalid.
+	//
+	// negated classes are compiled as a list of OP_NOT_xxx/OP_BACKUP pairs
+	// between OP_PUSH_FAILURE2 and OP_FORWARD; the map gets whatever passes all
+	// the members (see code_graph::char_test).
+	//
+	// an atomic group can only take matches away, so the studies go through
+	// OP_ATOMIC_BEGIN and OP_ATOMIC_END like an OP_NOOP. the dfa and the pike vm
+	// can't do them at all and give up (and exec_backtrack is left).
+	//
+	// with caseless compares the studies are done on the code with them folded
+	// in (see code_optimizer), and the matching doesn't do them again. the
+	// code is left as it was compiled; dump_code shows that.
+	//
+
+	template<class syntaxType>
+	void re_engine<syntaxType>::exec_study() {
+		caseless_cmps = caseless_wanted;
+		lower_caseless_cmps = lower_caseless_wanted;
+		folded = code_vector_type();
+		study_map.reset();
+		study_map_valid = false;
+		prefix.clear();
+		prefix_rare = 0;
+		prefix_only = false;
+		inner.clear();
+		inner_min = 0;
+		inner_max = code_graph<traits_type>::UNBOUNDED;
+		suffix.clear();
+		suffix_min = 0;
+		reverse_code = code_vector_type();
+		dfa.reset();
+		program.reset();
+		glushkov.reset();
+		onepass.reset();
+		linked.reset();
+		anchor = ANCHOR_NONE;
+		if (syntax_error_state || code.offset() == 0) {
+			return;
+		}
+
+		if (caseless_cmps || lower_caseless_cmps) {
+			const code_optimizer<traits_type> folder(code, caseless_cmps, lower_caseless_cmps);
+			if (folder.valid()) {
+				folded = folder.code();
+				caseless_cmps = false;
+				lower_caseless_cmps = false;
 			}
 		}
+		const code_vector_type &studied = folded.offset() ? folded : code;
 
-		if (continue_work == false || char_count < 2) {
-			// don't bother if just a single char
-			return 0;
+		auto instructions = std::make_shared<linked_code<traits_type> >(studied);
+		if (instructions->valid()) {
+			instructions->fuse_repeats();
+			linked = instructions;
 		}
 
-		int old_cursor = 0;
-		if (code[old_cursor] != OP_END) {
-			// just a plain string
-			code_vector_type new_code(char_count + 3);
-			// now, strip all OP_CHARs and turn the code into OP_STRING
-			int new_cursor = 0;
-			new_code[new_cursor++] = OP_STRING;
-			new_code[new_cursor++] = char_count;
-			while (code[old_cursor] != OP_END) {
-				if (code[old_cursor] == OP_CHAR) {
-					++old_cursor;
-				} else {
-					new_code[new_cursor++] = code[old_cursor++];
+		auto cache = std::make_shared<dfa_cache>(studied);
+		if (cache->anchored.valid()) {
+			dfa = cache;
+		}
+		auto threads = std::make_shared<const re_program<traits_type> >(studied, using_backrefs);
+		if (threads->valid()) {
+			program = threads;
+			auto positions = std::make_shared<const re_glushkov<traits_type> >(*program);
+			if (positions->valid()) {
+				glushkov = positions;
+			}
+			auto ways = std::make_shared<const re_onepass<traits_type> >(*program);
+			if (ways->valid()) {
+				onepass = ways;
+			}
+		}
+
+		const code_type *base = studied.code();
+
+		// leading literal; a run of OP_CHAR and OP_STRING at the very start of the
+		// code can't be skipped by any failure point.
+		const code_type *lp = base;
+		for (bool more = true; more;) {
+			switch (*lp) {
+				case OP_CHAR:
+					prefix += static_cast<char_type>(lp[1]);
+					lp += 2;
+					break;
+				case OP_STRING:
+					prefix.append(lp + 2, lp + 2 + lp[1]);
+					lp += 2 + lp[1];
+					break;
+				default:
+					more = false;
+					break;
+			}
+		}
+		prefix_only = !prefix.empty() && *lp == OP_END;
+		for (size_t i = 1; i < prefix.size(); i++) {
+			if (traits_type::frequency(prefix[i]) < traits_type::frequency(prefix[prefix_rare])) {
+				prefix_rare = i;
+			}
+		}
+		const code_graph<traits_type> graph(studied);
+		if (graph.valid() && graph.end() >= 0) {
+			exec_study_anchor(graph);
+			if (prefix.empty()) {
+				exec_study_inner(graph);
+				exec_study_suffix(graph);
+			}
+		}
+
+		const int code_end = studied.offset();
+		std::bitset<256> map;
+		std::vector<bool> visited(code_end + 1, false);
+		std::vector<const code_type *> pending(1, base);
+
+		while (!pending.empty()) {
+			const code_type *cp = pending.back();
+			pending.pop_back();
+
+			bool follow = true;
+			while (follow) {
+				const int at = cp - base;
+				if (at < 0 || at >= code_end) {
+					return; // bogus address, give up.
+				}
+				if (visited[at]) {
+					break;
+				}
+				visited[at] = true;
+
+				switch (*cp) {
+					case OP_NOOP:
+					case OP_POP_FAILURE:
+					case OP_BEGIN_OF_LINE:
+					case OP_END_OF_LINE:
+					case OP_BEGIN_OF_BUFFER:
+					case OP_END_OF_BUFFER:
+					case OP_BEGIN_OF_WORD:
+					case OP_ATOMIC_BEGIN:
+					case OP_ATOMIC_END:
+						++cp;
+						continue;
+
+					case OP_BACKREF_BEGIN:
+					case OP_BACKREF_END:
+					case OP_WORD_BOUNDARY:
+						cp += 2;
+						continue;
+
+					case OP_GOTO:
+					case OP_POP_FAILURE_GOTO:
+					case OP_FAKE_FAILURE_GOTO:
+						++cp;
+						cp += code_vector_type::decode_address_and_advance(cp);
+						continue;
+
+					case OP_PUSH_FAILURE: {
+						++cp;
+						int addr = code_vector_type::decode_address_and_advance(cp);
+						pending.push_back(cp + addr);
+						continue;
+					}
+
+					case OP_CLOSURE:
+					case OP_CLOSURE_INC: {
+						const bool entry = (*cp++ == OP_CLOSURE);
+						int addr = code_vector_type::decode_address_and_advance(cp);
+						int mi = code_vector_type::decode_number_and_advance(cp); // minimum
+						code_vector_type::decode_number_and_advance(cp); // maximum
+						code_vector_type::decode_number_and_advance(cp); // slot
+						// the loop can only be skipped on entry if it's allowed zero matches.
+						if (!entry || mi == 0) {
+							pending.push_back(cp + addr);
+						}
+						continue;
+					}
+
+					case OP_STRING:
+						if (cp[1] == 0) {
+							return;
+						}
+						for (int c = 0; c < 256; c++) {
+							if (static_cast<char_type>(c) == cp[2]) map.set(c);
+						}
+						follow = false;
+						break;
+
+					default:
+						// everything else has to be a single character test.
+						for (int c = 0; c < 256; c++) {
+							const int r = code_graph<traits_type>::char_test(cp, static_cast<char_type>(c));
+							if (r < 0) {
+								return; // OP_END, backrefs, etc. could match anywhere.
+							}
+							if (r) map.set(c);
+						}
+						follow = false;
+						break;
 				}
 			}
-			new_code[new_cursor] = OP_END;
-			code = new_code;
 		}
-		return 1;
+
+		study_map = map;
+		study_map_valid = true;
 	}
 
 	/////////////////////////////////////////////////////////////////////////////
-	// match stack object; these are used to store/save the counting values
-	// when using the {} style operator; this is a template because some day
-	// i'm going to switch to unicode -- and i want as much type checking that
-	// i can get.
+	// is the expression anchored?
+	// it is if every path from the start goes through a ^ (or \A) before it gets
+	// to anything else; then a match can only start at the beginning of a line
+	// (or of the buffer) and exec_search doesn't have to try anywhere else.
+	// alternatives have to be anchored on every branch.
 	//
-	// the auto cctor is used; that's why cctor's aren't privatized.
 
-	template<class char_type, class int_type>
-	class re_closure {
-	public:
-		//typedef char_type		char_type;
-		//typedef int_type		int_type;
+	template<class syntaxType>
+	void re_engine<syntaxType>::exec_study_anchor(const code_graph<traits_type> &graph) {
+		short found = ANCHOR_BUFFER;
+		std::vector<bool> visited(graph.size(), false);
+		std::vector<int> pending(1, 0);
+		visited[0] = true;
+		while (!pending.empty()) {
+			const int n = pending.back();
+			pending.pop_back();
+			switch (graph.op(n)) {
+				case OP_BEGIN_OF_BUFFER:
+					break;
 
-	public:
-		re_closure(const int_type *c = nullptr, const char_type *t = nullptr, int mi = -1, int mx = -1)
-			: code(c), text(t), minimum(mi), maximum(mx), matched(0) {
+				case OP_BEGIN_OF_LINE:
+					found = ANCHOR_LINE;
+					break;
+
+				case OP_GOTO:
+				case OP_PUSH_FAILURE:
+				case OP_POP_FAILURE:
+				case OP_POP_FAILURE_GOTO:
+				case OP_FAKE_FAILURE_GOTO:
+				case OP_CLOSURE:
+				case OP_CLOSURE_INC:
+				case OP_BACKREF_BEGIN:
+				case OP_BACKREF_END:
+				case OP_NOOP:
+				case OP_ATOMIC_BEGIN:
+				case OP_ATOMIC_END:
+					for (int s: graph.successors(n)) {
+						if (!visited[s]) {
+							visited[s] = true;
+							pending.push_back(s);
+						}
+					}
+					break;
+
+				default:
+					return; // this path isn't anchored.
+			}
+		}
+		anchor = found;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// find the longest literal every match has to contain.
+	// the instructions every match has to execute are the ones that dominate the
+	// OP_END in the code graph. walk that chain in execution order and collect
+	// runs of OP_CHAR/OP_STRING that directly follow each other in the code, and
+	// can't be jumped into from anywhere else. groups don't consume anything so
+	// they don't break a run up.
+	//
+
+	template<class syntaxType>
+	void re_engine<syntaxType>::exec_study_inner(const code_graph<traits_type> &graph) {
+		const std::vector<int> idom = graph.dominators();
+		std::vector<int> chain;
+		for (int n = graph.end(); n != 0; n = idom[n]) {
+			chain.push_back(n);
+		}
+		chain.push_back(0);
+		std::reverse(chain.begin(), chain.end());
+
+		typename traits_type::string_type run;
+		int run_node = -1, best_node = -1;
+		int prev = -1;
+		for (int n: chain) {
+			const auto op = graph.op(n);
+			const bool literal = (op == OP_CHAR || op == OP_STRING);
+			const bool transparent = (op == OP_BACKREF_BEGIN || op == OP_BACKREF_END || op == OP_NOOP
+			                          || op == OP_ATOMIC_BEGIN || op == OP_ATOMIC_END);
+
+			const bool follows = prev != -1
+			                     && graph.offset(n) == graph.offset(prev) + graph.instruction_length(graph.code(prev))
+			                     && graph.predecessors(n).size() == 1;
+			if (!follows || !(literal || transparent)) {
+				if (run.size() > inner.size()) {
+					inner = run;
+					best_node = run_node;
+				}
+				run.clear();
+			}
+			if (op == OP_CHAR) {
+				if (run.empty()) run_node = n;
+				run += static_cast<char_type>(graph.code(n)[1]);
+			} else if (op == OP_STRING) {
+				if (run.empty()) run_node = n;
+				run.append(graph.code(n) + 2, graph.code(n) + 2 + graph.code(n)[1]);
+			}
+			prev = n;
 		}
 
-		int failure() const {
-			return (maximum == -1 && minimum == -1);
+		if (best_node > 0) {
+			inner_min = graph.min_distance(best_node);
+			inner_max = graph.max_distance(best_node);
+		} else {
+			inner.clear();
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// find the literal every match ends with.
+	// that's a run of OP_CHAR/OP_STRING that only the OP_END (and closing groups)
+	// can follow, and that nothing jumps into the middle of. it's only any good
+	// if nothing in front of it can consume its first character: then a match
+	// can't have an earlier copy of the literal inside it, so the matches ending
+	// at each copy of the literal start after the copy before it, and
+	// exec_search never has to walk backwards over the same text twice.
+	//
+
+	template<class syntaxType>
+	void re_engine<syntaxType>::exec_study_suffix(const code_graph<traits_type> &graph) {
+		typename traits_type::string_type literal;
+		int first = -1;
+		for (int n = graph.end(); graph.predecessors(n).size() == 1;) {
+			const int p = graph.predecessors(n)[0];
+			if (graph.offset(p) + graph.instruction_length(graph.code(p)) != graph.offset(n)) {
+				break;
+			}
+			const auto op = graph.op(p);
+			if (op == OP_CHAR) {
+				literal.insert(literal.begin(), static_cast<char_type>(graph.code(p)[1]));
+			} else if (op == OP_STRING) {
+				literal.insert(literal.begin(), graph.code(p) + 2, graph.code(p) + 2 + graph.code(p)[1]);
+			} else if (!literal.empty() || !(op == OP_BACKREF_END || op == OP_NOOP)) {
+				break;
+			}
+			if (!literal.empty()) {
+				first = p;
+			}
+			n = p;
+		}
+		if (first <= 0) {
+			return; // nothing, or the whole expression (that's the prefix).
 		}
 
-		int closed() const {
-			if (maximum == -1) {
-				// we are not match counting.
-				return 1;
+		code_vector_type reversed;
+		if (!graph.reverse(first, reversed)) {
+			return;
+		}
+		const code_type *base = reversed.code();
+		for (int at = 0; at < reversed.offset();) {
+			const int op = base[at];
+			if (op != OP_END && op != OP_GOTO && op != OP_PUSH_FAILURE
+			    && code_graph<traits_type>::char_test(base + at, literal[0]) != 0) {
+				return;
 			}
+			// step over a whole negated class.
+			at = (op == OP_PUSH_FAILURE2) ? graph.jump_target(base, at) + 1
+			                              : at + graph.instruction_length(base + at);
+		}
+
+		suffix = literal;
+		suffix_min = graph.min_distance(first);
+		reverse_code = reversed;
+	}
+
+	// can ch begin a match? the caseless compares left over when the code
+	// couldn't be folded (wide characters) are checked here.
+	template<class syntaxType>
+	bool re_engine<syntaxType>::study_map_test(int_type ch) const {
+		auto index = [](int_type c) {
+			return static_cast<typename std::make_unsigned<char_type>::type>(c);
+		};
+		if (index(ch) > 255) {
+			return true;
+		}
+		if (study_map.test(index(ch))) {
+			return true;
+		}
+		if (caseless_cmps || lower_caseless_cmps) {
+			const int_type u = static_cast<char_type>(traits_type::toupper(ch));
+			const int_type l = static_cast<char_type>(traits_type::tolower(ch));
+			return (index(u) <= 255 && study_map.test(index(u)))
+			       || (index(l) <= 255 && study_map.test(index(l)));
+		}
+		return false;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// match stack object; an entry on exec_backtrack's failure stack. it's four
+	// ints, so a backtracking match walks 16 bytes an entry and not the two
+	// pointers and four ints it used to be. code is the index of the linked
+	// instruction it goes back to and text an offset from the start of the text
+	// (-1 when there's nothing to go back to).
+	//
+	// a counting entry has the slot of its closure's count, and goes back to
+	// its OP_CLOSURE or OP_CLOSURE_INC, which has the closure's bounds; one with
+	// no code just puts the count back (see restore()) when it comes off the
+	// stack. an OP_REPEAT's entry (see run()) is the repeat, the start of the
+	// run, and how much of it is taken now. an atomic group's mark() is where
+	// its OP_ATOMIC_END cuts the stack back to; a failure just goes past it. a
+	// capture() puts a group's begin and end back the way they were before it
+	// was changed.
+
+	struct re_closure {
+		static re_closure failure(int c, int t = -1) {
+			return re_closure{c, t, 0, -1};
+		}
+
+		// an OP_FAKE_FAILURE_GOTO's; nothing to go back to, but it says where the
+		// first time round the x+ it goes into began.
+		static re_closure fake(int c, int at) {
+			return re_closure{c, -1, at, -1};
+		}
+
+		static re_closure counting(int c, int t, int s, int count) {
+			return re_closure{c, t, count, s};
+		}
+
+		static re_closure restore(int s, int count) {
+			return re_closure{RESTORE, -1, count, s};
+		}
+
+		static re_closure mark() {
+			return re_closure{ATOMIC, -1, 0, -1};
+		}
+
+		static re_closure capture(int group, int begin, int end) {
+			return re_closure{CAPTURE, begin, end, group};
+		}
+
+		static re_closure run(int repeat, int t, int count) {
+			return re_closure{repeat, t, count, RUN};
+		}
+
+		bool failure() const {
+			return code >= 0 && slot == -1;
+		}
+
+		bool running() const {
+			return code >= 0 && slot == RUN;
+		}
+
+		bool restores() const {
+			return code == RESTORE;
+		}
+
+		bool marks() const {
+			return code == ATOMIC;
+		}
+
+		bool captures() const {
+			return code == CAPTURE;
+		}
+
+		static bool closed(const int minimum, const int maximum, const int matched) {
 			if (minimum == maximum && matched == minimum) {
-				return 1;
+				return true;
 			}
 			if ((minimum == 0 && matched <= maximum)
 			    || (maximum == 0 && matched >= minimum)) {
-				return 1;
+				return true;
 			}
 			if ((minimum != 0 && maximum != 0)
 			    && (matched >= minimum && matched <= maximum)) {
-				return 1;
+				return true;
 			}
-			return 0;
+			return false;
 		}
 
-		int can_continue() const {
-			assert(maximum != -1 && minimum != -1); // don't call this unless counting.
+		static bool can_continue(const int minimum, const int maximum, const int matched) {
 			if (minimum == maximum && matched < minimum) {
-				return 1;
+				return true;
 			}
 			if ((minimum != 0 && maximum != 0) && matched < maximum) {
-				return 1;
+				return true;
 			}
 			if ((minimum == 0 && matched < maximum) || maximum == 0) {
-				return 1;
+				return true;
 			}
-			return 0;
+			return false;
 		}
 
-		// vc5
-		bool operator <(const re_closure &) const { return false; }
-		bool operator ==(const re_closure &) const { return false; }
+		enum { RESTORE = -1, ATOMIC = -2, CAPTURE = -3 }; // code
+		enum { RUN = -2 }; // slot
 
+		int code;
+		int text;
+		int matched; // a closure's count, how much of a run is taken, a group's end
+		int slot; // a closure's slot, a group
+	};
+
+	/////////////////////////////////////////////////////////////////////////////
+	// the failure stack's storage; the first inlined entries are in the object
+	// itself (a few KB), so a backtracking match that doesn't go deeper than
+	// that doesn't allocate for it, even in a new context; past that it grows
+	// on the heap like a vector. only what exec_backtrack needs.
+
+	template<class T, size_t inlined>
+	class re_failure_stack {
 	public:
-		const int_type *code;
-		const char_type *text;
-		int minimum;
-		int maximum;
-		int matched;
+		re_failure_stack() : _begin(_inline), _end(_inline), _limit(_inline + inlined) {
+		}
+
+		re_failure_stack(const re_failure_stack &) = delete;
+
+		re_failure_stack &operator=(const re_failure_stack &) = delete;
+
+		bool empty() const { return _end == _begin; }
+
+		size_t size() const { return _end - _begin; }
+
+		size_t capacity() const { return _limit - _begin; }
+
+		size_t bytes() const { return size() * sizeof(T); }
+
+		void clear() { _end = _begin; }
+
+		void push_back(const T &v) {
+			if (_end == _limit) [[unlikely]] {
+				grow();
+			}
+			*_end++ = v;
+		}
+
+		void pop_back() {
+			assert(!empty());
+			--_end;
+		}
+
+		T &back() { return _end[-1]; }
+
+		T &operator[](const size_t i) { return _begin[i]; }
+
+		// it only gets smaller.
+		void resize(const size_t n) {
+			assert(n <= size());
+			_end = _begin + n;
+		}
+
+	private:
+		void grow() {
+			const size_t n = size();
+			const size_t grown = 2 * capacity();
+			std::unique_ptr<T[]> more(new T[grown]);
+			std::copy(_begin, _end, more.get());
+			_begin = more.get();
+			_end = _begin + n;
+			_limit = _begin + grown;
+			_heap = std::move(more);
+		}
+
+		T _inline[inlined];
+		std::unique_ptr<T[]> _heap;
+		T *_begin;
+		T *_end;
+		T *_limit;
 	};
 
 
@@ -340,26 +1003,51 @@ namespace re {
 	//	 not possible.
 	//
 
-	inline int decode_address_and_advance(const char *&cp) {
-		short r = *cp++;
-		r |= *cp++ << 8;
-		return r;
+	template<class codeT>
+	inline int decode_address_and_advance(const codeT *&cp) {
+		return code_operands<codeT>::address(cp);
 	}
 
-	inline int decode_address_and_advance(const wchar_t *&cp) {
-		wint_t r = *cp++;
-		r |= *cp++ << 8;
-		return r;
+	template<class codeT>
+	inline int decode_number_and_advance(const codeT *&cp) {
+		return code_operands<codeT>::number(cp);
 	}
 
-	typedef std::pair<int, int> runtime_backref;
+	/////////////////////////////////////////////////////////////////////////////
+	// the buffers a match works in: exec_backtrack's (the failure stack, the
+	// closure counts and the groups' captures), the slots the pike vm,
+	// re_bitstate and re_onepass fill in, what those work in themselves, and
+	// exec_reverse's lists. they're emptied for each match but keep their
+	// memory, so once they've grown to the expression and the text neither
+	// exec_match nor exec_search goes to the allocator. one match at a time in
+	// each; the engine is shared, so each thread keeps its own
+	// (thread_context) for the calls that don't pass one.
 
-	inline ostream &operator <<(ostream &out, const runtime_backref &p) {
-		return out << '(' << p.first << ',' << p.second << ')';
+	template<class syntaxType>
+	struct re_engine<syntaxType>::match_context {
+		re_failure_stack<re_closure, 256> failures;
+		std::vector<int> counts;
+		std::vector<int> captures;
+		std::vector<int> slots;
+		std::vector<int> kept; // re_onepass's
+		typename re_pike<traits_type>::buffers pike;
+		typename re_bitstate<traits_type>::buffers bitstate;
+		std::vector<int> seen, current, next, pending; // exec_reverse's
+	};
+
+	template<class syntaxType>
+	typename re_engine<syntaxType>::match_context &re_engine<syntaxType>::thread_context() {
+		thread_local match_context context;
+		return context;
+	}
+
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_match(ctext_type &text, bool partial_matches, re_match_vector &matches) const {
+		return exec_match(text, thread_context(), partial_matches, matches);
 	}
 
 	template<class syntaxType>
-	int re_engine<syntaxType>::exec_match(ctext_type &text,
+	int re_engine<syntaxType>::exec_match(ctext_type &text, match_context &context,
 	                                      bool partial_matches, re_match_vector &matches) const {
 		if (syntax_error_state) {
 			return -3;
@@ -375,413 +1063,623 @@ namespace re {
 			return -1;
 		}
 
-		typedef std::vector<std::pair<int, int> > match_count_vector;
-		match_count_vector mv(0);
+		// nobody wants the groups, so the dfa can find the end of the match
+		// without backtracking.
+		if (!partial_matches && &matches == &default_matches) {
+			const int found = exec_dfa(text, false);
+			if (found >= 0) {
+				text.text(text.data() + found);
+				return (text.position() - text.start());
+			}
+			if (found == re_dfa<traits_type>::NO_MATCH) {
+				return -1;
+			}
+		}
+
+		if (linear_matching && !partial_matches) {
+			const int found = exec_pike(text, text.position(), context, matches);
+			if (found >= 0) {
+				return (text.position() - text.start());
+			}
+			if (found == re_pike<traits_type>::NO_MATCH) {
+				return -1;
+			}
+		}
+
+		if (!partial_matches) {
+			// nothing to backtrack to, the groups are saved on the way through.
+			const int found = exec_onepass(text, context, matches);
+			if (found >= 0) {
+				return (text.position() - text.start());
+			}
+			if (found == re_onepass<traits_type>::NO_MATCH) {
+				return -1;
+			}
+		}
+
+		const int from = text.position();
+		if (!partial_matches) {
+			// short text can be backtracked without going over the same ground
+			// twice.
+			const int found = exec_bitstate(text, from, context, matches);
+			if (found >= 0) {
+				return (text.position() - text.start());
+			}
+			if (found == re_bitstate<traits_type>::NO_MATCH) {
+				return -1;
+			}
+			if (text.length() - from <= re_bitstate<traits_type>::SHORT) {
+				// short, but with too many counts for the bitset; still linear.
+				const int linear = exec_pike(text, from, context, matches);
+				if (linear >= 0) {
+					return (text.position() - text.start());
+				}
+				if (linear == re_pike<traits_type>::NO_MATCH) {
+					return -1;
+				}
+			}
+		}
+
+		const int ret = exec_backtrack(text, partial_matches, context, matches);
+		if (ret == -2 && !partial_matches && program) {
+			// out of failure stack; the pike vm doesn't need one.
+			text.text(text.data() + from);
+			const int found = exec_pike(text, from, context, matches);
+			if (found >= 0) {
+				return (text.position() - text.start());
+			}
+			if (found == re_pike<traits_type>::NO_MATCH) {
+				return -1;
+			}
+		}
+		return ret;
+	}
 
-		typedef re_closure<char_type, typename code_vector_type::code_type> re_match_closure;
-		typedef std::stack<re_match_closure> matching_stack;
-		matching_stack ms;
+	/////////////////////////////////////////////////////////////////////////////
+	// the backtracking matcher; exec_match has checked there's code and text.
+	// it runs the linked instructions, not the code itself.
+	//
+	// with gcc and clang each instruction jumps straight to the next one's case
+	// through a table of label addresses (RE_NEXT), instead of going back round
+	// the loop to the switch; every op then has its own indirect jump, which the
+	// branch predictor does a lot better with. the switch is still there for
+	// other compilers, and for -DRE_NO_COMPUTED_GOTO. the ops that run all the
+	// time come first, the rare ones after.
+	//
 
-		typedef std::vector<runtime_backref> runtime_backref_stack;
-		typedef std::vector<runtime_backref_stack> runtime_backref_stack_vector;
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(RE_NO_COMPUTED_GOTO)
+#define RE_COMPUTED_GOTO 1
+// label addresses are an extension; -pedantic says so for every one of them.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
 
-		// can use (below): runtime_backref_stack bs(0); and the stacks will be added when necessary.
-		runtime_backref_stack_vector bs(using_backrefs, runtime_backref_stack(0));
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_backtrack(ctext_type &text, bool partial_matches, match_context &context,
+	                                          re_match_vector &matches) const {
+		// the count of each {n,m} closure, by the slot the compiler gave it. a
+		// closure's count is 0 outside of it; the failure stack puts the counts
+		// back when it backtracks into one.
+		std::vector<int> &counts = context.counts;
+		counts.assign(code.closures(), 0);
+
+		typedef re_closure re_match_closure;
+		auto &ms = context.failures;
+		ms.clear();
+
+		// each group's begin and end, -1 until it's matched. changing them
+		// pushes a capture() that puts them back, so a failure undoes just what
+		// was changed since the failure point was pushed.
+		std::vector<int> &captures = context.captures;
+		captures.assign(2 * using_backrefs, -1);
+		auto capture = [&ms, &captures](const int group) {
+			// nothing to put back if nothing's been pushed since the last time.
+			if (!ms.empty() && !(ms.back().captures() && ms.back().slot == group)) {
+				ms.push_back(re_match_closure::capture(group, captures[2 * group], captures[2 * group + 1]));
+			}
+		};
+
+		// the newest entry pushed with the slot (and the code, unless code is
+		// -1), or null. a loop pushes one each time round, so it says where the
+		// iteration going on began (an x+'s first one, its fake()).
+		//
+		// a time round that gets back to the top of the loop without taking
+		// anything would go round at the same place for ever. in an x* or x+
+		// that time round fails, and what's left of it is tried before the loop
+		// is; it's ecmascript's rule, and what the pike vm does, dropping a
+		// thread that's back where it's been. perl leaves the loop there
+		// instead: (c?|\d)* takes the 1 of "1ba" here, and nothing in perl. a
+		// counted loop past its minimum is still left there.
+		auto pushed = [&ms](const int code, const int slot) -> const re_match_closure * {
+			for (size_t i = ms.size(); i > 0; i--) {
+				const re_match_closure &m = ms[i - 1];
+				if (m.slot == slot && m.code >= 0 && (code < 0 || m.code == code)) {
+					return &m;
+				}
+			}
+			return nullptr;
+		};
 
-		const typename code_vector_type::code_type *code_ptr = code.code();
+		if (!linked) {
+			return -2;
+		}
+		const instruction_type *base = linked->code();
+		const instruction_type *code_ptr = base;
+		const instruction_type *in = nullptr;
 		const char_type *last_text = nullptr;
+		const char_type *data = text.data();
+		auto offset = [&text, data]() { return static_cast<int>(text.text() - data); };
+		int_type ch = 0;
+
+#if RE_COMPUTED_GOTO
+		// one for each op, in the order of the opcodes enum.
+		static const void *const dispatch[] = {
+			&&op_OP_END, &&op_OP_NOOP, &&op_OP_BACKUP, &&op_OP_FORWARD,
+			&&op_OP_BEGIN_OF_LINE, &&op_OP_END_OF_LINE,
+			&&op_OP_STRING, &&op_OP_BIN_CHAR, &&op_OP_NOT_BIN_CHAR, &&op_OP_ANY_CHAR,
+			&&op_OP_CHAR, &&op_OP_NOT_CHAR, &&op_OP_RANGE_CHAR, &&op_OP_NOT_RANGE_CHAR,
+			&&op_OP_BACKREF_BEGIN, &&op_OP_BACKREF_END, &&op_OP_BACKREF, &&op_illegal,
+			&&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal,
+			&&op_OP_GOTO, &&op_OP_PUSH_FAILURE, &&op_OP_PUSH_FAILURE2, &&op_OP_POP_FAILURE,
+			&&op_OP_POP_FAILURE_GOTO, &&op_OP_FAKE_FAILURE_GOTO,
+			&&op_OP_CLOSURE, &&op_OP_CLOSURE_INC, &&op_illegal,
+			&&op_OP_BEGIN_OF_BUFFER, &&op_OP_END_OF_BUFFER,
+			&&op_OP_BEGIN_OF_WORD, &&op_illegal,
+			&&op_OP_DIGIT, &&op_OP_SPACE, &&op_OP_WORD, &&op_illegal,
+			&&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal,
+			&&op_OP_ATOMIC_BEGIN, &&op_OP_ATOMIC_END,
+			&&op_OP_REPEAT,
+			&&op_OP_CLASS, &&op_OP_NOT_CLASS, &&op_OP_RANGE_CLASS,
+		};
+		static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == OP_RANGE_CLASS + 1,
+		              "a label for every opcode");
+		// and each one where its opcode is; a row of these for each row above, so
+		// moving an opcode doesn't quietly send it somewhere else.
+		static_assert(OP_END == 0 && OP_NOOP == 1 && OP_BACKUP == 2 && OP_FORWARD == 3, "dispatch");
+		static_assert(OP_BEGIN_OF_LINE == 4 && OP_END_OF_LINE == 5, "dispatch");
+		static_assert(OP_STRING == 6 && OP_BIN_CHAR == 7 && OP_NOT_BIN_CHAR == 8 && OP_ANY_CHAR == 9,
+		              "dispatch");
+		static_assert(OP_CHAR == 10 && OP_NOT_CHAR == 11 && OP_RANGE_CHAR == 12 && OP_NOT_RANGE_CHAR == 13,
+		              "dispatch");
+		static_assert(OP_BACKREF_BEGIN == 14 && OP_BACKREF_END == 15 && OP_BACKREF == 16
+		              && OP_BACKREF_FAIL == 17, "dispatch");
+		static_assert(OP_EXT_BEGIN == 18 && OP_EXT_END == 19 && OP_EXT == 20 && OP_NOT_EXT == 21, "dispatch");
+		static_assert(OP_GOTO == 22 && OP_PUSH_FAILURE == 23 && OP_PUSH_FAILURE2 == 24 && OP_POP_FAILURE == 25,
+		              "dispatch");
+		static_assert(OP_POP_FAILURE_GOTO == 26 && OP_FAKE_FAILURE_GOTO == 27, "dispatch");
+		static_assert(OP_CLOSURE == 28 && OP_CLOSURE_INC == 29 && OP_TEST_CLOSURE == 30, "dispatch");
+		static_assert(OP_BEGIN_OF_BUFFER == 31 && OP_END_OF_BUFFER == 32, "dispatch");
+		static_assert(OP_BEGIN_OF_WORD == 33 && OP_END_OF_WORD == 34, "dispatch");
+		static_assert(OP_DIGIT == 35 && OP_SPACE == 36 && OP_WORD == 37 && OP_WORD_BOUNDARY == 38, "dispatch");
+		static_assert(OP_CASELESS == 39 && OP_NO_CASELESS == 40 && OP_LCASELESS == 41 && OP_NO_LCASELESS == 42,
+		              "dispatch");
+		static_assert(OP_ATOMIC_BEGIN == 43 && OP_ATOMIC_END == 44, "dispatch");
+		static_assert(OP_REPEAT == 45, "dispatch");
+		static_assert(OP_CLASS == 46 && OP_NOT_CLASS == 47 && OP_RANGE_CLASS == 48, "dispatch");
+
+		// remember our last match for use if partial_matching.
+#define RE_NEXT() \
+		do { \
+			last_text = text.text(); \
+			in = code_ptr++; \
+			goto *dispatch[in->op]; \
+		} while (0)
+#define RE_CASE(op) case op: op_##op
+#else
+#define RE_NEXT() continue
+#define RE_CASE(op) case op
+#endif
 
-		bool continue_matching = true;
-		while (continue_matching) {
-			bool fail = false;
-			int_type ch = 0;
+		for (;;) {
 			// remember our last match for use if partial_matching.
 			last_text = text.text();
 
 			assert(code_ptr != nullptr);
-			switch (*code_ptr++) {
-				case OP_NOOP:
-					continue;
-
-				case OP_BACKUP:
-					text.unget(ch);
-					continue;
-
-				case OP_FORWARD:
+			in = code_ptr++;
+			switch (in->op) {
+				// the character tests.
+				RE_CASE(OP_CHAR):
 					if (text.next(ch)) break;
-					continue;
-
-				case OP_END: {
-					// we always put the entire matched length in backref 0, since that backref
-					// isn't used.
-					if (&matches != &default_matches) {
-						matches.push_back(re_match_type(0, text.position()));
-						for (int i = 0; i < using_backrefs; i++) {
-							matches.emplace_back(0, 0);
-						}
+					if (ch != static_cast<char_type>(in->arg1) && !code_vector_type::char_test(
+						    static_cast<char_type>(in->arg1), ch, caseless_cmps, lower_caseless_cmps)) break;
+					RE_NEXT();
+
+				RE_CASE(OP_STRING): {
+					const size_t n = in->arg2;
+					const size_t left = text.length() - text.position();
+					if (left >= n && exec_string(linked->literals(*in), text.text(), n)) {
+						text.advance(n);
+						RE_NEXT();
 					}
-					if (!bs.empty()) {
-						for (size_t i = 0; i < bs.size(); i++) {
-							runtime_backref_stack &s = bs[i];
-							while (!s.empty()) {
-								if (s.back().second == -1) {
-									s.pop_back();
-									continue;
-								}
-
-								if (&matches != &default_matches) {
-									if ((s.back().second - s.back().first) > 0) {
-										matches[i + 1].first = s.back().first;
-										matches[i + 1].second = s.back().second - s.back().first;
-									}
-								}
-
-								break;
-							}
+					if (partial_matches) {
+						// as far as the characters one at a time (the OP_CHARs the
+						// optimizer made this from) would have got.
+						size_t k = 0;
+						while (k < std::min(n, left) && exec_string(linked->literals(*in) + k, text.text() + k, 1)) {
+							k++;
 						}
+						last_text = text.text() + k;
 					}
-				}
-					return (text.position()); // length of match. todo: account for +pos
-
-				case OP_BEGIN_OF_LINE:
-					if (text.at_begin() || text[-1] == '\n') continue; // text[-1] always valid
 					break;
+				}
 
-				case OP_END_OF_LINE:
-					if (text.at_end()) continue;
+				RE_CASE(OP_CLASS):
+				RE_CASE(OP_NOT_CLASS):
+				RE_CASE(OP_RANGE_CLASS):
+					if (text.next(ch)) break;
+					if (code_vector_type::class_test(linked->literals(*in), ch, caseless_cmps, lower_caseless_cmps)) {
+						RE_NEXT();
+					}
 					break;
 
-				case OP_ANY_CHAR:
+				RE_CASE(OP_ANY_CHAR):
 					if (text.next(ch)) break;
 					if (ch == '\n') break;
-#if opt_greedy_line
-				if ( *(code_ptr + 1) == OP_GOTO && *(code_ptr + 2) == OP_END ) {
-					// eat entire line
-				}
-#endif
-#if opt_greedy_peek
-				if ( *(code_ptr + 1) == OP_GOTO && *(code_ptr + 2) == OP_CHAR ) {
-					// search ahead for char.
-				}
-#endif
-					continue;
+					RE_NEXT();
 
-				case OP_BIN_CHAR:
+				RE_CASE(OP_NOT_CHAR):
 					if (text.next(ch)) break;
-					if (ch == *code_ptr++) continue;
+					if (ch != static_cast<char_type>(in->arg1) && !code_vector_type::char_test(
+						    static_cast<char_type>(in->arg1), ch, caseless_cmps, lower_caseless_cmps)) RE_NEXT();
 					break;
 
-				case OP_NOT_BIN_CHAR:
+				RE_CASE(OP_RANGE_CHAR):
 					if (text.next(ch)) break;
-					if (ch != *code_ptr++) continue;
+					if (code_vector_type::range_test(in->arg1, in->arg2, ch, caseless_cmps, lower_caseless_cmps)) {
+						RE_NEXT();
+					}
 					break;
 
-				case OP_CHAR:
+				RE_CASE(OP_NOT_RANGE_CHAR):
 					if (text.next(ch)) break;
-					if (caseless_cmps) {
-						if (traits_type::toupper(ch) != traits_type::toupper(*code_ptr++)) break;
-					} else if (lower_caseless_cmps) {
-						if (ch == *code_ptr++ || ch == traits_type::toupper(*code_ptr++)) break;
-					} else {
-						if (ch != static_cast<char_type>(*code_ptr++)) break;
-					}
-					continue;
-
-				case OP_STRING: {
-					size_t n = *(code_ptr++);
-					if (caseless_cmps) {
-						if (traits_type::istrncmp(code_ptr, text.text(), n) == 0) {
-							text.advance(n);
-							code_ptr += n;
-							continue;
-						}
-					} else {
-						if (traits_type::strncmp(code_ptr, text.text(), n) == 0) {
-							text.advance(n);
-							code_ptr += n;
-							continue;
-						}
+					if (!code_vector_type::range_test(in->arg1, in->arg2, ch, caseless_cmps, lower_caseless_cmps)) {
+						RE_NEXT();
 					}
-					code_ptr += n;
 					break;
-				}
-				case OP_NOT_CHAR:
+
+				RE_CASE(OP_DIGIT):
 					if (text.next(ch)) break;
-					if (ch != static_cast<char_type>(*code_ptr++)) continue;
+					if ((in->arg1 ? !traits_type::isdigit(ch) : traits_type::isdigit(ch))) {
+						RE_NEXT();
+					}
 					break;
 
-				case OP_RANGE_CHAR:
+				RE_CASE(OP_SPACE):
 					if (text.next(ch)) break;
-					code_ptr += 2;
-					if (ch >= *(code_ptr - 2) && ch <= *(code_ptr - 1)) continue;
+					if ((in->arg1 ? !traits_type::isspace(ch) : traits_type::isspace(ch))) {
+						RE_NEXT();
+					}
 					break;
 
-				case OP_NOT_RANGE_CHAR:
+				RE_CASE(OP_WORD):
 					if (text.next(ch)) break;
-					code_ptr += 2;
-					if (!(ch >= *(code_ptr - 2) && ch <= *(code_ptr - 1))) continue;
+					if ((in->arg1 ? !traits_type::isalnum(ch) : traits_type::isalnum(ch))) {
+						RE_NEXT();
+					}
 					break;
 
-				case OP_BACKREF_BEGIN: {
-					int ref = *code_ptr++;
-					while (static_cast<int>(bs.size()) < ref) {
-						bs.emplace_back();
+				// jumps, failure points and closures.
+				// x* and x+ go back to the failure point that leaves them, x*? and
+				// x+? push one to go back to it.
+				RE_CASE(OP_GOTO):
+					code_ptr = base + in->target;
+					if (in->empty_loop) {
+						const re_match_closure *m = pushed(code_ptr->target, -1);
+						if (m && m->text == offset()) {
+							break;
+						}
+						if (m && m->text < 0 && m->matched == offset()) {
+							// an x+'s first time round; the pike vm's been where
+							// going round again starts, so that's all it leaves.
+							code_ptr = base + code_ptr->target;
+						}
 					}
-					runtime_backref_stack &s = bs[ref - 1];
-					s.push_back(runtime_backref(text.position(), -1));
-				}
-					continue;
-
-				case OP_BACKREF_END: {
-					size_t ref = *code_ptr++;
-
-					assert(ref <= bs.size());
-					runtime_backref_stack &s = bs[ref - 1];
-					assert(!s.empty());
-
-					if (s.back().second == -1) {
-						s.back().second = text.position();
-					} else {
-						s.push_back(runtime_backref(s.back().first, text.position()));
+					RE_NEXT();
+
+				RE_CASE(OP_PUSH_FAILURE):
+					if (ms.bytes() > maximum_closure_stack) [[unlikely]] return -2;
+					if (in->empty_loop) {
+						// x*? and x+? leave first anyway; going round again from
+						// where this time round began isn't another way.
+						const re_match_closure *m = pushed(base[in->target].target, -1);
+						if (m && (m->text < 0 ? m->matched : m->text) == offset()) RE_NEXT();
 					}
-					continue;
-				}
-
-				case OP_BACKREF: {
-					const size_t ref = *code_ptr++;
-					assert(ref <= bs.size());
-					if (ref > bs.size() || bs[ref - 1].empty()) {
-						break;
+					ms.push_back(re_match_closure::failure(in->target, offset()));
+					RE_NEXT();
+
+				RE_CASE(OP_REPEAT): {
+					// take all of the run; backtracking gives it back a character
+					// at a time, from the one failure point.
+					const char_type *run = text.text();
+					const size_t left = text.length() - text.position();
+					const int least = static_cast<int>(in->arg2);
+					int taken = static_cast<int>(exec_run(base[in->arg1], run, left));
+					// possessive (see linked_code::fuse_repeats) when the compares
+					// are the ones it was worked out with; then nothing after it can
+					// start with what it took, and there's no giving any back.
+					const bool keep = in->slot > 0 && !partial_matches && !caseless_cmps && !lower_caseless_cmps;
+					int_type follows;
+					if (!keep && !partial_matches && exec_run_follows(base + in->target, follows)) {
+						// the code after it needs this character; no point stopping
+						// anywhere else.
+						taken = std::min(taken, static_cast<int>(left) - 1);
+						while (taken >= least && run[taken] != follows) {
+							taken--;
+						}
 					}
-					runtime_backref_stack &s = bs[ref - 1];
-
-					// scg alt: if ( text.compare(s.back().first, s.back().second, ch) == false ) {
-					if (text.has_substring(s.back().first, s.back().second, ch) == false) {
-						break;
+					if (taken < least) break;
+					if (taken > least && !keep) {
+						if (ms.bytes() > maximum_closure_stack) [[unlikely]] return -2;
+						ms.push_back(re_match_closure::run(static_cast<int>(in - base), static_cast<int>(run - data), taken));
 					}
-					continue;
+					text.text(run + taken);
+					code_ptr = base + in->target;
+					RE_NEXT();
 				}
 
-				case OP_GOTO:
-					code_ptr += decode_address_and_advance(code_ptr);
-					continue;
+				RE_CASE(OP_POP_FAILURE):
+					if (ms.back().failure()) ms.pop_back();
+					RE_NEXT();
 
-				case OP_FAKE_FAILURE_GOTO: {
-					int addr0 = decode_address_and_advance(code_ptr);
-					assert(*code_ptr == OP_PUSH_FAILURE);
-					const typename code_vector_type::code_type *cp = code_ptr + 1;
-					int addr1 = decode_address_and_advance(cp);
-					if (maximum_closure_stack < ms.size()) return -2;
-					ms.push(re_match_closure(code_ptr + addr1 + 3));
-					code_ptr += addr0;
-					continue;
-				}
+				RE_CASE(OP_POP_FAILURE_GOTO):
+					if (ms.back().failure()) ms.pop_back();
+					code_ptr = base + in->target;
+					RE_NEXT();
 
-				case OP_PUSH_FAILURE2: {
-					int addr = decode_address_and_advance(code_ptr);
-					if (maximum_closure_stack < ms.size()) return -2;
-					ms.push(re_match_closure(code_ptr + addr));
-					continue;
+				RE_CASE(OP_CLOSURE):
+					if (ms.bytes() > maximum_closure_stack) [[unlikely]] {
+						return -2;
+					}
+					counts[in->slot] = 0;
+					ms.push_back(re_match_closure::counting(static_cast<int>(in - base), offset(), in->slot, 0));
+					RE_NEXT();
+
+				RE_CASE(OP_CLOSURE_INC): {
+					// the count goes in the failure stack entry too; other failure
+					// points get pushed before the next increment, and the entry is
+					// tested (outside this switch) with the count it had here.
+					const re_match_closure m = re_match_closure::counting(static_cast<int>(in - base), offset(),
+					                                                      in->slot, counts[in->slot] + 1);
+
+					if (ms.bytes() > maximum_closure_stack) [[unlikely]] {
+						return -2;
+					}
+					// once the minimum's done, a time round that took nothing is the
+					// last one.
+					const bool done = in->empty_loop && m.matched >= in->arg1;
+					const re_match_closure *begun = done ? pushed(-1, in->slot) : nullptr;
+					if (!re_match_closure::can_continue(in->arg1, in->arg2, m.matched)
+					    || (begun && begun->text == offset())) {
+						// done; going back into the closure has to find the count
+						// it left with.
+						ms.push_back(re_match_closure::restore(in->slot, counts[in->slot]));
+						counts[in->slot] = 0;
+						RE_NEXT();
+					}
+					counts[in->slot] = m.matched;
+					code_ptr = base + in->target;
+					ms.push_back(m);
+					RE_NEXT();
 				}
 
-				case OP_PUSH_FAILURE: {
-					int addr = decode_address_and_advance(code_ptr); // offset to goto
-					if (maximum_closure_stack < ms.size()) return -2;
-					ms.push(re_match_closure(code_ptr + addr, text.text()));
-					continue;
+				// the groups.
+				RE_CASE(OP_BACKREF_BEGIN): {
+					const int group = in->arg1 - 1;
+					assert(group >= 0 && group < using_backrefs);
+					capture(group);
+					captures[2 * group] = text.position();
+					RE_NEXT();
 				}
 
-				case OP_POP_FAILURE:
-					if (ms.top().failure()) ms.pop();
-					continue;
-
-				case OP_POP_FAILURE_GOTO:
-					if (ms.top().failure()) ms.pop();
-					code_ptr += decode_address_and_advance(code_ptr);
-					continue;
-
-				case OP_CLOSURE: {
-					int addr = decode_address_and_advance(code_ptr); // offset to goto
-					int mi = decode_address_and_advance(code_ptr); // minimum
-					int mx = decode_address_and_advance(code_ptr); // maximum
-					if (maximum_closure_stack < ms.size()) {
-						return -2;
-					}
-					ms.push(re_match_closure(code_ptr + addr, text.text(), mi, mx));
-					continue;
+				RE_CASE(OP_BACKREF_END): {
+					const int group = in->arg1 - 1;
+					assert(group >= 0 && group < using_backrefs);
+					capture(group);
+					captures[2 * group + 1] = text.position();
+					RE_NEXT();
 				}
 
-				case OP_CLOSURE_INC: {
-					int my_addr = code_ptr - code.code(); // index into map (unique)
-					int addr = decode_address_and_advance(code_ptr); // offset to goto
-					int mi = decode_address_and_advance(code_ptr); // minimum
-					int mx = decode_address_and_advance(code_ptr); // maximum
-
-					// we store the number of successful matches in a "map", and then store
-					// it again in the failure stack. we do this because other failure
-					// points might be pushed onto the stack before we get a chance to
-					// do this increment -- and we save copies in the stack to test failures
-					// later (outside this switch).
-
-					// the map really isn't a stl::map because that class isn't thread safe,
-					// this implementation uses a rb_tree with a bunch of static objects.
-
-					int n_matches = 1;
-
-					auto it = mv.begin();
-					if (!mv.empty()) {
-						while (it != mv.end()) {
-							if (it->first == my_addr) {
-								n_matches = it->second + 1;
-								break;
+				RE_CASE(OP_END):
+					// we always put the entire matched length in backref 0, since that backref
+					// isn't used. a group that matched nothing is left as (0, 0).
+					if (&matches != &default_matches) {
+						matches.push_back(re_match_type(text.start(), text.position() - text.start()));
+						for (int i = 0; i < using_backrefs; i++) {
+							const int begin = captures[2 * i];
+							const int end = captures[2 * i + 1];
+							if (begin >= 0 && end - begin > 0) {
+								matches.emplace_back(begin, end - begin);
+							} else {
+								matches.emplace_back(0, 0);
 							}
-							++it;
 						}
 					}
+					return (text.position() - text.start()); // length of match.
 
-					if (it == mv.end()) {
-						mv.emplace_back(my_addr, 0);
-						it = mv.end() - 1;
-					}
-
-					re_match_closure m;
-					m.matched = n_matches;
-					m.minimum = mi;
-					m.maximum = mx;
-
-
-					if (!m.can_continue()) {
-						it->second = 0;
-						continue;
-					}
-					it->second = n_matches;
+				// the rest don't turn up much, or only once in a match.
+				RE_CASE(OP_BEGIN_OF_LINE):
+					if (text.at_begin()) RE_NEXT();
+					text.current(ch); // the character in front of us
+					if (ch == '\n') RE_NEXT();
+					break;
 
-					m.text = text.text();
-					m.code = code_ptr;
-					code_ptr += addr;
-					ms.push(m);
-					continue;
-				}
+				RE_CASE(OP_END_OF_LINE):
+					if (text.at_end()) RE_NEXT();
+					break;
 
-#if notdone
-				case OP_BEGIN_OF_BUFFER:
-					if (text.buffer_begin()) continue;
+				RE_CASE(OP_BEGIN_OF_BUFFER):
+					if (text.at_begin()) RE_NEXT();
 					break;
 
-				case OP_END_OF_BUFFER:
-					if (text.buffer_end()) continue;
+				RE_CASE(OP_END_OF_BUFFER):
+					if (text.at_end()) RE_NEXT();
 					break;
-#endif
 
-				case OP_BEGIN_OF_WORD: {
+				RE_CASE(OP_BEGIN_OF_WORD): {
 					if (text.at_end()) {
 						break;
 					}
-					if (text.at_begin() || traits_type::isalnum(static_cast<int_type>(text[-1])) == 0) {
-						continue;
+					if (text.at_begin()) {
+						RE_NEXT();
+					}
+					text.current(ch);
+					if (traits_type::isalnum(ch) == 0) {
+						RE_NEXT();
 					}
 				}
 				break;
 
-#if notdone
-				case OP_END_OF_WORD: {
-					if (text.at_begin() || traits_type::isalnum(text[-1]) == 0) {
+				RE_CASE(OP_BIN_CHAR):
+					if (text.next(ch)) break;
+					if (ch == in->arg1) RE_NEXT();
+					break;
+
+				RE_CASE(OP_NOT_BIN_CHAR):
+					if (text.next(ch)) break;
+					if (ch != in->arg1) RE_NEXT();
+					break;
+
+				RE_CASE(OP_BACKREF): {
+					const int group = in->arg1 - 1;
+					assert(group >= 0 && group < using_backrefs);
+					if (group >= using_backrefs || captures[2 * group] < 0) {
 						break;
 					}
-					if (traits_type::isalnum(*text) != 0) {
+
+					// scg alt: if ( text.compare(s.back().first, s.back().second, ch) == false ) {
+					if (text.has_substring(captures[2 * group], captures[2 * group + 1], ch) == false) {
 						break;
 					}
-					if (text.at_end()) {
-						continue;
-					}
-					continue;
+					RE_NEXT();
 				}
-#endif
 
-#if notdone
-				case OP_WORD_BOUNDARY: // match at begin/end of strings (buffer) ok.
-				{
-					if (*code_ptr) {
-						// complement
-						if (text.at_begin() || text.word_test()) break;
-						continue;
+				RE_CASE(OP_FAKE_FAILURE_GOTO):
+					// arg1 is where the OP_PUSH_FAILURE after this one goes. going
+					// into an x+ starts its first time round; going to an x*?'s back
+					// edge (which goes back to that OP_PUSH_FAILURE) doesn't.
+					if (ms.bytes() > maximum_closure_stack) [[unlikely]] return -2;
+					code_ptr = base + in->target;
+					{
+						const bool back_edge = code_ptr->op == OP_PUSH_FAILURE && code_ptr->target == in - base + 1;
+						ms.push_back(re_match_closure::fake(in->arg1, back_edge ? -1 : offset()));
 					}
-					if (text.at_begin() || text.word_test()) continue;
-					break;
+					RE_NEXT();
+
+				RE_CASE(OP_PUSH_FAILURE2):
+					if (ms.bytes() > maximum_closure_stack) [[unlikely]] return -2;
+					ms.push_back(re_match_closure::failure(in->target));
+					RE_NEXT();
+
+				RE_CASE(OP_ATOMIC_BEGIN):
+					if (ms.bytes() > maximum_closure_stack) [[unlikely]] return -2;
+					ms.push_back(re_match_closure::mark());
+					RE_NEXT();
+
+				RE_CASE(OP_ATOMIC_END): {
+					// whatever's left to try inside the group is forgotten, but not
+					// what puts the groups back for a failure before it.
+					size_t at = ms.size();
+					while (at > 0 && !ms[at - 1].marks()) {
+						at--;
+					}
+					size_t to = at > 0 ? at - 1 : 0;
+					for (size_t i = at; i < ms.size(); i++) {
+						if (ms[i].captures()) {
+							ms[to++] = ms[i];
+						}
+					}
+					ms.resize(to);
+					RE_NEXT();
 				}
-#endif
 
-				case OP_DIGIT:
-					if (text.next(ch)) break;
-					if ((*code_ptr++ ? !traits_type::isdigit(ch) : traits_type::isdigit(ch))) {
-						continue;
-					}
-					break;
+				RE_CASE(OP_NOOP):
+					RE_NEXT();
 
-				case OP_SPACE:
-					if (text.next(ch)) break;
-					if ((*code_ptr++ ? !traits_type::isspace(ch) : traits_type::isspace(ch))) {
-						continue;
-					}
-					break;
+				RE_CASE(OP_BACKUP):
+					text.unget(ch);
+					RE_NEXT();
 
-				case OP_WORD:
+				RE_CASE(OP_FORWARD):
 					if (text.next(ch)) break;
-					if ((*code_ptr++ ? !traits_type::isalnum(ch) : traits_type::isalnum(ch))) {
-						continue;
-					}
-					break;
+					RE_NEXT();
 
 				default:
+#if RE_COMPUTED_GOTO
+				op_illegal:
+#endif
 					return -2; // should i throw something? because we've got illegal code.
 			} // end switch
 
 			// we should only get here when we break out of the above
 			// switch, that is, a break above imply a failure.
-			fail = true;
-			while (fail == true) {
-				if (ms.empty() == false) {
-					re_match_closure m = ms.top();
-					ms.pop();
+			bool resumed = false;
+			while (!ms.empty()) {
+				re_match_closure m = ms.back();
+				ms.pop_back();
 
 #if oldway
-					text.text(m.text);
-					if ( m.text == 0 || !m.closed() ) {
-						continue;
-					}
+				text.text(m.text);
+				if ( m.text == 0 || !m.closed() ) {
+					continue;
+				}
 #endif
-					if (m.text == 0) continue;
-					text.text(m.text);
-					if (!m.closed()) continue;
-					code_ptr = m.code;
-					fail = false;
-
-					// now cleanup the backreference stack.
-					if (!bs.empty()) {
-						// we have some backreferences
-						auto it = bs.begin();
-						int p = text.position();
-						while (it != bs.end()) {
-							while (!it->empty()) {
-								if ((it->back().first > p || it->back().second > p)) {
-									if (it->size() == 1) {
-										it->back().second = -1;
-										break;
-									}
-									it->pop_back();
-								} else {
-									break;
-								}
-							}
-							++it;
+				if (m.code < 0) {
+					if (m.captures()) {
+						captures[2 * m.slot] = m.text;
+						captures[2 * m.slot + 1] = m.matched;
+					} else if (m.restores()) {
+						counts[m.slot] = m.matched;
+					}
+					continue; // a mark()'s just gone past
+				}
+				const instruction_type &from = base[m.code];
+				if (m.running()) {
+					// one character less of an OP_REPEAT's run.
+					const int least = static_cast<int>(from.arg2);
+					const char_type *run = data + m.text;
+					int taken = m.matched - 1;
+					int_type follows;
+					if (!partial_matches && exec_run_follows(base + from.target, follows)) {
+						while (taken >= least && run[taken] != follows) {
+							taken--;
 						}
 					}
-					break;
+					if (taken < least) continue;
+					if (taken > least) {
+						m.matched = taken;
+						ms.push_back(m);
+					}
+					text.text(run + taken);
+					code_ptr = base + from.target;
+				} else {
+					if (m.text < 0) continue;
+					text.text(data + m.text);
+					code_ptr = base + m.code;
+					if (m.slot >= 0) {
+						// back to the OP_CLOSURE's exit or past the OP_CLOSURE_INC.
+						code_ptr = from.op == OP_CLOSURE ? base + from.target : code_ptr + 1;
+
+						// the count before this entry's increment, unless the closure is
+						// left here; then it's 0 until something backtracks into it.
+						if (!re_match_closure::closed(from.arg1, from.arg2, m.matched)) {
+							counts[m.slot] = std::max(m.matched - 1, 0);
+							continue;
+						}
+						if (m.matched > 0) {
+							ms.push_back(re_match_closure::restore(m.slot, m.matched - 1));
+						}
+						counts[m.slot] = 0;
+					}
 				}
-				continue_matching = false; // this is basically "return -1;"
+				resumed = true;
 				break;
-			} // while ( fail )
-		} // while ( continue_matching )
+			}
+			if (!resumed) {
+				break; // this is basically "return -1;"
+			}
+		}
+#undef RE_NEXT
+#undef RE_CASE
 
 		// if we get here then the match failed, we can now check for partial matches.
 		if (partial_matches && last_text) {
@@ -789,11 +1687,314 @@ namespace re {
 			return (text.match_end(last_text) - text.start());
 #endif
 			text.text(last_text);
-			return (text.position());
+			return (text.position() - text.start());
 		}
 		return -1; // match not found.
 	}
 
+#if RE_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+
+	// does the text match an OP_STRING's characters? code words wider than the
+	// characters, and caseless compares that weren't folded into the code (see
+	// exec_study), are compared one by one.
+	template<class syntaxType>
+	bool re_engine<syntaxType>::exec_string(const code_type *cp, const char_type *tp, const size_t n) const {
+		if constexpr (std::is_same<code_type, char_type>::value) {
+			if (!caseless_cmps && !lower_caseless_cmps) {
+				return traits_type::strncmp(cp, tp, n) == 0;
+			}
+		}
+		for (size_t i = 0; i < n; i++) {
+			const int_type c = static_cast<char_type>(cp[i]);
+			if (!code_vector_type::char_test(c, tp[i], caseless_cmps, lower_caseless_cmps)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+
+	// does a character pass a one character test? this is what the test's case in
+	// exec_backtrack does with the character; the characters, their ranges and
+	// the classes care about caseless compares.
+	template<class syntaxType>
+	bool re_engine<syntaxType>::exec_test(const instruction_type &in, const int_type ch) const {
+		switch (in.op) {
+			case OP_CHAR:
+				return code_vector_type::char_test(static_cast<char_type>(in.arg1), ch, caseless_cmps,
+				                                   lower_caseless_cmps);
+			case OP_NOT_CHAR:
+				return !code_vector_type::char_test(static_cast<char_type>(in.arg1), ch, caseless_cmps,
+				                                    lower_caseless_cmps);
+			case OP_RANGE_CHAR:
+				return code_vector_type::range_test(in.arg1, in.arg2, ch, caseless_cmps, lower_caseless_cmps);
+			case OP_NOT_RANGE_CHAR:
+				return !code_vector_type::range_test(in.arg1, in.arg2, ch, caseless_cmps, lower_caseless_cmps);
+			case OP_CLASS:
+			case OP_NOT_CLASS:
+			case OP_RANGE_CLASS:
+				return code_vector_type::class_test(linked->literals(in), ch, caseless_cmps, lower_caseless_cmps);
+			default:
+				return linked->accepts(in, ch);
+		}
+	}
+
+	// how many of the characters, from tp on, pass an OP_REPEAT's test. the usual
+	// runs, .* and [^,]* and a*, are a memchr or a compare loop the compiler can
+	// vectorize; the rest test each character.
+	template<class syntaxType>
+	size_t re_engine<syntaxType>::exec_run(const instruction_type &in, const char_type *tp, const size_t left) const {
+		const auto until = [tp, left](const int_type c) -> size_t {
+			if constexpr (sizeof(char_type) == 1) {
+				const void *p = std::memchr(tp, static_cast<unsigned char>(c), left);
+				return p ? static_cast<const char_type *>(p) - tp : left;
+			} else {
+				return std::find(tp, tp + left, static_cast<char_type>(c)) - tp;
+			}
+		};
+		const bool exact = !caseless_cmps && !lower_caseless_cmps;
+		size_t n = 0;
+		switch (in.op) {
+			case OP_ANY_CHAR:
+				return until('\n');
+			case OP_NOT_CHAR:
+				if (!exact) break;
+				return until(static_cast<char_type>(in.arg1));
+			case OP_NOT_BIN_CHAR:
+				if (in.arg1 != static_cast<char_type>(in.arg1)) break; // nothing's equal to it
+				return until(in.arg1);
+			case OP_CHAR:
+				if (!exact) break;
+				while (n < left && tp[n] == static_cast<char_type>(in.arg1)) {
+					n++;
+				}
+				return n;
+			case OP_CLASS:
+			case OP_NOT_CLASS:
+				if (!exact) break;
+				while (n < left && code_vector_type::class_member(linked->literals(in), tp[n])) {
+					n++;
+				}
+				return n;
+			default:
+				break;
+		}
+		while (n < left && exec_test(in, tp[n])) {
+			n++;
+		}
+		return n;
+	}
+
+	// the character the code after an OP_REPEAT has to start with, when it has to
+	// start with one (groups don't count, they don't take any characters).
+	template<class syntaxType>
+	bool re_engine<syntaxType>::exec_run_follows(const instruction_type *next, int_type &ch) const {
+		if (caseless_cmps || lower_caseless_cmps) {
+			return false;
+		}
+		while (next->op == OP_BACKREF_BEGIN || next->op == OP_BACKREF_END) {
+			next++;
+		}
+		switch (next->op) {
+			case OP_CHAR:
+				ch = static_cast<char_type>(next->arg1);
+				return true;
+			case OP_BIN_CHAR:
+				ch = next->arg1;
+				return ch == static_cast<char_type>(ch);
+			case OP_STRING:
+				ch = static_cast<char_type>(linked->literals(*next)[0]);
+				return next->arg2 > 0;
+			default:
+				return false;
+		}
+	}
+
+
+	/////////////////////////////////////////////////////////////////////////////
+	// run the reversed code backwards from the text cursor.
+	// the reversed code is only character tests, gotos and failure points, so
+	// rather than backtracking every path is followed at the same time, one
+	// character at a time; this never looks at a character twice.
+	//
+	// returns the smallest position where the reversed code gets to its OP_END,
+	// that's the furthest back a match could start, or -1 if there isn't one.
+	//
+
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_reverse(ctext_type &text, match_context &context) const {
+		typedef code_graph<traits_type> code_graph_type;
+		assert(text.backward());
+
+		const code_type *base = reverse_code.code();
+		std::vector<int> &seen = context.seen;
+		seen.assign(reverse_code.offset(), -1);
+		std::vector<int> &current = context.current, &next = context.next, &pending = context.pending;
+		current.clear();
+		int found = -1;
+
+		// follow the gotos and failure points from pc, and collect the character
+		// tests that are waiting for the next character.
+		auto add = [&](int pc, const int step, std::vector<int> &tests) {
+			pending.assign(1, pc);
+			while (!pending.empty()) {
+				pc = pending.back();
+				pending.pop_back();
+				if (seen[pc] == step) {
+					continue;
+				}
+				seen[pc] = step;
+				switch (base[pc]) {
+					case OP_END:
+						found = text.position();
+						break;
+					case OP_GOTO:
+						pending.push_back(code_graph_type::jump_target(base, pc));
+						break;
+					case OP_PUSH_FAILURE:
+						pending.push_back(code_graph_type::jump_target(base, pc));
+						pending.push_back(pc + code_graph_type::instruction_length(base + pc));
+						break;
+					default:
+						tests.push_back(pc);
+						break;
+				}
+			}
+		};
+
+		int step = 0;
+		add(0, step, current);
+		int_type ch = 0;
+		while (!current.empty() && text.next(ch) == 0) {
+			++step;
+			next.clear();
+			for (int pc: current) {
+				if (code_graph<traits_type>::char_test(base + pc, ch) > 0) {
+					add((base[pc] == OP_PUSH_FAILURE2)
+					    ? code_graph_type::jump_target(base, pc) + 1
+					    : pc + code_graph_type::instruction_length(base + pc), step, next);
+				}
+			}
+			current.swap(next);
+		}
+		return found;
+	}
+
+
+	/////////////////////////////////////////////////////////////////////////////
+	// run the lazy dfa from the text cursor.
+	// returns where the match ends (the first match to end when unanchored), or
+	// re_dfa::NO_MATCH, or re_dfa::GAVE_UP when exec_match has to do it: the code
+	// has something the dfa can't do, the comparisons are caseless, or another
+	// thread is using the dfa right now.
+	//
+
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_dfa(ctext_type &text, bool unanchored) const {
+		if (!dfa || caseless_cmps || lower_caseless_cmps || text.backward()) {
+			return re_dfa<traits_type>::GAVE_UP;
+		}
+		std::unique_lock<std::mutex> hold(dfa->lock, std::try_to_lock);
+		if (!hold.owns_lock()) {
+			return re_dfa<traits_type>::GAVE_UP;
+		}
+		re_dfa<traits_type> &d = unanchored ? dfa->unanchored : dfa->anchored;
+		return d.exec(text.data(), text.position(), text.length());
+	}
+
+
+	/////////////////////////////////////////////////////////////////////////////
+	// run the pike vm from the text cursor, trying starts up to last. fills in
+	// the matches the same way exec_match does and leaves the cursor at the end
+	// of the match.
+	// returns where the match starts, or re_pike::NO_MATCH, or re_pike::GAVE_UP
+	// when exec_match has to do it.
+	//
+
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_pike(ctext_type &text, const int last, match_context &context,
+	                                     re_match_vector &matches) const {
+		if (!program || lower_caseless_cmps || text.backward()) {
+			return re_pike<traits_type>::GAVE_UP;
+		}
+		if (&matches != &default_matches) {
+			matches.clear();
+		}
+		std::vector<int> &slots = context.slots;
+		const re_pike<traits_type> vm(*program);
+		const int found = vm.exec(text.data(), text.position(), last, text.length(), caseless_cmps,
+		                          context.pike, slots);
+		if (found >= 0) {
+			exec_slots(text, found, slots, matches);
+		}
+		return found;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// the same with re_bitstate, which gives up unless the text is short.
+	//
+
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_bitstate(ctext_type &text, const int last, match_context &context,
+	                                         re_match_vector &matches) const {
+		if (!program || lower_caseless_cmps || text.backward()) {
+			return re_bitstate<traits_type>::GAVE_UP;
+		}
+		if (&matches != &default_matches) {
+			matches.clear();
+		}
+		std::vector<int> &slots = context.slots;
+		const re_bitstate<traits_type> vm(*program);
+		const int found = vm.exec(text.data(), text.position(), last, text.length(), caseless_cmps,
+		                          context.bitstate, slots);
+		if (found >= 0) {
+			exec_slots(text, found, slots, matches);
+		}
+		return found;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// and with re_onepass, which gives up unless the code is one-pass.
+	//
+
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_onepass(ctext_type &text, match_context &context,
+	                                        re_match_vector &matches) const {
+		if (!onepass || caseless_cmps || lower_caseless_cmps || text.backward()) {
+			return re_onepass<traits_type>::GAVE_UP;
+		}
+		if (&matches != &default_matches) {
+			matches.clear();
+		}
+		std::vector<int> &slots = context.slots;
+		const int found = onepass->exec(text.data(), text.position(), text.length(), context.kept, slots);
+		if (found >= 0) {
+			exec_slots(text, found, slots, matches);
+		}
+		return found;
+	}
+
+	// the matches from the slots, and the cursor to the end of the match.
+	template<class syntaxType>
+	void re_engine<syntaxType>::exec_slots(ctext_type &text, const int found, const std::vector<int> &slots,
+	                                       re_match_vector &matches) const {
+		if (&matches != &default_matches) {
+			matches.push_back(re_match_type(found, slots[1] - found));
+			for (int i = 1; i <= using_backrefs; i++) {
+				const int b = slots[2 * i], e = slots[2 * i + 1];
+				if (b >= 0 && e - b > 0) {
+					matches.emplace_back(b, e - b);
+				} else {
+					matches.emplace_back(0, 0);
+				}
+			}
+		}
+		text.text(text.data() + slots[1]);
+	}
+
 
 	/////////////////////////////////////////////////////////////////////////////
 	// searching method
@@ -810,6 +2011,16 @@ namespace re {
 	//	if you pass -1 for pos_stop i'll set to len1 + len2.
 	//  if you pass non-default matches, i'll pass them on to exec_match
 	//
+	// when the study map is valid we only call exec_match at positions whose
+	// character could start a match. a literal prefix, suffix or inner literal is
+	// found first, and only the positions that could go with it are tried. an
+	// anchored expression is only tried at the start of the buffer or of a line.
+	// otherwise, if nobody wants the match vector, the dfa finds where the first
+	// match ends (or that there isn't one) and nothing after that is tried.
+	// short expressions are run as a bit-parallel automaton first, to find where
+	// the first match ends. with linear_matching the pike vm does the whole
+	// search in one pass, and short text is searched by re_bitstate.
+	//
 	// returns:
 	//  >=0 to indicate the starting character position for a successful search
 	//   -1 to indicate an unsuccessful search
@@ -818,7 +2029,12 @@ namespace re {
 	//
 
 	template<class syntaxType>
-	int re_engine<syntaxType>::exec_search(ctext_type &text,
+	int re_engine<syntaxType>::exec_search(ctext_type &text, int range, re_match_vector &matches) const {
+		return exec_search(text, thread_context(), range, matches);
+	}
+
+	template<class syntaxType>
+	int re_engine<syntaxType>::exec_search(ctext_type &text, match_context &context,
 	                                       int range, re_match_vector &matches) const {
 		if (syntax_error_state) {
 			return -3;
@@ -831,53 +2047,265 @@ namespace re {
 		if (range == 0) {
 			range = text.length();
 		}
-#if notdone
-		int dir = (range < 0) ? -1 : 1;
-#endif
+		const int dir = (range < 0) ? -1 : 1;
 		if (range < 0) {
 			range = -range;
 		}
 
-		// after cleaning up the parameters, check that we haven't violated any assumptions that follow.
-		// assert(pos + range >= 0 && pos + range <= len1 + (len2 == -1 ? 0 : len2));
+		const int end = text.length();
+		const char_type *buffer = text.data();
+
+		if (linear_matching && dir > 0) {
+			// one pass over the text trying every start at the same time.
+			const int from = text.start();
+			text.start(from);
+			const int found = exec_pike(text, std::min(end, from + range), context, matches);
+			if (found >= 0) {
+				const int stop = text.position();
+				text.start(found);
+				text.text(buffer + stop);
+				return found;
+			}
+			if (found == re_pike<traits_type>::NO_MATCH) {
+				return -1;
+			}
+		}
+
+		if (anchor != ANCHOR_NONE && dir > 0) {
+			// a match can only start at the beginning of the buffer, or right after
+			// a newline; memchr from one line to the next.
+			const int last = std::min(end, text.start() + range);
+			for (int pos = text.start(); pos <= last;) {
+				if (pos == 0 || (anchor == ANCHOR_LINE && buffer[pos - 1] == '\n')) {
+					if (!study_map_valid || (pos < end && study_map_test(buffer[pos]))) {
+						text.start(pos);
+						const int ret = exec_match(text, context, false, matches);
+						if (ret >= 0) {
+							return pos;
+						}
+						if (ret < -1) {
+							return ret;
+						}
+					}
+				}
+				if (anchor == ANCHOR_BUFFER || pos >= end) {
+					break;
+				}
+				const char_type *nl = traits_type::find_char(buffer + pos, end - pos, '\n');
+				if (nl == nullptr) {
+					break;
+				}
+				pos = (nl - buffer) + 1;
+			}
+			return -1;
+		}
 
-		const typename code_vector_type::code_type *code_ptr = code.code();
+		if (!prefix.empty() && dir > 0 && !caseless_cmps && !lower_caseless_cmps) {
+			const int n = prefix.size();
+			const int first = text.start();
+			const int last = std::min(end - n, first + range); // last possible start
 
-#if notdone
-		for (int pos = text.start(); range >= 0; range--, pos += dir) {
-			text.start(pos);
-			//const char_type* partstart = 0;
-
-			if (lower_caseless_cmps == false && caseless_cmps == false && *code_ptr == OP_STRING) {
-				//size_t n_chars = *(code_ptr + 1);
-				int n = traits_type::has_chars(text, (code_ptr + 2));
-				if (n > 0) {
-					// n--;
-					pos += (dir * n);
-					range -= n;
-					text.start(pos);
-				} else if (n < 0) {
+			if (prefix_only) {
+				// just a string, no need for exec_match.
+				if (last < first) {
 					return -1;
 				}
+				const char_type *hit = traits_type::find_literal(buffer + first, last + n - first,
+				                                                 prefix.data(), n);
+				if (hit == nullptr) {
+					return -1;
+				}
+				const int pos = hit - buffer;
+				if (&matches != &default_matches) {
+					matches.assign(1, re_match_type(pos, n));
+				}
+				text.start(pos);
+				text.advance(n);
+				return pos;
+			}
+
+			// memchr for the rarest character of the prefix, check the rest of the
+			// prefix in place, and only then run the whole expression.
+			const char_type rare = prefix[prefix_rare];
+			for (int pos = first; pos <= last; pos++) {
+				const char_type *hit = traits_type::find_char(buffer + pos + prefix_rare,
+				                                              last - pos + 1, rare);
+				if (hit == nullptr) {
+					break;
+				}
+				pos = (hit - buffer) - prefix_rare;
+				if (traits_type::strncmp(buffer + pos, prefix.data(), n) != 0) {
+					continue;
+				}
+				text.start(pos);
+				const int ret = exec_match(text, context, false, matches);
+				if (ret >= 0) {
+					return pos;
+				}
+				if (ret < -1) {
+					return ret;
+				}
 			}
+			return -1;
+		}
 
-			// assume that we've either found something in a study_map or (we don't have a study_map) we
-			// just rely on match to do the work at every character position. this is terribly slow
-			// without a study_map. if ret == -1 then keep searching the strings.
-			int ret = exec_match(text, 0, matches);
+		if (glushkov && dir > 0 && !caseless_cmps && !lower_caseless_cmps) {
+			// find where the first match ends; the leftmost match can't start after
+			// that, nor further back than the longest match.
+			const int first = glushkov->exec(buffer, text.start(), end);
+			if (first == re_glushkov<traits_type>::NO_MATCH) {
+				return -1;
+			}
+			const int last = std::min(text.start() + range, first);
+			int from = text.start();
+			if (glushkov->longest() != re_glushkov<traits_type>::UNBOUNDED) {
+				from = std::max(from, first - glushkov->longest());
+			}
+			if (from > last) {
+				return -1;
+			}
+			text.start(from);
+			range = last - from;
+		}
 
-			if (ret >= 0) {
-				if (&matches != &default_matches) {
-					matches[0].first = pos;
+		if (!suffix.empty() && dir > 0 && !caseless_cmps && !lower_caseless_cmps) {
+			// every match ends with the literal; find it and run the reversed code
+			// back from it to where the match starts. a match ending at a later
+			// copy of the literal has to start after this copy (see
+			// exec_study_suffix), so that's as far back as the next one goes.
+			const int n = suffix.size();
+			const int last = std::min(end, text.start() + range);
+			int floor = text.start();
+			for (int from = floor + suffix_min; from + n <= end;) {
+				const char_type *hit = traits_type::find_literal(buffer + from, end - from, suffix.data(), n);
+				if (hit == nullptr) {
+					break;
+				}
+				const int at = hit - buffer;
+				text.start(at);
+				text.backward(true, floor);
+				const int s = exec_reverse(text, context);
+				text.backward(false);
+				if (s > last) {
+					break;
+				}
+				if (s >= 0) {
+					text.start(s);
+					const int ret = exec_match(text, context, false, matches);
+					if (ret >= 0) {
+						return s;
+					}
+					if (ret < -1) {
+						return ret;
+					}
+				}
+				floor = at + 1;
+				from = floor + suffix_min;
+			}
+			return -1;
+		}
+
+		if (!inner.empty() && dir > 0 && !caseless_cmps && !lower_caseless_cmps) {
+			// every match starting at or after pos contains the literal somewhere in
+			// [pos + inner_min, pos + inner_max], so find the next one and only try
+			// the start positions that could reach it.
+			const int n = inner.size();
+			const int last = std::min(end, text.start() + range);
+			for (int pos = text.start(); pos <= last;) {
+				const int from = pos + inner_min;
+				if (from + n > end) {
+					break;
+				}
+				const char_type *hit = traits_type::find_literal(buffer + from, end - from, inner.data(), n);
+				if (hit == nullptr) {
+					break;
+				}
+				const int at = hit - buffer;
+				int first = pos;
+				if (inner_max != code_graph<traits_type>::UNBOUNDED) {
+					first = std::max(pos, at - inner_max);
+				}
+				const int stop = std::min(at - inner_min, last);
+				for (int s = first; s <= stop; s++) {
+					if (study_map_valid && !study_map_test(buffer[s])) {
+						continue;
+					}
+					text.start(s);
+					const int ret = exec_match(text, context, false, matches);
+					if (ret >= 0) {
+						return s;
+					}
+					if (ret < -1) {
+						return ret;
+					}
+				}
+				pos = stop + 1;
+			}
+			return -1;
+		}
+
+		if (dir > 0 && &matches == &default_matches) {
+			// the leftmost match can't start after the first one ends.
+			text.start(text.start());
+			const int first = exec_dfa(text, true);
+			if (first == re_dfa<traits_type>::NO_MATCH) {
+				return -1;
+			}
+			if (first >= 0) {
+				range = std::min(range, first - text.start());
+			}
+		}
+
+		if (dir > 0) {
+			// short text; backtrack from every start in one go, nothing that failed
+			// from one start is tried again from the next.
+			const int from = text.start();
+			text.start(from);
+			const int found = exec_bitstate(text, std::min(end, from + range), context, matches);
+			if (found >= 0) {
+				const int stop = text.position();
+				text.start(found);
+				text.text(buffer + stop);
+				return found;
+			}
+			if (found == re_bitstate<traits_type>::NO_MATCH) {
+				return -1;
+			}
+		}
+
+		for (int pos = text.start(); range >= 0 && pos >= 0 && pos <= end; range--, pos += dir) {
+			if (anchor != ANCHOR_NONE && pos != 0
+			    && (anchor == ANCHOR_BUFFER || buffer[pos - 1] != '\n')) {
+				continue;
+			}
+			if (study_map_valid) {
+				// every match has to start with a character in the study map, skip
+				// straight to the next one instead of trying exec_match everywhere.
+				if (dir > 0) {
+					const int last = std::min(end - 1, pos + range);
+					int skip = pos;
+					while (skip <= last && !study_map_test(buffer[skip])) {
+						++skip;
+					}
+					if (skip > last) {
+						break;
+					}
+					range -= skip - pos;
+					pos = skip;
+				} else if (pos == end || !study_map_test(buffer[pos])) {
+					continue;
 				}
+			}
 
+			text.start(pos);
+			const int ret = exec_match(text, context, false, matches);
+			if (ret >= 0) {
 				return pos;
 			}
 			if (ret < -1) {
 				return ret;
 			}
 		}
-#endif // notdone
 		return -1;
 	}
 
@@ -890,7 +2318,7 @@ namespace re {
 
 	template<class syntaxType>
 	void re_engine<syntaxType>::dump_code(std::ostream& out) const {
-		const char_type *cp = code.code();
+		const code_type *cp = code.code();
 		int pos = 0;
 		while ((pos = cp - code.code()) < code.offset()) {
 			out << '\t' << pos << '\t';
@@ -941,6 +2369,14 @@ namespace re {
 					out << "OP_CHAR (" << static_cast<char>(*cp++) << ")\n";
 					break;
 
+				case OP_STRING: {
+					const int n = *cp++;
+					out << "OP_STRING (" << n << ", ";
+					out << std::basic_string<char_type>(cp, n) << ")\n";
+					cp += n;
+					break;
+				}
+
 				case OP_NOT_CHAR:
 					out << "OP_NOT_CHAR (" << static_cast<char>(*cp++) << ")\n";
 					break;
@@ -949,6 +2385,13 @@ namespace re {
 					out << "ANY_CHAR" << std::endl;
 					break;
 
+				case OP_CLASS:
+				case OP_NOT_CLASS:
+				case OP_RANGE_CLASS:
+					out << opcode_to_string(cp[-1]) << " (" << code_vector_type::class_string(cp - 1) << ")\n";
+					cp += code_vector_type::class_length(cp - 1) - 1;
+					break;
+
 				case OP_RANGE_CHAR:
 					out << "OP_RANGE_CHAR (" << static_cast<char>(*cp++);
 					out << ',' << static_cast<char>(*cp++) << ")\n";
@@ -960,15 +2403,15 @@ namespace re {
 					break;
 
 				case OP_BACKREF_BEGIN:
-					out << "OP_BACKREF_BEGIN (" << static_cast<int>(*cp++) << ")\n";
+					out << "OP_BACKREF_BEGIN (" << code_operands<code_type>::unit(*cp++) << ")\n";
 					break;
 
 				case OP_BACKREF_END:
-					out << "OP_BACKREF_END (" << static_cast<int>(*cp++) << ")\n";
+					out << "OP_BACKREF_END (" << code_operands<code_type>::unit(*cp++) << ")\n";
 					break;
 
 				case OP_BACKREF:
-					out << "OP_BACKREF (" << static_cast<int>(*cp++) << ")\n";
+					out << "OP_BACKREF (" << code_operands<code_type>::unit(*cp++) << ")\n";
 					break;
 
 				case OP_BACKREF_FAIL:
@@ -977,14 +2420,16 @@ namespace re {
 
 				case OP_CLOSURE:
 					out << "OP_CLOSURE (" << decode_address_and_advance(cp) << ") ";
-					out << "{" << decode_address_and_advance(cp) << ",";
-					out << decode_address_and_advance(cp) << "}" << std::endl;
+					out << "{" << decode_number_and_advance(cp) << ",";
+					out << decode_number_and_advance(cp) << "}";
+					out << " [" << decode_number_and_advance(cp) << "]" << std::endl;
 					break;
 
 				case OP_CLOSURE_INC:
 					out << "OP_CLOSURE_INC (" << decode_address_and_advance(cp) << ")";
-					out << " {" << decode_address_and_advance(cp) << ",";
-					out << decode_address_and_advance(cp) << "}" << std::endl;
+					out << " {" << decode_number_and_advance(cp) << ",";
+					out << decode_number_and_advance(cp) << "}";
+					out << " [" << decode_number_and_advance(cp) << "]" << std::endl;
 					break;
 
 				case OP_TEST_CLOSURE:
@@ -1027,6 +2472,14 @@ namespace re {
 					out << "OP_NOOP" << std::endl;
 					break;
 
+				case OP_ATOMIC_BEGIN:
+					out << "OP_ATOMIC_BEGIN" << std::endl;
+					break;
+
+				case OP_ATOMIC_END:
+					out << "OP_ATOMIC_END" << std::endl;
+					break;
+
 				default:
 					out << "BAD CASE" << std::endl;
 					break;
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <functional>
+#include <cstdint>
+#include "program.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// re_glushkov is the position (glushkov) automaton of a re_program packed into
+	// the bits of a word. a position is an instruction that consumes a character,
+	// along with the closure counts it is reached with (so [A-Z]{3} is three
+	// positions); the states are the sets of positions, and a character moves a
+	// state on with a few table lookups and ands (shift-and generalised with the
+	// follow tables from navarro & raffinot):
+	//
+	//	state = (follow(state) | first) & mask[ch]
+	//
+	// it only says where the first match ends, for exec_search to narrow down
+	// where the leftmost match can start. code that needs more than 64 positions,
+	// or has anchors or word tests, isn't valid() for this; nor is anything but
+	// single byte characters.
+
+	template<class traitsT>
+	class re_glushkov {
+	public:
+		typedef traitsT traits_type;
+		typedef typename traits_type::char_type char_type;
+		typedef re_program<traitsT> program_type;
+		typedef uint64_t mask_type;
+
+		enum { NO_MATCH = -1, POSITIONS = 64, UNBOUNDED = -1 };
+
+		explicit re_glushkov(const program_type &program);
+
+		bool valid() const { return _valid; }
+
+		int positions() const { return _positions; }
+
+		// the most characters a match can have, or UNBOUNDED when there's a loop.
+		int longest() const { return _longest; }
+
+		// where the first match to end (starting at or after pos) ends, or NO_MATCH.
+		int exec(const char_type *buffer, int pos, int end) const;
+
+	private:
+		typedef typename program_type::node node;
+		typedef typename program_type::frame frame;
+
+		// the positions the program gets to from pc without consuming anything,
+		// and if it gets to OP_END.
+		bool closure(const program_type &program, int pc, std::vector<int> &regs, mask_type &set, bool &match);
+
+		mask_type follow(mask_type state) const {
+			mask_type next = 0;
+			for (int k = 0; state != 0; k++, state >>= 8) {
+				next |= _follow[k][state & 255];
+			}
+			return next;
+		}
+
+		std::map<int, int> _position; // key to bit
+		std::vector<std::vector<int> > _regs; // the registers each position is reached with
+		mask_type _mask[256];
+		std::vector<std::vector<mask_type> > _follow; // by byte of the state, then its value
+		mask_type _first;
+		mask_type _final;
+		bool _empty;
+		int _positions;
+		int _longest;
+		bool _valid;
+	};
+
+	template<class traitsT>
+	re_glushkov<traitsT>::re_glushkov(const program_type &program)
+		: _mask(), _first(0), _final(0), _empty(false), _positions(0),
+		  _longest(UNBOUNDED), _valid(false) {
+		if (sizeof(char_type) != 1 || !program.valid()) {
+			return;
+		}
+
+		std::vector<int> regs(program.registers(), 0);
+		if (!closure(program, 0, regs, _first, _empty)) {
+			return;
+		}
+
+		// new positions get found while following the earlier ones.
+		std::vector<mask_type> follows;
+		for (int p = 0; p < _positions; p++) {
+			regs.assign(_regs[p].begin(), _regs[p].end() - 1);
+			mask_type set = 0;
+			bool match = false;
+			const node &nd = program[_regs[p].back()];
+			if (!closure(program, nd.next, regs, set, match)) {
+				return;
+			}
+			follows.push_back(set);
+			if (match) {
+				_final |= mask_type(1) << p;
+			}
+		}
+
+		for (int p = 0; p < _positions; p++) {
+			const node &nd = program[_regs[p].back()];
+			for (int c = 0; c < 256; c++) {
+				if (program.test(nd, static_cast<char_type>(c), false)) {
+					_mask[c] |= mask_type(1) << p;
+				}
+			}
+		}
+
+		_follow.assign((_positions + 7) / 8, std::vector<mask_type>(256, 0));
+		for (size_t k = 0; k < _follow.size(); k++) {
+			for (int v = 1; v < 256; v++) {
+				for (int b = 0; b < 8; b++) {
+					const int p = 8 * k + b;
+					if ((v & (1 << b)) && p < _positions) {
+						_follow[k][v] |= follows[p];
+					}
+				}
+			}
+		}
+
+		// the longest way through the positions, unless they loop.
+		std::vector<int> longest(_positions, 0), state(_positions, 0);
+		bool loops = false;
+		std::function<int(int)> walk = [&](const int p) -> int {
+			if (state[p] == 2) {
+				return longest[p];
+			}
+			if (state[p] == 1) {
+				loops = true;
+				return 0;
+			}
+			state[p] = 1;
+			int most = 0;
+			for (int q = 0; q < _positions; q++) {
+				if (follows[p] & (mask_type(1) << q)) {
+					most = std::max(most, walk(q));
+				}
+			}
+			state[p] = 2;
+			return longest[p] = most + 1;
+		};
+		int most = 0;
+		for (int p = 0; p < _positions && !loops; p++) {
+			if (_first & (mask_type(1) << p)) {
+				most = std::max(most, walk(p));
+			}
+		}
+		_longest = loops ? UNBOUNDED : most;
+		_valid = true;
+	}
+
+	template<class traitsT>
+	bool re_glushkov<traitsT>::closure(const program_type &program, const int pc, std::vector<int> &regs,
+	                                   mask_type &set, bool &match) {
+		std::vector<frame> stack(1, frame{pc, 0, 0, 0});
+		std::vector<int> seen;
+		while (!stack.empty()) {
+			const frame f = stack.back();
+			stack.pop_back();
+			if (f.pc < 0) {
+				regs[f.reg] = f.value;
+				continue;
+			}
+			for (int at = f.pc; at >= 0;) {
+				const int k = program.key(at, regs.data());
+				if (std::find(seen.begin(), seen.end(), k) != seen.end()) {
+					break;
+				}
+				seen.push_back(k);
+
+				const node &nd = program[at];
+				switch (nd.what) {
+					case program_type::TEST:
+					case program_type::CHAR: {
+						auto it = _position.find(k);
+						if (it == _position.end()) {
+							if (_positions == POSITIONS) {
+								return false;
+							}
+							it = _position.emplace(k, _positions++).first;
+							_regs.push_back(regs);
+							_regs.back().push_back(at); // and where it is
+						}
+						set |= mask_type(1) << it->second;
+						at = -1;
+						break;
+					}
+
+					case program_type::MATCH:
+						match = true;
+						at = -1;
+						break;
+
+					case program_type::LINE_BEGIN:
+					case program_type::BUFFER_BEGIN:
+					case program_type::END_OF_TEXT:
+					case program_type::WORD_BEGIN:
+						return false;
+
+					default:
+						at = program.step(at, regs.data(), nullptr, 0, 0, stack);
+						break;
+				}
+			}
+		}
+		return true;
+	}
+
+	template<class traitsT>
+	int re_glushkov<traitsT>::exec(const char_type *buffer, const int pos, const int end) const {
+		if (_empty) {
+			return pos;
+		}
+		mask_type state = 0;
+		for (int at = pos; at < end; at++) {
+			state = (follow(state) | _first) & _mask[static_cast<unsigned char>(buffer[at])];
+			if (state & _final) {
+				return at + 1;
+			}
+		}
+		return NO_MATCH;
+	}
+}
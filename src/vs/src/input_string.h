@@ -156,13 +156,17 @@ namespace re {
 	template<class traitsType>
 	int input_string<traitsType>::get_hexadecimal_digit(int_type &h) {
 		int_type c;
-		get(c);
+		if (get(c)) {
+			return -1;
+		}
 		const int value1 = traits_type::hexadecimal_to_decimal(c);
 		if (value1 == -1) {
 			return -1;
 		}
 
-		get(c);
+		if (get(c)) {
+			return -1;
+		}
 		const int value2 = traits_type::hexadecimal_to_decimal(c);
 		if (value2 == -1) {
 			return -1;
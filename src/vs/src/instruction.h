@@ -1,7 +1,10 @@
 #pragma once
 
+#include <vector>
 #include "traits.h"
 #include "tokens.h"
+#include "code.h"
+#include "code_graph.h"
 
 namespace re {
     template<class traitsT>
@@ -9,11 +12,14 @@ namespace re {
         typedef traitsT traits_type;
         typedef typename traits_type::char_type char_type;
         typedef typename traits_type::int_type int_type;
-        typedef typename traits_type::char_type code_type;
+        typedef typename code_word<traits_type>::type code_type;
 
         opcodes op; // Opcode (e.g., OP_CHAR, OP_RANGE_CHAR, etc.)
         int_type arg1; // First argument (e.g., character, range start, jump target, etc.)
         int_type arg2; // Second argument (e.g., range end, repetition max, etc.)
+        int target = -1; // index of the instruction a jump/failure point goes to
+        int slot = -1; // closure count slot
+        bool empty_loop = false; // a way back round a loop that can take nothing
 
         explicit instruction(const opcodes opcode)
             : instruction(opcode, 0, 0) {
@@ -27,4 +33,396 @@ namespace re {
             : op(opcode), arg1(argument1), arg2(argument2) {
         }
     };
-}
\ No newline at end of file
+
+    /////////////////////////////////////////////////////////////////////////////////
+    // linked_code is the compiled code "linked": one instruction for each op, with
+    // the operands already decoded and the jumps turned into instruction indexes,
+    // so the backtracker doesn't take displacements apart on every goto and
+    // failure point. the operands are:
+    //
+    //	characters, ranges, groups, OP_DIGIT etc.	arg1 (and arg2) as in the code
+    //	OP_STRING	arg1 is where the characters are in literals(), arg2 how many
+    //	OP_CLASS, OP_NOT_CLASS, OP_RANGE_CLASS	the same, with the whole instruction
+    //		(see compiled_code_vector::class_member)
+    //	jumps and failure points	target
+    //	OP_FAKE_FAILURE_GOTO	target, and arg1 is the target of the
+    //		OP_PUSH_FAILURE that follows it
+    //	OP_CLOSURE, OP_CLOSURE_INC	target, arg1 minimum, arg2 maximum, slot
+    //	OP_REPEAT	target, arg1 is the index of the character test, arg2
+    //		the minimum, slot is 1 if it's possessive (see fuse_repeats)
+    //
+    // the OP_GOTO at the end of an x* or x+, the OP_PUSH_FAILURE at the end of
+    // an x*? or x+?, and an OP_CLOSURE_INC are empty_loop when x can match
+    // nothing; the backtracker has to see that a time round took something.
+    //
+    // code with a jump into the middle of an instruction isn't valid().
+
+    template<class traitsT>
+    class linked_code {
+    public:
+        typedef traitsT traits_type;
+        typedef compiled_code_vector<traits_type> code_vector_type;
+        typedef typename code_vector_type::code_type code_type;
+        typedef typename code_vector_type::operands_type operands_type;
+        typedef instruction<traits_type> instruction_type;
+        typedef typename instruction_type::int_type int_type;
+        typedef typename instruction_type::char_type char_type;
+
+        explicit linked_code(const code_vector_type &code);
+
+        bool valid() const { return _valid; }
+
+        int size() const { return static_cast<int>(_code.size()); }
+
+        const instruction_type *code() const { return _code.data(); }
+
+        const instruction_type &operator[](const int i) const { return _code[i]; }
+
+        // the characters of an OP_STRING, or the code of a class.
+        const code_type *literals(const instruction_type &in) const { return _literals.data() + in.arg1; }
+
+        // turns the greedy loops of one character test, x* and x+, into OP_REPEATs;
+        // returns how many there were. only the backtracker knows OP_REPEAT, so
+        // the code given to the optimizer isn't fused.
+        int fuse_repeats();
+
+        // does a one character test accept ch? (as exec_backtrack does it, without
+        // caseless compares.)
+        bool accepts(const instruction_type &in, int_type ch) const;
+
+        // the instruction at an offset in the compiled code, -1 if there isn't one.
+        int index(const int offset) const {
+            return (offset >= 0 && offset < static_cast<int>(_index.size())) ? _index[offset] : -1;
+        }
+
+    private:
+        // a jump target, as an offset; the displacement is from the end of the
+        // instruction. one outside the code is the length, which isn't the
+        // offset of any instruction.
+        static int decode_address(const code_type *&cp, const int end, const int length) {
+            const int at = end + operands_type::address(cp);
+            return (at >= 0 && at < length) ? at : length;
+        }
+
+        bool possessive(const instruction_type &repeat) const;
+
+        void mark_empty_loops();
+
+        bool reaches_empty(int from, int to) const;
+
+        static bool tests_one_character(const opcodes op) {
+            switch (op) {
+                case OP_CHAR:
+                case OP_NOT_CHAR:
+                case OP_BIN_CHAR:
+                case OP_NOT_BIN_CHAR:
+                case OP_ANY_CHAR:
+                case OP_RANGE_CHAR:
+                case OP_NOT_RANGE_CHAR:
+                case OP_CLASS:
+                case OP_NOT_CLASS:
+                case OP_RANGE_CLASS:
+                case OP_DIGIT:
+                case OP_SPACE:
+                case OP_WORD:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        std::vector<instruction_type> _code;
+        std::vector<code_type> _literals;
+        std::vector<int> _index; // offset to instruction
+        bool _valid;
+    };
+
+    template<class traitsT>
+    linked_code<traitsT>::linked_code(const code_vector_type &code) : _valid(false) {
+        const code_type *base = code.code();
+        const int length = code.offset();
+        _index.assign(length + 1, -1);
+
+        // decode everything, the targets are offsets until they're all known.
+        for (int pc = 0; pc < length;) {
+            const code_type *cp = base + pc;
+            const int next = pc + code_graph<traits_type>::instruction_length(cp);
+            if (next <= pc || next > length) {
+                return;
+            }
+            instruction_type in(static_cast<opcodes>(*cp++));
+            switch (in.op) {
+                case OP_STRING:
+                    in.arg1 = static_cast<int_type>(_literals.size());
+                    in.arg2 = static_cast<int_type>(next - pc - 2);
+                    _literals.insert(_literals.end(), cp + 1, base + next);
+                    break;
+
+                case OP_CLASS:
+                case OP_NOT_CLASS:
+                case OP_RANGE_CLASS:
+                    in.arg1 = static_cast<int_type>(_literals.size());
+                    in.arg2 = static_cast<int_type>(next - pc);
+                    _literals.insert(_literals.end(), base + pc, base + next);
+                    break;
+
+                case OP_RANGE_CHAR:
+                case OP_NOT_RANGE_CHAR:
+                    in.arg1 = cp[0];
+                    in.arg2 = cp[1];
+                    break;
+
+                case OP_BACKREF_BEGIN:
+                case OP_BACKREF_END:
+                case OP_BACKREF:
+                    in.arg1 = operands_type::unit(cp[0]);
+                    break;
+
+                case OP_GOTO:
+                case OP_PUSH_FAILURE:
+                case OP_PUSH_FAILURE2:
+                case OP_POP_FAILURE_GOTO:
+                    in.target = decode_address(cp, next, length);
+                    break;
+
+                case OP_FAKE_FAILURE_GOTO: {
+                    in.target = decode_address(cp, next, length);
+                    if (next >= length || base[next] != OP_PUSH_FAILURE) {
+                        return;
+                    }
+                    const code_type *fp = base + next + 1;
+                    in.arg1 = decode_address(fp, next + 3, length);
+                    break;
+                }
+
+                case OP_CLOSURE:
+                case OP_CLOSURE_INC:
+                    in.target = decode_address(cp, next, length);
+                    in.arg1 = operands_type::number(cp);
+                    in.arg2 = operands_type::number(cp);
+                    in.slot = operands_type::number(cp);
+                    break;
+
+                default:
+                    if (next - pc == 2) {
+                        in.arg1 = cp[0];
+                    }
+                    break;
+            }
+            _index[pc] = static_cast<int>(_code.size());
+            _code.push_back(in);
+            pc = next;
+        }
+        if (_code.empty() || _code.back().op != OP_END) {
+            return;
+        }
+
+        for (instruction_type &in: _code) {
+            if (in.target >= 0 && (in.target = index(in.target)) < 0) {
+                return;
+            }
+            if (in.op == OP_FAKE_FAILURE_GOTO && (in.arg1 = index(in.arg1)) < 0) {
+                return;
+            }
+        }
+        _valid = true;
+        mark_empty_loops();
+    }
+
+    // a loop goes back to the OP_PUSH_FAILURE that leaves it, and its body
+    // starts after that; a closure's OP_CLOSURE_INC goes back to its body.
+    template<class traitsT>
+    void linked_code<traitsT>::mark_empty_loops() {
+        for (int i = 0; i < size(); i++) {
+            instruction_type &in = _code[i];
+            switch (in.op) {
+                case OP_GOTO:
+                case OP_PUSH_FAILURE:
+                    in.empty_loop = in.target < i && _code[in.target].op == OP_PUSH_FAILURE
+                                    && reaches_empty(in.target + 1, i);
+                    break;
+
+                case OP_CLOSURE_INC:
+                    in.empty_loop = reaches_empty(in.target, i);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    // can from get to to without taking a character? anything that might not
+    // take one (a backref, x{0,n}) is taken to not.
+    template<class traitsT>
+    bool linked_code<traitsT>::reaches_empty(const int from, const int to) const {
+        std::vector<bool> seen(size(), false);
+        std::vector<int> pending(1, from);
+        while (!pending.empty()) {
+            const int at = pending.back();
+            pending.pop_back();
+            if (at == to) {
+                return true;
+            }
+            if (at < 0 || at >= size() || seen[at]) {
+                continue;
+            }
+            seen[at] = true;
+            const instruction_type &in = _code[at];
+            switch (in.op) {
+                case OP_END:
+                case OP_FORWARD:
+                    break;
+
+                case OP_STRING:
+                    if (in.arg2 == 0) {
+                        pending.push_back(at + 1);
+                    }
+                    break;
+
+                case OP_REPEAT:
+                    if (in.arg2 == 0) {
+                        pending.push_back(in.target);
+                    }
+                    break;
+
+                case OP_GOTO:
+                case OP_POP_FAILURE_GOTO:
+                    pending.push_back(in.target);
+                    break;
+
+                case OP_FAKE_FAILURE_GOTO:
+                    pending.push_back(in.target);
+                    pending.push_back(in.arg1);
+                    break;
+
+                case OP_PUSH_FAILURE:
+                case OP_PUSH_FAILURE2:
+                case OP_CLOSURE:
+                case OP_CLOSURE_INC:
+                    pending.push_back(in.target);
+                    pending.push_back(at + 1);
+                    break;
+
+                default:
+                    if (!tests_one_character(in.op)) {
+                        pending.push_back(at + 1);
+                    }
+                    break;
+            }
+        }
+        return false;
+    }
+
+    // x* is compiled as
+    //
+    //	i	OP_PUSH_FAILURE i + 3
+    //	i + 1	the test
+    //	i + 2	OP_GOTO i
+    //
+    // which pushes a failure point for every character it takes. the OP_REPEAT
+    // put in place of the OP_PUSH_FAILURE takes the whole run at once, and only
+    // has the one failure point (see exec_backtrack). x+ has an
+    // OP_FAKE_FAILURE_GOTO to the test in front of that; it becomes an OP_REPEAT
+    // with a minimum of 1. the test and the OP_GOTO are left where they are, so
+    // anything else that jumps to them still does what it did.
+    //
+    // when what comes after the loop has to start with a character the test
+    // doesn't take, like the : in \d+:, giving characters back can't help; the
+    // OP_REPEAT is made possessive and doesn't keep its failure point.
+    template<class traitsT>
+    int linked_code<traitsT>::fuse_repeats() {
+        int found = 0;
+        for (int i = 0; _valid && i + 3 < size(); i++) {
+            const instruction_type &push = _code[i];
+            const instruction_type &back = _code[i + 2];
+            if (push.op != OP_PUSH_FAILURE || push.target != i + 3 || !tests_one_character(_code[i + 1].op)
+                || back.op != OP_GOTO || back.target != i) {
+                continue;
+            }
+            instruction_type repeat(OP_REPEAT, i + 1, 0);
+            repeat.target = i + 3;
+            repeat.slot = possessive(repeat) ? 1 : 0;
+            if (i > 0 && _code[i - 1].op == OP_FAKE_FAILURE_GOTO && _code[i - 1].target == i + 1) {
+                _code[i - 1] = repeat;
+                _code[i - 1].arg2 = 1;
+            }
+            _code[i] = repeat;
+            found++;
+        }
+        return found;
+    }
+
+    template<class traitsT>
+    bool linked_code<traitsT>::accepts(const instruction_type &in, const int_type ch) const {
+        switch (in.op) {
+            case OP_CHAR:
+                return ch == static_cast<char_type>(in.arg1);
+            case OP_NOT_CHAR:
+                return ch != static_cast<char_type>(in.arg1);
+            case OP_BIN_CHAR:
+                return ch == in.arg1;
+            case OP_NOT_BIN_CHAR:
+                return ch != in.arg1;
+            case OP_ANY_CHAR:
+                return ch != '\n';
+            case OP_RANGE_CHAR:
+                return ch >= in.arg1 && ch <= in.arg2;
+            case OP_NOT_RANGE_CHAR:
+                return !(ch >= in.arg1 && ch <= in.arg2);
+            case OP_CLASS:
+            case OP_NOT_CLASS:
+            case OP_RANGE_CLASS:
+                return code_vector_type::class_member(literals(in), ch);
+            case OP_DIGIT:
+                return in.arg1 ? !traits_type::isdigit(ch) : traits_type::isdigit(ch);
+            case OP_SPACE:
+                return in.arg1 ? !traits_type::isspace(ch) : traits_type::isspace(ch);
+            case OP_WORD:
+                return in.arg1 ? !traits_type::isalnum(ch) : traits_type::isalnum(ch);
+            default:
+                return false;
+        }
+    }
+
+    // can't what follows the loop start with anything its test takes? groups
+    // don't take any characters, so they're looked past, and so is the jump
+    // into an x+.
+    template<class traitsT>
+    bool linked_code<traitsT>::possessive(const instruction_type &repeat) const {
+        const instruction_type &test = _code[repeat.arg1];
+        int at = repeat.target;
+        for (int hops = 0; hops < size(); hops++) {
+            const opcodes op = _code[at].op;
+            if (op == OP_FAKE_FAILURE_GOTO) {
+                at = _code[at].target;
+            } else if (op == OP_BACKREF_BEGIN || op == OP_BACKREF_END || op == OP_ATOMIC_BEGIN || op == OP_ATOMIC_END) {
+                at++;
+            } else {
+                break;
+            }
+        }
+        const instruction_type &next = _code[at];
+        switch (next.op) {
+            case OP_CHAR:
+                return !accepts(test, static_cast<char_type>(next.arg1));
+            case OP_BIN_CHAR:
+                return !accepts(test, next.arg1);
+            case OP_STRING:
+                return next.arg2 > 0 && !accepts(test, static_cast<char_type>(literals(next)[0]));
+            default:
+                // all of the characters, when there's no more than 256 of them
+                // (or the test only takes ones from its bitmap).
+                if (!tests_one_character(next.op) || (sizeof(char_type) > 1 && next.op != OP_CLASS)) {
+                    return false;
+                }
+                for (int c = 0; c < 256; c++) {
+                    const int_type ch = static_cast<char_type>(c);
+                    if (accepts(next, ch) && accepts(test, ch)) {
+                        return false;
+                    }
+                }
+                return true;
+        }
+    }
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <cstdint>
+#include "program.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// re_onepass is a dfa for code that is "one-pass": from every state, each
+	// character lets at most one way through the code go on, so there's never
+	// anything to backtrack to and the groups can be saved as the text is read.
+	// (\d+)-(\d+)-(\w+) is; (a|ab)c isn't, after the a it can't tell which way
+	// it went until later.
+	//
+	// a state is a key of the re_program (an instruction and the closure counts)
+	// that comes after a character. each state has a table of what to do with
+	// every character: go on to another state saving some of the slots, match
+	// right there, or fail. when an OP_END can be got to from a state, but a way
+	// that goes on comes first, that match is kept; it's what exec_match would
+	// go back to if the way that goes on fails.
+	//
+	// it works like exec_match, the match has to start at pos. code that isn't
+	// one-pass, or has line begins after the start, word tests, more than 64
+	// slots or too many states, isn't valid().
+
+	template<class traitsT>
+	class re_onepass {
+	public:
+		typedef traitsT traits_type;
+		typedef typename traits_type::char_type char_type;
+		typedef re_program<traitsT> program_type;
+		typedef uint64_t mask_type;
+
+		enum { NO_MATCH = -1, GAVE_UP = -2 };
+
+		enum { LIMIT = 4096 }; // most states
+
+		explicit re_onepass(const program_type &program);
+
+		bool valid() const { return _valid; }
+
+		int states() const { return static_cast<int>(_states.size()); }
+
+		// the match starting at pos; returns pos, or NO_MATCH. slots are as
+		// re_pike::exec leaves them. kept is where the longest match so far is
+		// kept while a longer one is tried; it's swapped with slots, so it's
+		// passed in to be kept with them.
+		int exec(const char_type *buffer, int pos, int end, std::vector<int> &kept,
+		         std::vector<int> &slots) const;
+
+		int exec(const char_type *buffer, int pos, int end, std::vector<int> &slots) const {
+			std::vector<int> kept;
+			return exec(buffer, pos, end, kept, slots);
+		}
+
+	private:
+		typedef typename program_type::node node;
+		typedef typename program_type::frame frame;
+
+		enum { FAIL = 255, MATCH = 254 }; // in the tables, otherwise the way to go on
+
+		// where the start state is reached from; NOT_START for the rest.
+		enum { NOT_START = -1, START, START_LINE, START_BUFFER };
+
+		struct way {
+			int state;
+			mask_type save; // the slots set to where the character is
+		};
+
+		struct state {
+			unsigned char table[256];
+			std::vector<way> ways;
+			bool match; // an OP_END, behind the ways
+			mask_type match_save;
+			bool end_match; // when there's no text left
+			mask_type end_save;
+		};
+
+		// the ways on from pc with the counts given, in the order exec_match would
+		// try them (the key, registers and saved slots of each), and the OP_END if
+		// one gets in first. at_end is for when the text has run out.
+		bool closure(const program_type &program, int pc, const std::vector<int> &counts, int start,
+		             bool at_end, std::vector<int> &keys, std::vector<std::vector<int> > &regs,
+		             std::vector<mask_type> &saves, bool &match, mask_type &match_save) const;
+
+		bool build(const program_type &program, int s, int pc, const std::vector<int> &counts, int start);
+
+		static void save(std::vector<int> &slots, mask_type mask, int at) {
+			for (int i = 0; mask != 0; i++, mask >>= 1) {
+				if (mask & 1) {
+					slots[i] = at;
+				}
+			}
+		}
+
+		std::vector<state> _states;
+		std::map<int, int> _index; // key to state
+		std::vector<std::pair<int, std::vector<int> > > _todo; // pc and counts of new states
+		int _start[3];
+		int _nslots;
+		bool _valid;
+	};
+
+	template<class traitsT>
+	re_onepass<traitsT>::re_onepass(const program_type &program)
+		: _start(), _nslots(program.slots()), _valid(false) {
+		if (sizeof(char_type) != 1 || !program.valid() || _nslots > 64) {
+			return;
+		}
+
+		const std::vector<int> fresh(program.registers() - _nslots, 0);
+		_states.resize(START_BUFFER + 1);
+		for (int s = START; s <= START_BUFFER; s++) {
+			_start[s] = s;
+			if (!build(program, s, 0, fresh, s)) {
+				return;
+			}
+		}
+		// the states get found while building the earlier ones.
+		for (size_t s = START_BUFFER + 1; s < _states.size(); s++) {
+			const std::pair<int, std::vector<int> > at = _todo[s - START_BUFFER - 1];
+			if (!build(program, s, at.first, at.second, NOT_START)) {
+				return;
+			}
+		}
+		_todo.clear();
+		_valid = true;
+	}
+
+	template<class traitsT>
+	bool re_onepass<traitsT>::build(const program_type &program, const int s, const int pc,
+	                                const std::vector<int> &counts, const int start) {
+		std::vector<int> keys;
+		std::vector<std::vector<int> > regs;
+		std::vector<mask_type> saves;
+		bool match = false;
+		mask_type match_save = 0;
+		if (!closure(program, pc, counts, start, false, keys, regs, saves, match, match_save)) {
+			return false;
+		}
+		if (keys.size() >= MATCH) {
+			return false;
+		}
+
+		state st;
+		std::fill(st.table, st.table + 256, match ? MATCH : FAIL);
+		st.match = match;
+		st.match_save = match_save;
+		for (size_t w = 0; w < keys.size(); w++) {
+			const int at = keys[w] % program.pcs();
+			const node &nd = program[at];
+			for (int c = 0; c < 256; c++) {
+				if (program.test(nd, static_cast<char_type>(c), false)) {
+					if (st.table[c] < MATCH) {
+						return false; // two ways on; not one-pass.
+					}
+					st.table[c] = static_cast<unsigned char>(w);
+				}
+			}
+
+			const int next = program.key(nd.next, regs[w].data());
+			auto it = _index.find(next);
+			if (it == _index.end()) {
+				if (_states.size() >= LIMIT) {
+					return false;
+				}
+				it = _index.emplace(next, _states.size()).first;
+				_states.emplace_back();
+				_todo.emplace_back(nd.next, std::vector<int>(regs[w].begin() + _nslots, regs[w].end()));
+			}
+			st.ways.push_back(way{it->second, saves[w]});
+		}
+
+		keys.clear();
+		regs.clear();
+		saves.clear();
+		st.end_match = false;
+		st.end_save = 0;
+		if (!closure(program, pc, counts, start, true, keys, regs, saves, st.end_match, st.end_save)) {
+			return false;
+		}
+		_states[s] = std::move(st);
+		return true;
+	}
+
+	template<class traitsT>
+	bool re_onepass<traitsT>::closure(const program_type &program, const int pc, const std::vector<int> &counts,
+	                                  const int start, const bool at_end, std::vector<int> &keys,
+	                                  std::vector<std::vector<int> > &ways, std::vector<mask_type> &saves,
+	                                  bool &match, mask_type &match_save) const {
+		// the slots say which have been saved on the way here (step() saves the
+		// position, 1).
+		std::vector<int> regs(_nslots, 0);
+		regs.insert(regs.end(), counts.begin(), counts.end());
+		std::vector<frame> stack(1, frame{pc, 1, 0, 0});
+		std::vector<int> seen;
+		const auto saved = [&]() {
+			mask_type mask = 0;
+			for (int i = 0; i < _nslots; i++) {
+				if (regs[i] == 1) {
+					mask |= mask_type(1) << i;
+				}
+			}
+			return mask;
+		};
+
+		while (!stack.empty()) {
+			const frame f = stack.back();
+			stack.pop_back();
+			if (f.pc < 0) {
+				regs[f.reg] = f.value;
+				continue;
+			}
+			for (int at = f.pc; at >= 0;) {
+				const int k = program.key(at, regs.data());
+				if (std::find(seen.begin(), seen.end(), k) != seen.end()) {
+					break;
+				}
+				seen.push_back(k);
+
+				const node &nd = program[at];
+				switch (nd.what) {
+					case program_type::TEST:
+					case program_type::CHAR:
+						if (!at_end) {
+							keys.push_back(k);
+							ways.push_back(regs);
+							saves.push_back(saved());
+						}
+						at = -1;
+						break;
+
+					case program_type::MATCH:
+						// nothing after this gets tried.
+						match = true;
+						match_save = saved();
+						return true;
+
+					case program_type::LINE_BEGIN:
+						if (start == NOT_START) {
+							return false; // depends on the character before.
+						}
+						at = (start != START) ? nd.next : -1;
+						break;
+
+					case program_type::BUFFER_BEGIN:
+						at = (start == START_BUFFER) ? nd.next : -1;
+						break;
+
+					case program_type::END_OF_TEXT:
+						at = at_end ? nd.next : -1;
+						break;
+
+					case program_type::WORD_BEGIN:
+						return false;
+
+					default:
+						at = program.step(at, regs.data(), nullptr, 1, 2, stack);
+						break;
+				}
+			}
+		}
+		return true;
+	}
+
+	template<class traitsT>
+	int re_onepass<traitsT>::exec(const char_type *buffer, const int pos, const int end,
+	                              std::vector<int> &kept, std::vector<int> &slots) const {
+		if (!_valid) {
+			return GAVE_UP;
+		}
+
+		slots.assign(_nslots, -1);
+		slots[0] = pos;
+		kept.clear(); // the match to go back to
+		int s = _start[pos == 0 ? START_BUFFER : (buffer[pos - 1] == '\n' ? START_LINE : START)];
+		for (int at = pos;; at++) {
+			const state &st = _states[s];
+			if (at == end) {
+				if (st.end_match) {
+					save(slots, st.end_save, at);
+					slots[1] = at;
+					return pos;
+				}
+				break;
+			}
+			const int w = st.table[static_cast<unsigned char>(buffer[at])];
+			if (w == MATCH) {
+				save(slots, st.match_save, at);
+				slots[1] = at;
+				return pos;
+			}
+			if (w == FAIL) {
+				break;
+			}
+			if (st.match) {
+				kept = slots;
+				save(kept, st.match_save, at);
+				kept[1] = at;
+			}
+			save(slots, st.ways[w].save, at);
+			s = st.ways[w].state;
+		}
+		if (kept.empty()) {
+			return NO_MATCH;
+		}
+		slots.swap(kept);
+		return pos;
+	}
+}
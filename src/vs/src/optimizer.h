@@ -0,0 +1,533 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include "tokens.h"
+#include "code.h"
+#include "instruction.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// code_optimizer is a peephole pass over the compiled code. it works on the
+	// linked instructions (see instruction.h), where the jumps are instruction
+	// indexes, and stores the code again when it's done:
+	//
+	//	- runs of OP_CHAR/OP_STRING become one OP_STRING (unless something jumps
+	//	  into the middle of them).
+	//	- a jump to an OP_GOTO goes where the OP_GOTO goes, and a goto to the
+	//	  next instruction is dropped. (a goto to the OP_END stays a goto; the
+	//	  studies in exec_study want the one OP_END.)
+	//	- OP_NOOPs go, and so does anything that can't be got to.
+	//	- an OP_PUSH_FAILURE followed by its OP_POP_FAILURE (or OP_POP_FAILURE_GOTO),
+	//	  with nothing that can fail or push in between, can never be used; both
+	//	  go (the OP_POP_FAILURE_GOTO is left as an OP_GOTO).
+	//
+	// the passes are repeated until none of them finds anything. the failure
+	// points and closures behave just as they did, so do the groups; the code is
+	// only shorter.
+	//
+	// the OP_PUSH_FAILURE after an OP_FAKE_FAILURE_GOTO is where the failure
+	// point it pushes comes from, so it always stays right behind it.
+	//
+	// given the caseless compares, it folds them into the code instead (and
+	// leaves the rest alone): an OP_CHAR with more than one case becomes a class
+	// of its cases, an OP_STRING is split into the characters that have them and
+	// runs of the ones that don't, and a class gets a bitmap with every case it
+	// takes. the code is then run with the compares off; the dfa, the pike vm and
+	// the literal studies all work on it, and nothing calls toupper while
+	// matching. only for one byte characters, the bitmaps can't have the rest.
+
+	template<class traitsT>
+	class code_optimizer {
+	public:
+		typedef traitsT traits_type;
+		typedef compiled_code_vector<traits_type> code_vector_type;
+		typedef typename code_vector_type::code_type code_type;
+		typedef linked_code<traits_type> linked_type;
+		typedef typename linked_type::instruction_type instruction_type;
+
+		enum { PASSES = 8 };
+
+		explicit code_optimizer(const code_vector_type &code);
+
+		code_optimizer(const code_vector_type &code, bool caseless, bool lower_caseless);
+
+		bool valid() const { return _valid; }
+
+		// how many things were changed; 0 leaves the code as it was.
+		int changes() const { return _changes; }
+
+		const code_vector_type &code() const { return _code; }
+
+	private:
+		typedef typename traits_type::char_type char_type;
+		typedef typename traits_type::int_type int_type;
+		typedef typename code_vector_type::operands_type operands_type;
+
+		struct step {
+			instruction_type in;
+			std::vector<code_type> text; // OP_STRING, or the whole of a class
+			bool removed;
+			bool folded; // text is the code for it, as it is (see fold_cases)
+		};
+
+		// where a jump to i ends up; removed instructions go on to the next one.
+		int resolve(int i) const {
+			while (i < static_cast<int>(_steps.size()) - 1 && _steps[i].removed) {
+				i++;
+			}
+			return i;
+		}
+
+		int next(const int i) const { return resolve(i + 1); }
+
+		static bool jumps(const opcodes op) {
+			switch (op) {
+				case OP_GOTO:
+				case OP_PUSH_FAILURE:
+				case OP_PUSH_FAILURE2:
+				case OP_POP_FAILURE_GOTO:
+				case OP_FAKE_FAILURE_GOTO:
+				case OP_CLOSURE:
+				case OP_CLOSURE_INC:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		int remove(int i) {
+			_steps[i].removed = true;
+			return 1;
+		}
+
+		bool load(const code_vector_type &code);
+
+		std::vector<bool> targets() const;
+
+		int thread_jumps();
+
+		int fold_failures();
+
+		int merge_strings();
+
+		int drop_dead_code();
+
+		int fold_cases(bool caseless, bool lower_caseless);
+
+		void store();
+
+		std::vector<step> _steps;
+		code_vector_type _code;
+		int _changes;
+		bool _valid;
+	};
+
+	template<class traitsT>
+	code_optimizer<traitsT>::code_optimizer(const code_vector_type &code)
+		: _code(code), _changes(0), _valid(false) {
+		if (!load(code)) {
+			return;
+		}
+		for (int pass = 0; pass < PASSES; pass++) {
+			const int found = thread_jumps() + fold_failures() + merge_strings() + drop_dead_code();
+			if (found == 0) {
+				break;
+			}
+			_changes += found;
+		}
+		if (_changes == 0) {
+			_valid = true;
+			return;
+		}
+		store();
+		if (_code.too_long()) {
+			_code = code;
+			_changes = 0;
+			return;
+		}
+		_valid = true;
+	}
+
+	template<class traitsT>
+	code_optimizer<traitsT>::code_optimizer(const code_vector_type &code, const bool caseless,
+	                                        const bool lower_caseless)
+		: _code(code), _changes(0), _valid(false) {
+		if (sizeof(char_type) != 1 || !load(code)) {
+			return;
+		}
+		_changes = 0; // the OP_NOOPs can stay
+		if (caseless || lower_caseless) {
+			_changes = fold_cases(caseless, lower_caseless);
+		}
+		if (_changes > 0) {
+			store();
+			if (_code.too_long()) {
+				_code = code;
+				_changes = 0;
+				return;
+			}
+		}
+		_valid = true;
+	}
+
+	// the instructions, with the text of the strings and the classes.
+	template<class traitsT>
+	bool code_optimizer<traitsT>::load(const code_vector_type &code) {
+		const linked_type linked(code);
+		if (!linked.valid()) {
+			return false;
+		}
+		for (int i = 0; i < linked.size(); i++) {
+			step s{linked[i], {}, linked[i].op == OP_NOOP, false};
+			if (s.in.op == OP_STRING || s.in.op == OP_CLASS || s.in.op == OP_NOT_CLASS || s.in.op == OP_RANGE_CLASS) {
+				s.text.assign(linked.literals(s.in), linked.literals(s.in) + s.in.arg2);
+			}
+			_changes += s.removed;
+			_steps.push_back(s);
+		}
+		return true;
+	}
+
+	// the instructions something jumps to (or comes back to on a failure).
+	template<class traitsT>
+	std::vector<bool> code_optimizer<traitsT>::targets() const {
+		std::vector<bool> to(_steps.size(), false);
+		to[0] = true;
+		for (const step &s: _steps) {
+			if (!s.removed && jumps(s.in.op)) {
+				to[resolve(s.in.target)] = true;
+			}
+		}
+		return to;
+	}
+
+	template<class traitsT>
+	int code_optimizer<traitsT>::thread_jumps() {
+		int found = 0;
+		const int n = static_cast<int>(_steps.size());
+		for (int i = 0; i < n; i++) {
+			step &s = _steps[i];
+			if (s.removed || !jumps(s.in.op) || s.in.op == OP_PUSH_FAILURE2) {
+				continue; // a negated class's failure point is part of the class.
+			}
+			int to = resolve(s.in.target);
+			for (int hops = 0; _steps[to].in.op == OP_GOTO && hops < n; hops++) {
+				to = resolve(_steps[to].in.target);
+			}
+			if (to != s.in.target) {
+				s.in.target = to;
+				found++;
+			}
+
+			if (i > 0 && _steps[i - 1].in.op == OP_FAKE_FAILURE_GOTO && !_steps[i - 1].removed) {
+				continue;
+			}
+			if (s.in.op == OP_GOTO && to == next(i)) {
+				found += remove(i);
+			} else if (s.in.op == OP_POP_FAILURE_GOTO && to == next(i)) {
+				s.in = instruction_type(OP_POP_FAILURE);
+				found++;
+			}
+		}
+		return found;
+	}
+
+	template<class traitsT>
+	int code_optimizer<traitsT>::fold_failures() {
+		int found = 0;
+		const std::vector<bool> to = targets();
+		for (int i = 0; i < static_cast<int>(_steps.size()); i++) {
+			if (_steps[i].removed || _steps[i].in.op != OP_PUSH_FAILURE
+			    || (i > 0 && _steps[i - 1].in.op == OP_FAKE_FAILURE_GOTO && !_steps[i - 1].removed)) {
+				continue;
+			}
+			// groups can't fail, or push anything.
+			int j = next(i);
+			while (!to[j] && (_steps[j].in.op == OP_BACKREF_BEGIN || _steps[j].in.op == OP_BACKREF_END)) {
+				j = next(j);
+			}
+			if (to[j]) {
+				continue;
+			}
+			if (_steps[j].in.op == OP_POP_FAILURE) {
+				found += remove(i) + remove(j);
+			} else if (_steps[j].in.op == OP_POP_FAILURE_GOTO) {
+				found += remove(i);
+				_steps[j].in.op = OP_GOTO;
+			}
+		}
+		return found;
+	}
+
+	template<class traitsT>
+	int code_optimizer<traitsT>::merge_strings() {
+		int found = 0;
+		const std::vector<bool> to = targets();
+		const size_t most = std::numeric_limits<code_type>::max();
+		for (int i = 0; i < static_cast<int>(_steps.size()); i++) {
+			step &s = _steps[i];
+			if (s.removed || (s.in.op != OP_CHAR && s.in.op != OP_STRING)) {
+				continue;
+			}
+			for (int j = next(i); !to[j] && !_steps[j].removed; j = next(j)) {
+				step &t = _steps[j];
+				if (t.in.op != OP_CHAR && t.in.op != OP_STRING) {
+					break;
+				}
+				const size_t more = (t.in.op == OP_CHAR) ? 1 : t.text.size();
+				const size_t have = (s.in.op == OP_CHAR) ? 1 : s.text.size();
+				if (have + more > most) {
+					break;
+				}
+				if (s.in.op == OP_CHAR) {
+					s.text.assign(1, static_cast<code_type>(s.in.arg1));
+					s.in = instruction_type(OP_STRING);
+				}
+				if (t.in.op == OP_CHAR) {
+					s.text.push_back(static_cast<code_type>(t.in.arg1));
+				} else {
+					s.text.insert(s.text.end(), t.text.begin(), t.text.end());
+				}
+				found += remove(j);
+			}
+		}
+		return found;
+	}
+
+	template<class traitsT>
+	int code_optimizer<traitsT>::drop_dead_code() {
+		const int n = static_cast<int>(_steps.size());
+		std::vector<bool> live(n, false);
+		std::vector<int> pending(1, resolve(0));
+		while (!pending.empty()) {
+			const int i = pending.back();
+			pending.pop_back();
+			if (live[i]) {
+				continue;
+			}
+			live[i] = true;
+			const step &s = _steps[i];
+			if (jumps(s.in.op)) {
+				pending.push_back(resolve(s.in.target));
+			}
+			switch (s.in.op) {
+				case OP_END:
+				case OP_GOTO:
+				case OP_POP_FAILURE_GOTO:
+					break;
+				default:
+					// an OP_FAKE_FAILURE_GOTO's OP_PUSH_FAILURE isn't run, but it's
+					// where the failure point comes from.
+					if (i + 1 < n) {
+						pending.push_back(next(i));
+					}
+					break;
+			}
+		}
+
+		int found = 0;
+		for (int i = 0; i + 1 < n; i++) {
+			if (!live[i] && !_steps[i].removed) {
+				found += remove(i);
+			}
+		}
+		return found;
+	}
+
+	template<class traitsT>
+	int code_optimizer<traitsT>::fold_cases(const bool caseless, const bool lower_caseless) {
+		// the class for the characters 0..255 that accepts lets through, and how
+		// many there are.
+		auto fold = [](const opcodes op, auto accepts, int &members) {
+			std::vector<code_type> out(1 + code_vector_type::CLASS_BITMAP, 0);
+			out[0] = static_cast<code_type>(op);
+			members = 0;
+			for (int c = 0; c < 256; c++) {
+				if (accepts(static_cast<char_type>(c))) {
+					out[1 + c / operands_type::BITS] |= static_cast<code_type>(1 << (c % operands_type::BITS));
+					members++;
+				}
+			}
+			return out;
+		};
+		auto cases = [caseless, lower_caseless, &fold](const int_type c, int &members) {
+			return fold(OP_CLASS, [&](const int_type ch) {
+				return code_vector_type::char_test(c, ch, caseless, lower_caseless);
+			}, members);
+		};
+
+		int found = 0;
+		int members = 0;
+		for (step &s: _steps) {
+			if (s.removed) {
+				continue;
+			}
+			switch (s.in.op) {
+				case OP_CHAR: {
+					auto folded = cases(static_cast<char_type>(s.in.arg1), members);
+					if (members > 1) {
+						s.in = instruction_type(OP_CLASS);
+						s.text = folded;
+						found++;
+					}
+					break;
+				}
+
+				case OP_NOT_CHAR:
+				case OP_RANGE_CHAR:
+				case OP_NOT_RANGE_CHAR: {
+					// as a class, when the cases make it take something more.
+					const instruction_type in = s.in;
+					auto takes = [&in](const bool c, const bool l) {
+						return [&in, c, l](const int_type ch) {
+							if (in.op == OP_NOT_CHAR) {
+								return !code_vector_type::char_test(static_cast<char_type>(in.arg1), ch, c, l);
+							}
+							return code_vector_type::range_test(in.arg1, in.arg2, ch, c, l) == (in.op == OP_RANGE_CHAR);
+						};
+					};
+					const opcodes op = in.op == OP_RANGE_CHAR ? OP_CLASS : OP_NOT_CLASS;
+					auto folded = fold(op, takes(caseless, lower_caseless), members);
+					if (folded != fold(op, takes(false, false), members)) {
+						s.in = instruction_type(op);
+						s.text = folded;
+						found++;
+					}
+					break;
+				}
+
+				case OP_STRING: {
+					std::vector<code_type> out, run;
+					auto flush = [&out, &run] {
+						if (run.size() == 1) {
+							out.push_back(static_cast<code_type>(OP_CHAR));
+						} else if (!run.empty()) {
+							out.push_back(static_cast<code_type>(OP_STRING));
+							out.push_back(static_cast<code_type>(run.size()));
+						}
+						out.insert(out.end(), run.begin(), run.end());
+						run.clear();
+					};
+					bool any = false;
+					for (const code_type c: s.text) {
+						auto folded = cases(static_cast<char_type>(c), members);
+						if (members > 1) {
+							flush();
+							out.insert(out.end(), folded.begin(), folded.end());
+							any = true;
+						} else {
+							run.push_back(c);
+						}
+					}
+					flush();
+					if (any) {
+						s.text = out;
+						s.folded = true;
+						found++;
+					}
+					break;
+				}
+
+				case OP_CLASS:
+				case OP_NOT_CLASS: {
+					const std::vector<code_type> text = s.text;
+					auto folded = fold(s.in.op, [&](const int_type ch) {
+						return code_vector_type::class_test(text.data(), ch, caseless, lower_caseless);
+					}, members);
+					if (folded != s.text) {
+						s.text = folded;
+						found++;
+					}
+					break;
+				}
+
+				default:
+					break;
+			}
+		}
+		return found;
+	}
+
+	// the code for the instructions that are left; the jumps are put in when
+	// everything has its offset.
+	template<class traitsT>
+	void code_optimizer<traitsT>::store() {
+		code_vector_type out;
+		std::vector<int> offset(_steps.size(), -1);
+		struct fixup {
+			int at; // where the address goes
+			int step; // what it's the address of
+			int skip; // code after the address that the displacement is from the end of
+		};
+		std::vector<fixup> fixups;
+		for (int i = 0; i < static_cast<int>(_steps.size()); i++) {
+			const step &s = _steps[i];
+			if (s.removed) {
+				continue;
+			}
+			const instruction_type &in = s.in;
+			offset[i] = out.offset();
+			if (s.folded) {
+				for (const code_type c: s.text) {
+					out.store(c);
+				}
+				continue;
+			}
+			switch (in.op) {
+				case OP_STRING:
+					out.store(OP_STRING, static_cast<code_type>(s.text.size()));
+					for (const code_type c: s.text) {
+						out.store(c);
+					}
+					break;
+
+				case OP_CLASS:
+				case OP_NOT_CLASS:
+				case OP_RANGE_CLASS:
+					for (const code_type c: s.text) {
+						out.store(c);
+					}
+					break;
+
+				case OP_RANGE_CHAR:
+				case OP_NOT_RANGE_CHAR:
+					out.store(in.op);
+					out.store(static_cast<code_type>(in.arg1));
+					out.store(static_cast<code_type>(in.arg2));
+					break;
+
+				case OP_GOTO:
+				case OP_PUSH_FAILURE:
+				case OP_PUSH_FAILURE2:
+				case OP_POP_FAILURE_GOTO:
+				case OP_FAKE_FAILURE_GOTO:
+					out.store(in.op);
+					fixups.push_back(fixup{out.store(0), in.target, 0});
+					out.store(0);
+					break;
+
+				case OP_CLOSURE:
+				case OP_CLOSURE_INC:
+					fixups.push_back(fixup{out.store_closure_op(in.op, in.arg1, in.arg2, in.slot) + 1, in.target, 6});
+					break;
+
+				default: {
+					const code_type op[2] = {static_cast<code_type>(in.op), 0};
+					if (code_graph<traits_type>::instruction_length(op) == 2) {
+						out.store(in.op, static_cast<code_type>(in.arg1));
+					} else {
+						out.store(in.op);
+					}
+					break;
+				}
+			}
+		}
+
+		// a closure's displacement is from after its three numbers.
+		for (const fixup &f: fixups) {
+			out.put_address(f.at, offset[resolve(f.step)] - f.skip);
+		}
+		_code = out;
+	}
+}
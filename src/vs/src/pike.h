@@ -0,0 +1,184 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "program.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// re_pike runs a re_program as a pike vm: instead of backtracking, every way
+	// through the code is followed at the same time, one character at a time, so
+	// the time is bounded by the length of the text times the number of keys.
+	//
+	// the threads are kept in the order exec_match would get to them, and
+	// everything behind a thread that gets to OP_END is dropped, so the match and
+	// the groups are the ones the backtracking would find. the thread lists are
+	// sparse sets of keys; only the first thread with a key is kept.
+
+	template<class traitsT>
+	class re_pike {
+	public:
+		typedef traitsT traits_type;
+		typedef typename traits_type::char_type char_type;
+		typedef re_program<traitsT> program_type;
+
+		enum { NO_MATCH = -1, GAVE_UP = -2 };
+
+	private:
+		typedef typename program_type::node node;
+		typedef typename program_type::frame frame;
+
+		// a thread list; the sparse set from briggs & torczon. sparse is never
+		// initialized, contains() only believes an entry that dense agrees with,
+		// so getting it ready for another list costs nothing whatever the keys.
+		struct thread_list {
+			std::unique_ptr<int[]> sparse;
+			size_t room = 0; // the keys sparse has room for
+			std::vector<int> dense;
+			std::vector<int> regs; // the registers for each dense entry
+
+			void reserve(const size_t keys) {
+				if (keys > room) {
+					sparse.reset(new int[keys]);
+					room = keys;
+				}
+			}
+
+			bool contains(int key) const {
+				const size_t i = sparse[key];
+				return i < dense.size() && dense[i] == key;
+			}
+
+			void clear() {
+				dense.clear();
+				regs.clear();
+			}
+		};
+
+	public:
+		// what exec works in. they only ever grow, so whoever keeps one from
+		// call to call (re_engine's match_context) doesn't allocate once it's
+		// grown to the program.
+		struct buffers {
+			thread_list clist, nlist;
+			std::vector<frame> stack;
+			std::vector<int> regs;
+			std::vector<int> fresh;
+		};
+
+		explicit re_pike(const program_type &program) : _program(program) {}
+
+		// try matches starting from pos up to last (pos == last is what exec_match
+		// does). returns where the match starts, or NO_MATCH; slots gets the match
+		// and then each group, begin/end pairs, -1 where a group didn't match.
+		int exec(const char_type *buffer, int pos, int last, int end, bool caseless,
+		         buffers &work, std::vector<int> &slots) const;
+
+		int exec(const char_type *buffer, int pos, int last, int end, bool caseless,
+		         std::vector<int> &slots) const {
+			buffers work;
+			return exec(buffer, pos, last, end, caseless, work, slots);
+		}
+
+	private:
+		void add(thread_list &list, int pc, int *regs, const char_type *buffer, int at, int end,
+		         std::vector<frame> &stack) const;
+
+		const program_type &_program;
+	};
+
+	// follow everything that doesn't consume a character from pc, at position
+	// at, adding threads to the list in the order exec_match would get to them.
+	// regs are the registers of the thread being followed; they're changed as
+	// it goes, and put back from the stack before each failure point is taken.
+	template<class traitsT>
+	void re_pike<traitsT>::add(thread_list &list, int pc, int *regs, const char_type *buffer,
+	                           const int at, const int end, std::vector<frame> &stack) const {
+		const int nregs = _program.registers();
+		stack.push_back(frame{pc, at, 0, 0});
+		while (!stack.empty()) {
+			const frame f = stack.back();
+			stack.pop_back();
+			if (f.pc < 0) {
+				regs[f.reg] = f.value;
+				continue;
+			}
+			for (pc = f.pc; pc >= 0;) {
+				const int k = _program.key(pc, regs);
+				if (list.contains(k)) {
+					break;
+				}
+				list.sparse[k] = list.dense.size();
+				list.dense.push_back(k);
+				list.regs.insert(list.regs.end(), regs, regs + nregs);
+
+				switch (_program[pc].what) {
+					case program_type::TEST:
+					case program_type::CHAR:
+					case program_type::MATCH:
+						pc = -1;
+						break;
+
+					default:
+						pc = _program.step(pc, regs, buffer, at, end, stack);
+						break;
+				}
+			}
+		}
+	}
+
+	template<class traitsT>
+	int re_pike<traitsT>::exec(const char_type *buffer, const int pos, const int last, const int end,
+	                           const bool caseless, buffers &work, std::vector<int> &slots) const {
+		if (!_program.valid()) {
+			return GAVE_UP;
+		}
+
+		const int nregs = _program.registers();
+		const int nslots = _program.slots();
+		thread_list &clist = work.clist, &nlist = work.nlist;
+		clist.reserve(_program.keys());
+		nlist.reserve(_program.keys());
+		clist.clear();
+		std::vector<frame> &stack = work.stack;
+		stack.clear();
+		std::vector<int> &regs = work.regs, &fresh = work.fresh;
+		regs.assign(nregs, -1);
+		std::fill(regs.begin() + nslots, regs.end(), 0);
+		fresh = regs;
+		bool matched = false;
+
+		regs[0] = pos;
+		add(clist, 0, regs.data(), buffer, pos, end, stack);
+		for (int at = pos; !clist.dense.empty(); at++) {
+			nlist.clear();
+			for (size_t i = 0; i < clist.dense.size(); i++) {
+				const node &nd = _program[clist.dense[i] % _program.pcs()];
+				const int *tregs = clist.regs.data() + i * nregs;
+				if (nd.what == program_type::MATCH) {
+					// everything after this is something exec_match wouldn't try.
+					slots.assign(tregs, tregs + nslots);
+					slots[1] = at;
+					matched = true;
+					break;
+				}
+				if ((nd.what == program_type::TEST || nd.what == program_type::CHAR)
+				    && at < end && _program.test(nd, buffer[at], caseless)) {
+					regs.assign(tregs, tregs + nregs);
+					add(nlist, nd.next, regs.data(), buffer, at + 1, end, stack);
+				}
+			}
+			if (at >= end) {
+				break;
+			}
+			if (!matched && at + 1 <= last) {
+				// and a match could start at the next character.
+				regs = fresh;
+				regs[0] = at + 1;
+				add(nlist, 0, regs.data(), buffer, at + 1, end, stack);
+			}
+			std::swap(clist, nlist);
+		}
+		return matched ? slots[0] : NO_MATCH;
+	}
+}
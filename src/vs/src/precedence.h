@@ -1,7 +1,9 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <stack>
+#include <memory_resource>
 #include "concepts.h"
 
 namespace re {
@@ -14,12 +16,14 @@ namespace re {
     // the re_precedence_vec and re_precedence_stack work together to provide and n precedence levels
     // and (almost) unlimited amount of nesting. the nesting occurs when via the precedence stack
     // (push/pop) and the re_precedence_vec stores the current offset of the output code via
-    // a store current precedence. did you get all of that?
+    // a store current precedence. did you get all of that? (the levels are a fixed array, a
+    // ( doesn't allocate anything for them.)
 
     template<int sz>
-    class precedence_vec : public std::vector<int> {
+    class precedence_vec : public std::array<int, sz> {
     public:
-        explicit precedence_vec(const int init = 0) : std::vector<int>(sz, init) {
+        explicit precedence_vec(const int init = 0) {
+            this->fill(init);
         }
     };
 
@@ -29,9 +33,12 @@ namespace re {
     // the actual precedence stack; adds a couple of handy members to keep track of the positions
     // in the re_precedence_element.
 
-    class precedence_stack : public std::stack<re_precedence_element> {
+    class precedence_stack : public std::stack<re_precedence_element, std::pmr::vector<re_precedence_element> > {
     public:
-        precedence_stack() : m_current(0) {
+        explicit precedence_stack(std::pmr::memory_resource *arena = std::pmr::get_default_resource())
+            : std::stack<re_precedence_element, std::pmr::vector<re_precedence_element> >(container_type(arena)),
+              m_current(0) {
+            c.reserve(8);
             push(re_precedence_element());
         }
 
@@ -52,6 +59,6 @@ namespace re {
     // should occur when changing to lower precedence operators. after a successful
     // compilation of a regular expression the future jump stack should be empty.
 
-    typedef std::stack<int> re_future_jump_stack;
+    typedef std::stack<int, std::pmr::vector<int> > re_future_jump_stack;
     typedef precedence_stack precedence_stack;
 }
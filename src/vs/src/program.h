@@ -0,0 +1,368 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "tokens.h"
+#include "code.h"
+#include "code_graph.h"
+
+namespace re {
+	/////////////////////////////////////////////////////////////////////////////////
+	// re_program is the compiled code taken apart for the engines that don't
+	// backtrack through it byte by byte (re_pike and re_bitstate); one node per
+	// instruction, with the jumps worked out, and one for each character of an
+	// OP_STRING.
+	//
+	// the engines keep registers for each way through the code: the group
+	// positions (what exec_match keeps in its backref stacks) and the counts for
+	// the {n,m} closures (in the slots the compiler gave them). two ways at the
+	// same instruction with the same counts will do the same thing from then on,
+	// so key() numbers those, and the engines only follow the first of them (the
+	// one exec_match would try first).
+	//
+	// every count makes the keys go further; code with too many counts (or with
+	// backrefs or the unfinished word tests) isn't valid() for this.
+
+	template<class traitsT>
+	class re_program {
+	public:
+		typedef traitsT traits_type;
+		typedef typename traits_type::char_type char_type;
+		typedef typename traits_type::int_type int_type;
+		typedef compiled_code_vector<traitsT> code_vector_type;
+		typedef typename code_vector_type::code_type code_type;
+
+		enum kind {
+			TEST, CHAR, MATCH, JUMP, SPLIT, SAVE, CLOSURE, CLOSURE_INC,
+			LINE_BEGIN, BUFFER_BEGIN, END_OF_TEXT, WORD_BEGIN
+		};
+
+		enum { LIMIT = 1 << 20 }; // most keys
+
+		struct node {
+			kind what;
+			int next;
+			int alt; // failure point or closure target
+			int arg; // CHAR: the character, SAVE: the register, closures: the count
+			int minimum;
+			int maximum;
+			const code_type *cp; // TEST
+		};
+
+		// a failure point to go back to (pc at position at), or, when pc < 0, a
+		// value to put back into register reg.
+		struct frame {
+			int pc;
+			int at;
+			int reg;
+			int value;
+		};
+
+		re_program(const code_vector_type &code, int groups);
+
+		bool valid() const { return _valid; }
+
+		const node &operator [](int pc) const { return _node[pc]; }
+
+		// the instruction offsets, and how many keys there are.
+		int pcs() const { return _pcs; }
+
+		int keys() const { return _keys; }
+
+		// two registers for the match, two for each group, then the counts.
+		int slots() const { return _nslots; }
+
+		int registers() const { return _nregs; }
+
+		int key(int pc, const int *regs) const;
+
+		// does a TEST or CHAR accept ch?
+		bool test(const node &nd, int_type ch, bool caseless) const;
+
+		// do an instruction that doesn't consume anything, at position at. returns
+		// where to go next, -1 if it fails there. failure points, and the register
+		// values to put back before taking them, go on the stack.
+		int step(int pc, int *regs, const char_type *buffer, int at, int end,
+		         std::vector<frame> &stack) const;
+
+	private:
+		// the same tests exec_match makes on its closure stack entries.
+		static bool closed(int matched, int mi, int mx);
+
+		static bool can_continue(int matched, int mi, int mx);
+
+		std::vector<node> _node; // by code offset
+		std::vector<int> _radix; // for each count, how many values it can have
+		int _pcs;
+		int _keys;
+		int _nslots;
+		int _nregs;
+		bool _valid;
+	};
+
+	template<class traitsT>
+	re_program<traitsT>::re_program(const code_vector_type &code, const int groups)
+		: _pcs(code.offset() + 1), _keys(0), _nslots(2 * (groups + 1)), _nregs(0), _valid(false) {
+		typedef code_graph<traitsT> code_graph_type;
+
+		const code_graph_type graph(code);
+		if (!graph.valid() || graph.end() < 0) {
+			return;
+		}
+
+		// each closure's count is the slot the compiler gave it; the ones that
+		// can't be got to only ever have one value.
+		const code_type *base = code.code();
+		_radix.assign(code.closures(), 1);
+		for (int n = 0; n < graph.size(); n++) {
+			if (graph.reachable(n) && graph.op(n) == OP_CLOSURE_INC) {
+				const code_type *cp = base + graph.offset(n) + 3;
+				const int mi = code_vector_type::decode_number_and_advance(cp);
+				const int mx = code_vector_type::decode_number_and_advance(cp);
+				const int slot = code_vector_type::decode_number_and_advance(cp);
+				if (slot < 0 || slot >= code.closures()) {
+					return;
+				}
+				_radix[slot] = (mx ? mx : mi) + 1;
+			}
+		}
+		_nregs = _nslots + _radix.size();
+
+		long long keys = _pcs;
+		for (int r: _radix) {
+			keys *= r;
+			if (keys > LIMIT) {
+				return;
+			}
+		}
+		_keys = static_cast<int>(keys);
+
+		_node.assign(_pcs, node{MATCH, 0, 0, 0, 0, 0, nullptr});
+		for (int n = 0; n < graph.size(); n++) {
+			if (!graph.reachable(n)) {
+				continue;
+			}
+			const int off = graph.offset(n);
+			const code_type *cp = graph.code(n);
+			node &nd = _node[off];
+			nd.next = off + code_graph_type::instruction_length(cp);
+			switch (*cp) {
+				case OP_END:
+					nd.what = MATCH;
+					break;
+
+				case OP_GOTO:
+				case OP_POP_FAILURE_GOTO:
+				case OP_FAKE_FAILURE_GOTO:
+					nd.what = JUMP;
+					nd.next = code_graph_type::jump_target(base, off);
+					break;
+
+				case OP_PUSH_FAILURE:
+					nd.what = SPLIT;
+					nd.alt = code_graph_type::jump_target(base, off);
+					break;
+
+				case OP_POP_FAILURE:
+				case OP_NOOP:
+					nd.what = JUMP;
+					break;
+
+				case OP_BACKREF_BEGIN:
+				case OP_BACKREF_END:
+					if (code_vector_type::operands_type::unit(cp[1]) < 1
+					    || code_vector_type::operands_type::unit(cp[1]) > groups) {
+						return;
+					}
+					nd.what = SAVE;
+					nd.arg = 2 * code_vector_type::operands_type::unit(cp[1]) + (*cp == OP_BACKREF_END);
+					break;
+
+				case OP_CLOSURE:
+				case OP_CLOSURE_INC: {
+					const code_type *mp = cp + 3;
+					nd.what = (*cp == OP_CLOSURE) ? CLOSURE : CLOSURE_INC;
+					nd.alt = code_graph_type::jump_target(base, off);
+					nd.minimum = code_vector_type::decode_number_and_advance(mp);
+					nd.maximum = code_vector_type::decode_number_and_advance(mp);
+					nd.arg = code_vector_type::decode_number_and_advance(mp);
+					if (nd.arg < 0 || nd.arg >= code.closures()) {
+						return;
+					}
+					break;
+				}
+
+				case OP_BEGIN_OF_LINE:
+					nd.what = LINE_BEGIN;
+					break;
+
+				case OP_BEGIN_OF_BUFFER:
+					nd.what = BUFFER_BEGIN;
+					break;
+
+				case OP_END_OF_LINE:
+				case OP_END_OF_BUFFER:
+					nd.what = END_OF_TEXT;
+					break;
+
+				case OP_BEGIN_OF_WORD:
+					nd.what = WORD_BEGIN;
+					break;
+
+				case OP_CHAR:
+					nd.what = CHAR;
+					nd.arg = cp[1];
+					break;
+
+				case OP_STRING:
+					if (cp[1] == 0) {
+						nd.what = JUMP;
+						break;
+					}
+					for (int i = cp[1] - 1; i >= 0; i--) {
+						node &ch = _node[off + 2 + i];
+						ch.what = CHAR;
+						ch.arg = cp[2 + i];
+						ch.next = (i + 1 < cp[1]) ? off + 3 + i : nd.next;
+					}
+					nd = _node[off + 2];
+					break;
+
+				default:
+					if (graph.consumes(n) != 1 || code_graph_type::char_test(cp, 0) < 0) {
+						return; // backrefs, word boundaries.
+					}
+					nd.what = TEST;
+					nd.cp = cp;
+					if (*cp == OP_PUSH_FAILURE2) {
+						nd.next = code_graph_type::jump_target(base, off);
+					}
+					break;
+			}
+		}
+		_valid = true;
+	}
+
+	template<class traitsT>
+	bool re_program<traitsT>::closed(const int matched, const int mi, const int mx) {
+		if (mi == mx && matched == mi) {
+			return true;
+		}
+		if ((mi == 0 && matched <= mx) || (mx == 0 && matched >= mi)) {
+			return true;
+		}
+		return mi != 0 && mx != 0 && matched >= mi && matched <= mx;
+	}
+
+	template<class traitsT>
+	bool re_program<traitsT>::can_continue(const int matched, const int mi, const int mx) {
+		if (mi == mx && matched < mi) {
+			return true;
+		}
+		if (mi != 0 && mx != 0 && matched < mx) {
+			return true;
+		}
+		return (mi == 0 && matched < mx) || mx == 0;
+	}
+
+	template<class traitsT>
+	int re_program<traitsT>::key(const int pc, const int *regs) const {
+		int k = 0;
+		for (int i = _radix.size() - 1; i >= 0; i--) {
+			k = k * _radix[i] + regs[_nslots + i];
+		}
+		return k * _pcs + pc;
+	}
+
+	template<class traitsT>
+	bool re_program<traitsT>::test(const node &nd, const int_type ch, const bool caseless) const {
+		if (nd.what == CHAR) {
+			if (caseless) {
+				return traits_type::toupper(ch) == traits_type::toupper(nd.arg);
+			}
+			return ch == static_cast<char_type>(nd.arg);
+		}
+		if (caseless) {
+			switch (*nd.cp) {
+				case OP_NOT_CHAR:
+					return !code_vector_type::char_test(static_cast<char_type>(nd.cp[1]), ch, true, false);
+				case OP_RANGE_CHAR:
+					return code_vector_type::range_test(nd.cp[1], nd.cp[2], ch, true, false);
+				case OP_NOT_RANGE_CHAR:
+					return !code_vector_type::range_test(nd.cp[1], nd.cp[2], ch, true, false);
+				case OP_CLASS:
+				case OP_NOT_CLASS:
+				case OP_RANGE_CLASS:
+					return code_vector_type::class_test(nd.cp, ch, true, false);
+				default:
+					break;
+			}
+		}
+		return code_graph<traitsT>::char_test(nd.cp, ch) > 0;
+	}
+
+	template<class traitsT>
+	int re_program<traitsT>::step(const int pc, int *regs, const char_type *buffer, const int at,
+	                              const int end, std::vector<frame> &stack) const {
+		const node &nd = _node[pc];
+		switch (nd.what) {
+			case JUMP:
+				return nd.next;
+
+			case SPLIT:
+				stack.push_back(frame{nd.alt, at, 0, 0});
+				return nd.next;
+
+			case SAVE:
+				stack.push_back(frame{-1, at, nd.arg, regs[nd.arg]});
+				regs[nd.arg] = at;
+				return nd.next;
+
+			case CLOSURE: {
+				// a new count; the closure's failure point goes past it, when no
+				// iterations are enough.
+				const int reg = _nslots + nd.arg;
+				stack.push_back(frame{-1, at, reg, regs[reg]});
+				regs[reg] = 0;
+				if (closed(0, nd.minimum, nd.maximum)) {
+					stack.push_back(frame{nd.alt, at, 0, 0});
+				}
+				return nd.next;
+			}
+
+			case CLOSURE_INC: {
+				// another iteration; go round again first, and past the closure as
+				// the failure point when there have been enough.
+				const int reg = _nslots + nd.arg;
+				const int matched = regs[reg] + 1;
+				stack.push_back(frame{-1, at, reg, regs[reg]});
+				if (!can_continue(matched, nd.minimum, nd.maximum)) {
+					regs[reg] = 0;
+					return nd.next;
+				}
+				if (closed(matched, nd.minimum, nd.maximum)) {
+					stack.push_back(frame{nd.next, at, 0, 0});
+					stack.push_back(frame{-1, at, reg, 0});
+				}
+				// unbounded counts past the minimum are all the same.
+				regs[reg] = nd.maximum ? matched : std::min(matched, nd.minimum);
+				return nd.alt;
+			}
+
+			case LINE_BEGIN:
+				return (at == 0 || buffer[at - 1] == '\n') ? nd.next : -1;
+
+			case BUFFER_BEGIN:
+				return (at == 0) ? nd.next : -1;
+
+			case END_OF_TEXT:
+				return (at == end) ? nd.next : -1;
+
+			case WORD_BEGIN:
+				return (at < end && (at == 0 || traits_type::isalnum(buffer[at - 1]) == 0)) ? nd.next : -1;
+
+			default:
+				return -1; // the ones that consume something aren't done here.
+		}
+	}
+}
@@ -2,9 +2,11 @@
 
 #include <utility> // For std::pair
 #include <vector>  // For std::vector
+#include <memory>  // For std::shared_ptr
 #include "concepts.h"
 #include "traits.h"
 #include "ctext.h"
+#include "engine.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 // class description ---
@@ -15,7 +17,8 @@
 //  string to the regular expression:
 //		::match compare a string to a re, the match must be exact. will return the
 //			length of the match (>=0), or -1 for failed match, and finally -2 for an
-//			internal error (closure stack overflow).
+//			internal error (closure stack overflow). without a re_match_vector this
+//			uses the engine's lazy dfa when it can (see dfa.h), which never backtracks.
 //		::search will walk through the string parameter calling ::match looking for
 //			the string. returns (>=0) for the starting position for a successful
 //			match, or -1 for failed search, and -2 for an error (closure stack overflow).
@@ -28,7 +31,19 @@
 //		operators (that is "A+" will match "aA"), similar to "grep -i" or 
 //		perl "/i"
 //	lower_caseless_compares can be used to "turn off/on" lower caseness in comparisons.
-//		so, "Aa" will match "AA" but not "aa". similar to "grep -y".
+//		so, "Aa" will match "AA" but not "aa". similar to "grep -y". both of these
+//		fold the cases into the compiled code, so set them once rather than
+//		around every match.
+//	linear_matches can be used to "turn off/on" matching without backtracking (a pike
+//		vm); the time is then bounded by the length of the string times the size of
+//		the expression. expressions with backrefs are still backtracked, and so are
+//		ones whose {n,m} counts give the pike vm too many states (the size times each
+//		count's bound past re_program::LIMIT, say (a{1,9}b{1,9}c{1,9}d{1,9}){1,9}).
+//		linear_matches() says if the pike vm is really what's matching. without it
+//		the pike vm is only used when the closure stack overflows.
+//	auto_optimize can be used to "turn off/on" running ::optimize on every compile; it's
+//		on unless it's turned off. the optimized code matches the same things, it's just
+//		shorter (see optimizer.h).
 //
 // implementation notes ---
 //	the implementation is hidden via the rcimpl template. the basic_regular_expression_impl
@@ -36,6 +51,12 @@
 //  inexpensive. a copy_on_write copy will cost a new/copy of the internal runtime
 //  regular expression code.
 // 
+//  everything a match or a search works in (the failure stack, the pike vm's
+//  and re_bitstate's buffers and the rest) is kept for each thread (see
+//  re_engine::match_context); once those have grown to the expression and the
+//  text, matching over and over doesn't go to the allocator, except for a
+//  re_match_vector that has to get bigger.
+//
 //  i've tried to stay away from new'ing memory from any of the member functions; you
 //  shouldn't have to worry about deleting memory some any reference parameter or return
 //  value (instead i'm using std::string's everywhere).
@@ -69,31 +90,50 @@ namespace re {
 			compile(str.data(), str.length());
 		}
 
-		basic_regular_expression(const basic_regular_expression& rhs) : _engine(rhs._engine) {}
+		basic_regular_expression(const basic_regular_expression& rhs)
+			: _engine(rhs._engine), _auto_optimize(rhs._auto_optimize) {}
 
 		virtual ~basic_regular_expression() {}
 
 		const basic_regular_expression& operator = (const basic_regular_expression& rhs) {
 			if ( this != &rhs ) {
 				_engine = rhs._engine;
+				_auto_optimize = rhs._auto_optimize;
 			}
 			return *this;
 		}
 
-		void caseless_compares(bool c) { _engine->caseless_cmps = c; }
+		void caseless_compares(bool c) { _engine->exec_caseless(c, _engine->lower_caseless_wanted); }
+
+		void lower_caseless_compares(bool c) { _engine->exec_caseless(_engine->caseless_wanted, c); }
 
-		void lower_caseless_compares(bool c) { _engine->lower_caseless_cmps = c; }
+		void linear_matches(bool l) { _engine->linear_matching = l; }
+
+		// is it on, and can the pike vm do the compiled code?
+		bool linear_matches() const {
+			return _engine->linear_matching && _engine->program && !_engine->lower_caseless_cmps;
+		}
 
+		// how big the backtracker's failure stack can get, in bytes; a match that
+		// needs more fails with -2.
 		size_t maximum_closure_stack() const { return _engine->maximum_closure_stack; }
 
 		void maximum_closure_stack(size_t mx) { _engine->maximum_closure_stack = mx; }
 
-		int compile(const char_type* s, size_t slen = -1, int* err_pos = 0) {
-			return _engine->exec_compile(s, slen, err_pos);
+		void auto_optimize(bool o) { _auto_optimize = o; }
+
+		// arena is for the compile's scratch, see re_engine::exec_compile.
+		int compile(const char_type* s, size_t slen = -1, int* err_pos = 0,
+		            std::pmr::memory_resource* arena = nullptr) {
+			const int err = _engine->exec_compile(s, slen, err_pos, arena);
+			if (err == 0 && _auto_optimize) {
+				_engine->exec_optimize();
+			}
+			return err;
 		}
 
-		int compile(const string_type& s, int* err_pos = 0) {
-			return _engine->exec_compile(s.data(), s.length(), err_pos);
+		int compile(const string_type& s, int* err_pos = 0, std::pmr::memory_resource* arena = nullptr) {
+			return compile(s.data(), s.length(), err_pos, arena);
 		}
 
 		int optimize() { return _engine->exec_optimize(); }
@@ -109,22 +149,22 @@ namespace re {
 		}
 		
 		int match(const string_type& s, size_t pos = 0, size_t n = -1) const {
-			ctext_type text(s.data(), s.length(), 0, 0, pos, n);
+			ctext_type text(s.data(), s.length(), pos, n);
 			return _engine->exec_match(text);
 		}
 
 		int match(const string_type& s, re_match_vector& m, size_t pos = 0, size_t n = -1) const {
-			ctext_type text(s.data(), s.length(), 0, 0, pos, n);
+			ctext_type text(s.data(), s.length(), pos, n);
 			return _engine->exec_match(text, false, m);
 		}
 
 		int partial_match(const char_type* s, size_t slen = -1, size_t n = -1) const {
-			ctext_type text(s, slen, 0, 0, 0, n);
+			ctext_type text(s, slen, 0, n);
 			return _engine->exec_match(text, true);
 		}
 
 		int partial_match(const string_type& s, size_t pos = 0, size_t n = -1) const {
-			ctext_type text(s.data(), s.length(), 0, 0, pos, n);
+			ctext_type text(s.data(), s.length(), pos, n);
 			return _engine->exec_match(text, true);
 		}
 
@@ -134,17 +174,17 @@ namespace re {
 		}
 
 		int search(const char_type* s, re_match_vector& m, size_t slen = -1, size_t n = -1) const {
-			ctext_type text(s, slen, 0, 0, n);
+			ctext_type text(s, slen, 0, n);
 			return _engine->exec_search(text, 0, m);
 		}
 
 		int search(const string_type& s, size_t pos = 0, size_t n = -1) const {
-			ctext_type text(s.data(), s.length(), 0, 0, pos, n);
+			ctext_type text(s.data(), s.length(), pos, n);
 			return _engine->exec_search(text);
 		}
 
 		int search(const string_type& s, re_match_vector& m, size_t pos = 0, size_t n = -1) const {
-			ctext_type text(s.data(), s.length(), 0, 0, pos, n);
+			ctext_type text(s.data(), s.length(), pos, n);
 			return _engine->exec_search(text, 0, m);
 		}
 
@@ -161,5 +201,6 @@ namespace re {
 
 	private:
 		engine_impl_type	_engine;
+		bool				_auto_optimize = true;
 	};
 }
\ No newline at end of file
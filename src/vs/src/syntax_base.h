@@ -55,14 +55,7 @@ namespace re {
 					cs.prec_stack.start(cs.output.offset());
 				} else if (level < cs.prec_stack.current()) {
 					cs.prec_stack.current(level);
-					while (cs.jump_stack.size()) {
-						if (cs.jump_stack.top() >= cs.prec_stack.start()) {
-							cs.output.put_address(cs.jump_stack.top(), cs.output.offset());
-							cs.jump_stack.pop();
-						} else {
-							break;
-						}
-					}
+					cs.output.close_alternates(cs);
 				}
 
 				if (int err = cs.syntax.compile_opcode(cs)) {
@@ -71,6 +64,7 @@ namespace re {
 				}
 				cs.beginning_context = (cs.op == '(' || cs.op == '|');
 			}
+			cs.output.generate(cs.code);
 			return 0;
 		}
 
@@ -137,27 +131,7 @@ namespace re {
 						break;
 					}
 
-					switch (cs.op) {
-						case '?':
-							cs.output.store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE,
-							                     cs.output.offset() + 3);
-							break;
-
-						case '+':
-						case '*':
-							cs.output.store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE,
-							                     cs.output.offset() + 6);
-							cs.output.store_jump(cs.output.offset(), OP_GOTO,
-							                     cs.prec_stack.start());
-
-							if (cs.op == '+') {
-								// jump over initial failure_jump
-								cs.output.store_jump(cs.prec_stack.start(), OP_FAKE_FAILURE_GOTO,
-								                     cs.prec_stack.start() + 6);
-							}
-							break;
-						default: break;
-					}
+					cs.output.store_repeat(cs.prec_stack.start(), cs.op, false);
 					break;
 
 				case '[':
@@ -176,12 +150,15 @@ namespace re {
 					break;
 
 				case '(':
+					if (cs.next_backref >= MAX_BACKREFS) {
+						return BACKREFERENCE_OVERFLOW;
+					}
 					++cs.number_of_backrefs;
 					++cs.parenthesis_nesting;
 
 					cs.prec_stack.start(cs.output.offset());
 
-					cs.output.store(OP_BACKREF_BEGIN, cs.next_backref);
+					cs.output.store_group_begin(cs.next_backref);
 					cs.backref_stack.push(cs.next_backref++);
 
 					cs.prec_stack.push(re_precedence_element());
@@ -199,7 +176,7 @@ namespace re {
 					cs.prec_stack.pop();
 					cs.prec_stack.current(precedence('('));
 
-					cs.output.store(OP_BACKREF_END, cs.backref_stack.top());
+					cs.output.store_group_end(cs.backref_stack.top());
 					cs.backref_stack.pop();
 					break;
 
@@ -13,6 +13,8 @@ namespace re {
     //  from emacs.
     //	\d matches [0-9]
     //	\D matches [^0-9]
+    //	\A matches at the beginning of the buffer
+    //	\z matches at the end of the buffer
     //	\b matches on a word boundary (between \w and \W)
     //	\B matches on a non-word boundary
     //	\s [ \t\r\n\f]
@@ -28,6 +30,10 @@ namespace re {
     //		+ same as {1,}
     //		? same as {0,1}
     //
+    //	(?>...) is an atomic group: once it has matched, nothing inside it is
+    //		tried again. it isn't a register.
+    //	*+ ++ ?+ are possessive, x*+ is the same as (?>x*).
+    //
     //	\r\f\b\n inherited from awk.
     //	\000 is an octal number, unless the number would match a prior
     //		register.
@@ -100,6 +106,8 @@ namespace re {
 		}
 
 		switch (cs.ch) {
+			case 'A':
+			case 'z':
 			case 'b':
 			case 'B':
 			case 'd':
@@ -155,64 +163,48 @@ namespace re {
 					typename traitsT::int_type t;
 					cs.input.get(t); // consume the '?'
 
-					switch (cs.op) {
-						case '?':
-							cs.output.store_jump(cs.prec_stack.start(), OP_GOTO,
-							                     cs.output.offset() + 3);
-							cs.output.store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE,
-							                     cs.prec_stack.start() + 6);
-							break;
-
-						case '*':
-							cs.output.store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE,
-							                     cs.output.offset() + 6);
-							cs.output.store_jump(cs.output.offset(), OP_PUSH_FAILURE,
-							                     cs.prec_stack.start());
-							cs.output.store_jump(cs.prec_stack.start(), OP_FAKE_FAILURE_GOTO,
-							                     cs.output.offset());
-							break;
-
-						case '+':
-							cs.output.store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE,
-							                     cs.output.offset() + 6);
-							cs.output.store_jump(cs.output.offset(), OP_PUSH_FAILURE,
-							                     cs.prec_stack.start());
-							cs.output.store_jump(cs.prec_stack.start(), OP_FAKE_FAILURE_GOTO,
-							                     cs.prec_stack.start() + 6);
-							break;
-					}
+					cs.output.store_repeat(cs.prec_stack.start(), cs.op, true);
 				} else {
 					// greedy versions
-					switch (cs.op) {
-						case '?':
-							cs.output.store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE,
-							                     cs.output.offset() + 3);
-							break;
-
-						case '+':
-						case '*':
-							cs.output.store_jump(cs.prec_stack.start(), OP_PUSH_FAILURE,
-							                     cs.output.offset() + 6);
-							cs.output.store_jump(cs.output.offset(), OP_GOTO,
-							                     cs.prec_stack.start());
-
-							if (cs.op == '+') {
-								// jump over initial failure_jump
-								cs.output.store_jump(cs.prec_stack.start(), OP_FAKE_FAILURE_GOTO,
-								                     cs.prec_stack.start() + 6);
-							}
-							break;
+					const int start = cs.prec_stack.start();
+					cs.output.store_repeat(start, cs.op, false);
+					if (!cs.input.at_end() && cs.input.peek() == '+') {
+						// possessive versions
+						typename traitsT::int_type t;
+						cs.input.get(t); // consume the '+'
+						cs.output.store_atomic(start);
 					}
 				}
 				break;
 
 			case '(':
+				if (!cs.input.at_end() && cs.input.peek() == '?') {
+					typename traitsT::int_type t;
+					cs.input.get(t);
+					if (!cs.input.at_end() && cs.input.peek() == '>') {
+						// an atomic group; 0 on the backref stack says so.
+						cs.input.get(t);
+						++cs.parenthesis_nesting;
+						cs.prec_stack.start(cs.output.offset());
+						cs.output.store_group_begin(0);
+						cs.backref_stack.push(0);
+
+						cs.prec_stack.push(re_precedence_element());
+						cs.prec_stack.current(0);
+						cs.prec_stack.start(cs.output.offset());
+						break;
+					}
+					cs.input.unget();
+				}
+				if (cs.next_backref >= MAX_BACKREFS) {
+					return BACKREFERENCE_OVERFLOW;
+				}
 				++cs.number_of_backrefs;
 				++cs.parenthesis_nesting;
 
 				cs.prec_stack.start(cs.output.offset());
 
-				cs.output.store(OP_BACKREF_BEGIN, cs.next_backref);
+				cs.output.store_group_begin(cs.next_backref);
 				cs.backref_stack.push(cs.next_backref++);
 
 				cs.prec_stack.push(re_precedence_element());
@@ -230,7 +222,7 @@ namespace re {
 				cs.prec_stack.pop();
 				cs.prec_stack.current(precedence('('));
 
-				cs.output.store(OP_BACKREF_END, cs.backref_stack.top());
+				cs.output.store_group_end(cs.backref_stack.top());
 				cs.backref_stack.pop();
 				break;
 
@@ -246,6 +238,14 @@ namespace re {
 				return cs.output.store_closure(cs);
 				break;
 
+			case 'A':
+				cs.prec_stack.start(cs.output.store(OP_BEGIN_OF_BUFFER));
+				break;
+
+			case 'z':
+				cs.prec_stack.start(cs.output.store(OP_END_OF_BUFFER));
+				break;
+
 			case 'b':
 				//cs.output.store(OP_WORD_BOUNDARY, 0, cs.prec_stack);
 					cs.prec_stack.start(cs.output.store(OP_WORD_BOUNDARY, 0));
@@ -257,27 +257,27 @@ namespace re {
 				break;
 
 			case 'd':
-				cs.output.store(OP_DIGIT, 0);
+				cs.prec_stack.start(cs.output.store(OP_DIGIT, 0));
 				break;
 
 			case 'D':
-				cs.output.store(OP_DIGIT, 1);
+				cs.prec_stack.start(cs.output.store(OP_DIGIT, 1));
 				break;
 
 			case 's':
-				cs.output.store(OP_SPACE, 0);
+				cs.prec_stack.start(cs.output.store(OP_SPACE, 0));
 				break;
 
 			case 'S':
-				cs.output.store(OP_SPACE, 1);
+				cs.prec_stack.start(cs.output.store(OP_SPACE, 1));
 				break;
 
 			case 'w':
-				cs.output.store(OP_WORD, 0);
+				cs.prec_stack.start(cs.output.store(OP_WORD, 0));
 				break;
 
 			case 'W':
-				cs.output.store(OP_WORD, 1);
+				cs.prec_stack.start(cs.output.store(OP_WORD, 1));
 				break;
 
 			default:
@@ -67,6 +67,15 @@ namespace re {
 		OP_NO_CASELESS,		// turn off caseless compares
 		OP_LCASELESS,		// turn on lower caseless compares
 		OP_NO_LCASELESS,	// turn off lower caseless compares
+
+		OP_ATOMIC_BEGIN,	// an atomic group (?>...) starts; marks the failure stack.
+		OP_ATOMIC_END,		// drops the failure points pushed since its OP_ATOMIC_BEGIN.
+
+		OP_REPEAT,			// a greedy loop of one character test (only in linked code).
+
+		OP_CLASS,			// match a character class (a bitmap follows, see store_class).
+		OP_NOT_CLASS,		// a negated OP_CLASS (the bitmap's already negated).
+		OP_RANGE_CLASS,		// OP_CLASS for wide characters, with ranges and \d\s\w flags.
 	};
 
     constexpr int SYNTAX_ERROR = -1;
@@ -126,6 +135,12 @@ namespace re {
         case OP_NO_CASELESS: return "OP_NO_CASELESS";
         case OP_LCASELESS: return "OP_LCASELESS";
         case OP_NO_LCASELESS: return "OP_NO_LCASELESS";
+        case OP_ATOMIC_BEGIN: return "OP_ATOMIC_BEGIN";
+        case OP_ATOMIC_END: return "OP_ATOMIC_END";
+        case OP_REPEAT: return "OP_REPEAT";
+        case OP_CLASS: return "OP_CLASS";
+        case OP_NOT_CLASS: return "OP_NOT_CLASS";
+        case OP_RANGE_CLASS: return "OP_RANGE_CLASS";
         default: return "UNKNOWN_OPCODE";
     }
 }
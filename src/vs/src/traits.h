@@ -3,8 +3,11 @@
 #include <locale>
 #include <cstring>
 #include <cwchar>
+#include <cstdint>
 #include <string>
 #include <string_view>
+#include <algorithm>
+#include <functional>
 
 template<class T>
 struct re_char_traits : std::char_traits<T> {
@@ -90,6 +93,36 @@ struct re_char_traits<char> : std::char_traits<char> {
         return (t) ? (t - s1) : -1;
     }
 
+    // first c in s[0..n), memchr is vectorized by every libc worth using.
+    static const char_type* find_char(const char_type* s, size_t n, const char_type c) {
+        return static_cast<const char_type*>(std::memchr(s, c, n));
+    }
+
+    // first occurrence of lit[0..m) in s[0..n); memmem is a two-way search in glibc.
+    static const char_type* find_literal(const char_type* s, size_t n, const char_type* lit, size_t m) {
+#if defined(__GLIBC__) || defined(__APPLE__)
+        return static_cast<const char_type*>(::memmem(s, n, lit, m));
+#else
+        const char_type* t = std::search(s, s + n, std::boyer_moore_horspool_searcher(lit, lit + m));
+        return (t == s + n && m != 0) ? nullptr : t;
+#endif
+    }
+
+    // rough guess at how common a character is in text, smaller is rarer. used to
+    // pick which character of a literal to hand to find_char.
+    static int frequency(const int_type c) {
+        const unsigned char u = static_cast<unsigned char>(c);
+        if (u == 0) return 1;
+        if (u == ' ') return 8;
+        if (std::strchr("etaoinsrhl", u)) return 7;
+        if (std::islower(u)) return 5;
+        if (std::isdigit(u)) return 4;
+        if (u == '\n' || u == '\t' || std::strchr(".,:;=/-_\"'()", u)) return 3;
+        if (std::isupper(u)) return 2;
+        if (u < 0x80) return 1;
+        return 0;
+    }
+
     static int check(const char_type* s, size_t& n) {
         if (n == static_cast<size_t>(-1)) {
             n = (s) ? length(s) : 0;
@@ -173,6 +206,19 @@ struct re_char_traits<wchar_t> : public std::char_traits<wchar_t> {
         return (t) ? (t - s1) : -1;
     }
 
+    static const char_type* find_char(const char_type* s, size_t n, const char_type c) {
+        return std::wmemchr(s, c, n);
+    }
+
+    static const char_type* find_literal(const char_type* s, size_t n, const char_type* lit, size_t m) {
+        const char_type* t = std::search(s, s + n, std::boyer_moore_horspool_searcher(lit, lit + m));
+        return (t == s + n && m != 0) ? nullptr : t;
+    }
+
+    static int frequency(const int_type c) {
+        return (c < 0x80) ? re_char_traits<char>::frequency(c) : 0;
+    }
+
     static int check(const char_type* s, size_t& n) {
         if (n == static_cast<size_t>(-1)) {
             n = (s) ? length(s) : 0;
@@ -180,3 +226,11 @@ struct re_char_traits<wchar_t> : public std::char_traits<wchar_t> {
         return n;
     }
 };
+
+// the same, with 32 bit code words instead of characters (see code_word in
+// code.h); jumps and counts are 32 bits, for expressions too big for the 16 bit
+// ones. the compiled code is two to four times the size.
+template<class T>
+struct re_wide_code_traits : re_char_traits<T> {
+    typedef int32_t code_type;
+};
@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include "traits.h"
+#include "engine.h"
+#include "syntax_grep.h"
+#include "syntax_perl.h"
+#include "regexp.h"
+
+using ct = re_char_traits<char>;
+using ast_t = re::re_ast<ct>;
+using code_vector_t = re::compiled_code_vector<ct>;
+
+namespace re {
+    // compiles pattern with a syntax, and keeps what the syntax built.
+    template<class syntaxT>
+    struct parsed {
+        syntaxT syntax;
+        std::string pattern;
+        input_string<ct> input;
+        code_vector_t code;
+        compile_state<ct> cs;
+        int result;
+
+        explicit parsed(const std::string &p)
+            : pattern(p), input(pattern.c_str(), pattern.size()), cs(syntax, code, input) {
+            result = syntax.compile(cs);
+        }
+
+        const ast_t &ast() const { return cs.output; }
+
+        const ast_t::node &top(const int i) const { return ast()[ast().top()[i]]; }
+
+        const ast_t::node &child(const ast_t::node &n, const int i) const { return ast()[ast().children(n)[i]]; }
+    };
+
+    using perl = parsed<syntax_perl<ct> >;
+
+    TEST(re_ast, Leaves) {
+        const perl p("abc");
+        ASSERT_EQ(p.result, 0);
+        ASSERT_EQ(p.ast().top().size(), 1);
+        ASSERT_EQ(p.top(0).kind, ast_t::CODE);
+        ASSERT_EQ(p.top(0).count, 7);
+        ASSERT_EQ(std::vector<char>(p.ast().words(p.top(0)), p.ast().words(p.top(0)) + 7),
+                  std::vector<char>({OP_CHAR, 'a', OP_CHAR, 'b', OP_CHAR, 'c', OP_END}));
+        ASSERT_EQ(p.code.offset(), 7);
+    }
+
+    TEST(re_ast, Repeats) {
+        const perl p("a(bc)*?d");
+        ASSERT_EQ(p.result, 0);
+        ASSERT_EQ(p.ast().top().size(), 3);
+        ASSERT_EQ(p.top(0).kind, ast_t::CODE);
+        ASSERT_EQ(p.top(2).kind, ast_t::CODE);
+
+        // the repeat's jumps are leaves around the group.
+        const auto &repeat = p.top(1);
+        ASSERT_EQ(repeat.kind, ast_t::REPEAT);
+        ASSERT_EQ(repeat.arg, '*');
+        ASSERT_EQ(repeat.arg2, 1);
+        ASSERT_EQ(repeat.count, 3);
+        ASSERT_EQ(repeat.size, 6 + 8 + 3);
+        ASSERT_EQ(p.child(repeat, 0).kind, ast_t::CODE);
+        ASSERT_EQ(p.child(repeat, 0).count, 6);
+        ASSERT_EQ(p.child(repeat, 2).count, 3);
+
+        const auto &group = p.child(repeat, 1);
+        ASSERT_EQ(group.kind, ast_t::GROUP);
+        ASSERT_EQ(group.arg, 1);
+        ASSERT_EQ(group.count, 3);
+        ASSERT_EQ(*p.ast().words(p.child(group, 0)), OP_BACKREF_BEGIN);
+        ASSERT_EQ(p.child(group, 1).count, 4);
+        ASSERT_EQ(*p.ast().words(p.child(group, 2)), OP_BACKREF_END);
+    }
+
+    TEST(re_ast, Alternates) {
+        const perl p("ab|cd|ef");
+        ASSERT_EQ(p.result, 0);
+        ASSERT_EQ(p.ast().top().size(), 2);
+        const auto &alternate = p.top(0);
+        ASSERT_EQ(alternate.kind, ast_t::ALTERNATE);
+        ASSERT_EQ(alternate.count, 3);
+        ASSERT_EQ(p.child(alternate, 0).kind, ast_t::BRANCH);
+        ASSERT_EQ(p.child(alternate, 0).arg, OP_GOTO);
+        ASSERT_EQ(p.child(alternate, 1).kind, ast_t::BRANCH);
+        ASSERT_EQ(p.child(alternate, 2).kind, ast_t::CODE);
+        ASSERT_EQ(alternate.size, 2 * (3 + 4 + 3) + 4);
+
+        // both gotos go past the last alternative.
+        for (int i = 0; i < 2; i++) {
+            const auto &branch = p.child(alternate, i);
+            const char *cp = p.ast().words(p.child(branch, 2)) + 1;
+            const int at = (i + 1) * 10 - 2;
+            ASSERT_EQ(at + 2 + code_vector_t::decode_address_and_advance(cp), alternate.size);
+        }
+    }
+
+    TEST(re_ast, ClassAlternates) {
+        // a class doesn't know \W, it stores nothing for it; that's no
+        // bitmap, so the class is a failure point for each member (and an
+        // empty one last).
+        const perl p("[ab\\W]");
+        ASSERT_EQ(p.result, 0);
+        const auto &alternate = p.top(0);
+        ASSERT_EQ(alternate.kind, ast_t::ALTERNATE);
+        ASSERT_EQ(alternate.count, 2);
+        ASSERT_EQ(p.child(alternate, 1).kind, ast_t::BRANCH);
+        ASSERT_EQ(p.child(alternate, 0).arg, OP_POP_FAILURE_GOTO);
+
+        // and a class that can is one leaf.
+        const perl bitmap("[abc]x");
+        ASSERT_EQ(bitmap.ast().top().size(), 1);
+        ASSERT_EQ(*bitmap.ast().words(bitmap.top(0)), OP_CLASS);
+        ASSERT_EQ(bitmap.top(0).count, 1 + code_vector_t::CLASS_BITMAP + 3);
+    }
+
+    TEST(re_ast, Closures) {
+        const perl p("a(x|y){2,3}");
+        ASSERT_EQ(p.result, 0);
+        const auto &closure = p.top(1);
+        ASSERT_EQ(closure.kind, ast_t::CLOSURE);
+        ASSERT_EQ(closure.arg, 2);
+        ASSERT_EQ(closure.arg2, 3);
+        ASSERT_EQ(p.child(closure, 1).kind, ast_t::GROUP);
+        ASSERT_EQ(p.child(closure, 1).size + 18, closure.size);
+        ASSERT_EQ(p.ast().closures(), 1);
+        ASSERT_EQ(p.code.closures(), 1);
+    }
+
+    TEST(re_ast, Possessive) {
+        const perl p("a*+b");
+        ASSERT_EQ(p.result, 0);
+        const auto &atomic = p.top(0);
+        ASSERT_EQ(atomic.kind, ast_t::GROUP);
+        ASSERT_EQ(atomic.arg, 0);
+        ASSERT_EQ(p.child(atomic, 1).kind, ast_t::REPEAT);
+    }
+
+    TEST(re_ast, Grep) {
+        const parsed<syntax_grep<ct> > p("\\(ab\\)*c");
+        ASSERT_EQ(p.result, 0);
+        ASSERT_EQ(p.top(0).kind, ast_t::REPEAT);
+        ASSERT_EQ(p.child(p.top(0), 1).kind, ast_t::GROUP);
+    }
+
+    TEST(re_ast, Generate) {
+        // the code is laid out at the offsets the nodes were built with.
+        const perl p("x(a|bc)+?[^a-c]{1,}(?>y?)z$");
+        ASSERT_EQ(p.result, 0);
+        int offset = 0;
+        for (const int n: p.ast().top()) {
+            offset += p.ast()[n].size;
+        }
+        ASSERT_EQ(offset, p.ast().offset());
+        ASSERT_EQ(p.code.offset(), p.ast().offset());
+
+        basic_regular_expression<syntax_perl<ct> > re(p.pattern.c_str());
+        ASSERT_EQ(re.match("xbcaz"), -1);
+        ASSERT_EQ(re.match("xbcadyz"), 7);
+        ASSERT_EQ(re.match("xadz"), 4);
+    }
+
+    TEST(re_ast, Arena) {
+        // arena_size() is all the scratch a compile takes; there's nothing
+        // behind the buffer to go back to for more.
+        const std::string pattern = "^GET /api/v[0-9]+/(users|groups)/(\\d+)(\\.json)?$";
+        const input_string<ct> in(pattern.c_str(), pattern.size());
+        std::vector<std::byte> buffer(compile_state<ct>::arena_size(in));
+        std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+
+        re_engine<syntax_perl<ct> > engine, plain;
+        ASSERT_EQ(engine.exec_compile(pattern.c_str(), pattern.size(), nullptr, &arena), 0);
+        ASSERT_EQ(plain.exec_compile(pattern.c_str(), pattern.size()), 0);
+        ASSERT_EQ(std::vector<char>(engine.code.code(), engine.code.code() + engine.code.offset()),
+                  std::vector<char>(plain.code.code(), plain.code.code() + plain.code.offset()));
+
+        // a monotonic buffer doesn't give anything back, the next compile
+        // gets one of its own.
+        std::vector<std::byte> more(buffer.size());
+        std::pmr::monotonic_buffer_resource next(more.data(), more.size(), std::pmr::null_memory_resource());
+        basic_regular_expression<syntax_perl<ct> > re;
+        ASSERT_EQ(re.compile(pattern, nullptr, &next), 0);
+        ASSERT_EQ(re.match("GET /api/v2/groups/17.json"), 26);
+    }
+
+    TEST(re_ast, DeepNesting) {
+        // every * wraps everything in front of it; that used to move it all.
+        std::string pattern;
+        constexpr int depth = 2000;
+        for (int i = 0; i < depth; i++) {
+            pattern += "(?>a";
+        }
+        for (int i = 0; i < depth; i++) {
+            pattern += ")*";
+        }
+        const perl p(pattern);
+        ASSERT_EQ(p.result, 0);
+        ASSERT_EQ(p.code.offset(), depth * 10 + 1);
+        ASSERT_FALSE(p.code.too_long());
+    }
+}
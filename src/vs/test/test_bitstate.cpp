@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include "traits.h"
+#include "engine.h"
+#include "program.h"
+#include "bitstate.h"
+#include "syntax_perl.h"
+#include "test_compiled.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using program_t = re::re_program<ct>;
+using bitstate_t = re::re_bitstate<ct>;
+
+namespace re {
+    static std::vector<int> bitstate_slots(const char *pattern, int groups, const std::string &text,
+                                           bool search = false) {
+        const auto engine = compiled(pattern);
+        const program_t program(engine.code, groups);
+        const bitstate_t bitstate(program);
+        EXPECT_TRUE(bitstate.fits(0, text.size()));
+        std::vector<int> slots;
+        const int n = text.size();
+        if (bitstate.exec(text.c_str(), 0, search ? n : 0, n, false, slots) == bitstate_t::NO_MATCH) {
+            slots.clear();
+        }
+        return slots;
+    }
+
+    TEST(re_bitstate, Groups) {
+        ASSERT_EQ(bitstate_slots("(a|ab)(c|bcd)", 2, "abcd"), std::vector<int>({0, 4, 0, 1, 1, 4}));
+        ASSERT_EQ(bitstate_slots("(ab)+", 1, "ababa"), std::vector<int>({0, 4, 2, 4}));
+        ASSERT_EQ(bitstate_slots("(a){2}b", 1, "aab"), std::vector<int>({0, 3, 1, 2}));
+        ASSERT_EQ(bitstate_slots("b+|ab", 0, "xabb", true), std::vector<int>({1, 3}));
+    }
+
+    TEST(re_bitstate, Fits) {
+        const auto engine = compiled("a+b");
+        const program_t program(engine.code, 0);
+        const bitstate_t bitstate(program);
+        ASSERT_TRUE(bitstate.fits(0, 4096));
+        ASSERT_FALSE(bitstate.fits(0, 1 << 24));
+    }
+
+    TEST(re_bitstate, Buffers) {
+        // the bitset's kept from one exec to the next; what the last one
+        // marked has to be gone, and only that much is cleared.
+        const auto engine = compiled("(x+x+)+y");
+        const program_t program(engine.code, 1);
+        const bitstate_t bitstate(program);
+        bitstate_t::buffers work;
+        std::vector<int> slots;
+        const std::string text(200, 'x');
+        ASSERT_EQ(bitstate.exec(text.c_str(), 0, 0, text.size(), false, work, slots), bitstate_t::NO_MATCH);
+        const size_t grown = work.visited.size();
+        ASSERT_GT(work.used, 0u);
+
+        ASSERT_EQ(bitstate.exec("xxy", 0, 0, 3, false, work, slots), 0);
+        ASSERT_EQ(slots, std::vector<int>({0, 3, 0, 2}));
+        ASSERT_LT(work.used, grown);
+        ASSERT_EQ(bitstate.exec(text.c_str(), 0, 0, text.size(), false, work, slots), bitstate_t::NO_MATCH);
+        ASSERT_EQ(work.visited.size(), grown);
+        ASSERT_EQ(bitstate.exec("xxxy", 0, 0, 4, false, work, slots), 0);
+        ASSERT_EQ(slots, std::vector<int>({0, 4, 0, 3}));
+    }
+
+    TEST(re_bitstate, Pathological) {
+        // the same failures over and over for exec_match's backtracking.
+        const std::string text(3000, 'x');
+        EXPECT_EQ(bitstate_slots("(x+x+)+y", 1, text), std::vector<int>());
+        EXPECT_EQ(bitstate_slots("(x+x+)+y", 1, text, true), std::vector<int>());
+
+        re_engine_t engine = compiled("(x+x+)+y");
+        re_match_vector matches;
+        ctext<ct> t(text.c_str(), text.size());
+        ASSERT_EQ(engine.exec_search(t, 0, matches), -1);
+        const std::string found = text + "y";
+        ctext<ct> u(found.c_str(), found.size());
+        ASSERT_EQ(engine.exec_match(u, false, matches), 3001);
+    }
+
+    TEST(re_bitstate, TooManyKeys) {
+        // the counts make too many keys for a bitset over even a short text;
+        // the pike vm does it then, backtracking this would never finish.
+        re_engine_t engine = compiled("(a{0,9}a{0,9}){1,9}b");
+        const program_t program(engine.code, 1);
+        const bitstate_t bitstate(program);
+        const std::string text(160, 'a');
+        ASSERT_TRUE(program.valid());
+        ASSERT_FALSE(bitstate.fits(0, text.size()));
+
+        re_match_vector matches;
+        ctext<ct> t(text.c_str(), text.size());
+        ASSERT_EQ(engine.exec_match(t, false, matches), -1);
+        const std::string found = std::string(30, 'a') + "b";
+        ctext<ct> u(found.c_str(), found.size());
+        ASSERT_EQ(engine.exec_match(u, false, matches), 31);
+        ASSERT_EQ(matches[0], re_match_type(0, 31));
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include "traits.h"
+#include "engine.h"
+#include "code_graph.h"
+#include "syntax_perl.h"
+#include "test_compiled.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using code_graph_t = re::code_graph<ct>;
+
+namespace re {
+    TEST(code_graph, OneNodePerInstruction) {
+        const auto engine = compiled("ab");
+        const code_graph_t graph(engine.code);
+        ASSERT_TRUE(graph.valid());
+        ASSERT_EQ(graph.size(), 3);
+        ASSERT_EQ(graph.offset(1), 2);
+        ASSERT_EQ(graph.node(2), 1);
+        ASSERT_EQ(graph.node(3), -1);
+        ASSERT_EQ(graph.op(2), OP_END);
+        ASSERT_EQ(graph.end(), 2);
+    }
+
+    TEST(code_graph, FailurePointsAreEdges) {
+        // 0 OP_PUSH_FAILURE, 3 OP_CHAR a, 5 OP_GOTO, 8 OP_CHAR b, 10 OP_END
+        const auto engine = compiled("a|b");
+        const code_graph_t graph(engine.code);
+        ASSERT_TRUE(graph.valid());
+        ASSERT_EQ(graph.successors(0).size(), 2u);
+        ASSERT_EQ(graph.predecessors(graph.end()).size(), 2u);
+    }
+
+    TEST(code_graph, Dominators) {
+        const auto engine = compiled("x(a|b)y");
+        const code_graph_t graph(engine.code);
+        const auto idom = graph.dominators();
+        ASSERT_EQ(idom[0], 0);
+
+        // x and y are on every path to the end, a and b aren't.
+        std::vector<int> chain;
+        for (int n = graph.end(); n != 0; n = idom[n]) {
+            chain.push_back(graph.op(n) == OP_CHAR ? graph.code(n)[1] : 0);
+        }
+        ASSERT_NE(std::find(chain.begin(), chain.end(), 'y'), chain.end());
+        ASSERT_EQ(std::find(chain.begin(), chain.end(), 'a'), chain.end());
+        ASSERT_EQ(std::find(chain.begin(), chain.end(), 'b'), chain.end());
+    }
+
+    TEST(code_graph, Distances) {
+        const auto engine = compiled("x?ab*c");
+        const code_graph_t graph(engine.code);
+        int a = -1, c = -1;
+        for (int n = 0; n < graph.size(); n++) {
+            if (graph.op(n) == OP_CHAR && graph.code(n)[1] == 'a') a = n;
+            if (graph.op(n) == OP_CHAR && graph.code(n)[1] == 'c') c = n;
+        }
+        ASSERT_EQ(graph.min_distance(a), 0);
+        ASSERT_EQ(graph.max_distance(a), 1);
+        ASSERT_EQ(graph.min_distance(c), 1);
+        ASSERT_EQ(graph.max_distance(c), code_graph_t::UNBOUNDED);
+    }
+
+    TEST(code_graph, NegatedClassIsOneNode) {
+        const auto engine = compiled("[^ab]x");
+        const code_graph_t graph(engine.code);
+        ASSERT_EQ(graph.op(0), OP_NOT_CLASS);
+        ASSERT_EQ(graph.consumes(0), 1);
+        ASSERT_EQ(graph.successors(0).size(), 1u);
+        ASSERT_EQ(code_graph_t::char_test(graph.code(0), 'c'), 1);
+        ASSERT_EQ(code_graph_t::char_test(graph.code(0), 'b'), 0);
+
+        // the old way, that store_class still uses for what it can't put in
+        // a bitmap.
+        compiled_code_vector<ct> code;
+        code.store(OP_PUSH_FAILURE2);
+        code.store(0);
+        code.store(0);
+        code.put_address(1, 10);
+        code.store(OP_NOT_CHAR, 'a');
+        code.store(OP_BACKUP);
+        code.store(OP_NOT_CHAR, 'b');
+        code.store(OP_BACKUP);
+        code.store(OP_FORWARD);
+        code.store(OP_POP_FAILURE);
+        code.store(OP_CHAR, 'x');
+        code.store(OP_END);
+        const code_graph_t old(code);
+        ASSERT_TRUE(old.valid());
+        ASSERT_EQ(old.consumes(0), 1);
+        ASSERT_EQ(old.successors(0).size(), 1u);
+        ASSERT_FALSE(old.reachable(1));
+        ASSERT_EQ(code_graph_t::char_test(old.code(0), 'c'), 1);
+    }
+
+    TEST(code_graph, Reverse) {
+        // everything in front of the "c", backwards: b then a.
+        const auto engine = compiled("abc");
+        const code_graph_t graph(engine.code);
+        compiled_code_vector<ct> reversed;
+        ASSERT_TRUE(graph.reverse(2, reversed));
+        ASSERT_EQ(reversed.offset(), 5);
+        ASSERT_EQ(reversed[0], OP_CHAR);
+        ASSERT_EQ(reversed[1], 'b');
+        ASSERT_EQ(reversed[2], OP_CHAR);
+        ASSERT_EQ(reversed[3], 'a');
+        ASSERT_EQ(reversed[4], OP_END);
+    }
+
+    TEST(code_graph, ReverseLoop) {
+        const auto engine = compiled("a*b");
+        const code_graph_t graph(engine.code);
+        const int b = graph.end() - 1;
+        ASSERT_EQ(graph.op(b), OP_CHAR);
+        compiled_code_vector<ct> reversed;
+        ASSERT_TRUE(graph.reverse(b, reversed));
+        ASSERT_EQ(reversed[reversed.offset() - 1], OP_END);
+
+        // counted closures can't be run backwards.
+        const auto counted = compiled("a{2}b");
+        const code_graph_t counted_graph(counted.code);
+        compiled_code_vector<ct> unused;
+        ASSERT_FALSE(counted_graph.reverse(counted_graph.end() - 1, unused));
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <vector>
 #include <algorithm>
+#include <cwctype>
 #include "traits.h"
 #include "compile.h"
 #include "code.h"
@@ -8,6 +9,7 @@
 
 using ct = re_char_traits<char>;
 using test_code_vector = re::compiled_code_vector<ct>;
+using wide_code_vector = re::compiled_code_vector<re_wide_code_traits<char> >;
 
 namespace re {
 
@@ -58,6 +60,72 @@ namespace re {
         }
     }
 
+    TEST(CompiledCodeVectorTest, DecodeAddress) {
+        // the low code word isn't sign extended.
+        for (int addr: {200, 300, 32000, -200, -30000}) {
+            test_code_vector code_vector;
+            code_vector.store(OP_GOTO);
+            code_vector.store(0);
+            code_vector.store(0);
+            code_vector.put_address(1, addr + 3);
+            const char *cp = code_vector.code() + 1;
+            EXPECT_EQ(test_code_vector::decode_address_and_advance(cp), addr);
+            EXPECT_FALSE(code_vector.too_long());
+        }
+    }
+
+    TEST(CompiledCodeVectorTest, AddressTooLong) {
+        test_code_vector code_vector;
+        code_vector.store(OP_GOTO);
+        code_vector.store(0);
+        code_vector.store(0);
+        code_vector.put_address(1, 40000);
+        EXPECT_TRUE(code_vector.too_long());
+    }
+
+    TEST(CompiledCodeVectorTest, WideAddress) {
+        for (int addr: {200, 40000, 1 << 24, -(1 << 24)}) {
+            wide_code_vector code_vector;
+            code_vector.store(OP_GOTO);
+            code_vector.store(0);
+            code_vector.store(0);
+            code_vector.put_address(1, addr + 3);
+            const int32_t *cp = code_vector.code() + 1;
+            EXPECT_EQ(wide_code_vector::decode_address_and_advance(cp), addr);
+            EXPECT_FALSE(code_vector.too_long());
+        }
+    }
+
+    TEST(CompiledCodeVectorTest, ClassMember) {
+        test_code_vector code_vector;
+        code_vector.store(OP_CLASS);
+        for (int i = 0; i < test_code_vector::CLASS_BITMAP; i++) {
+            code_vector.store(0);
+        }
+        code_vector[1 + 'b' / 8] = static_cast<char>(1 << ('b' % 8));
+        code_vector[1 + 0xe9 / 8] = static_cast<char>(1 << (0xe9 % 8));
+        EXPECT_EQ(test_code_vector::class_length(code_vector.code()), 33);
+        EXPECT_TRUE(test_code_vector::class_member(code_vector.code(), 'b'));
+        EXPECT_FALSE(test_code_vector::class_member(code_vector.code(), 'c'));
+        EXPECT_TRUE(test_code_vector::class_member(code_vector.code(), static_cast<char>(0xe9)));
+    }
+
+    TEST(CompiledCodeVectorTest, RangeClassMember) {
+        // wide characters past the bitmap are in the ranges, or the flags.
+        using wchar_code_vector = compiled_code_vector<re_char_traits<wchar_t> >;
+        std::vector<wchar_t> code = {OP_RANGE_CLASS, 1, 0, wchar_code_vector::CLASS_SPACE};
+        code.insert(code.end(), wchar_code_vector::CLASS_BITMAP, 0);
+        code[4 + 'a' / 16] = 1 << ('a' % 16);
+        code.push_back(0x100);
+        code.push_back(0x17f);
+        ASSERT_EQ(wchar_code_vector::class_length(code.data()), static_cast<int>(code.size()));
+        EXPECT_TRUE(wchar_code_vector::class_member(code.data(), L'a'));
+        EXPECT_FALSE(wchar_code_vector::class_member(code.data(), L'b'));
+        EXPECT_TRUE(wchar_code_vector::class_member(code.data(), 0x150));
+        EXPECT_FALSE(wchar_code_vector::class_member(code.data(), 0x180));
+        EXPECT_EQ(wchar_code_vector::class_member(code.data(), 0x3000), std::iswspace(0x3000) != 0);
+    }
+
 } // namespace re
 
 int main(int argc, char **argv) {
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include "traits.h"
+#include "engine.h"
+#include "syntax_perl.h"
+
+namespace re {
+    // pattern compiled with the perl syntax, for the tests of what gets built
+    // from an engine's code.
+    inline re_engine<syntax_perl<re_char_traits<char> > > compiled(const char *pattern) {
+        re_engine<syntax_perl<re_char_traits<char> > > engine;
+        EXPECT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+        return engine;
+    }
+}
@@ -54,6 +54,26 @@ TEST(ctext, Position) {
     ASSERT_EQ(ctext.position(), 5);
 }
 
+TEST(ctext, Backward) {
+    auto str1 = "Hello";
+    test_ctext ctext(str1, -1);
+    ctext.start(4);
+    ctext.backward(true, 2);
+    int ch = 0;
+    ASSERT_EQ(ctext.next(ch), 0);
+    ASSERT_EQ(ch, 'l');
+    ASSERT_EQ(ctext.next(ch), 0);
+    ASSERT_EQ(ch, 'l');
+    ASSERT_EQ(ctext.position(), 2);
+    ASSERT_EQ(ctext.next(ch), 1);
+    ctext.unget(ch);
+    ASSERT_EQ(ch, 'l');
+    ASSERT_EQ(ctext.position(), 3);
+    ctext.backward(false);
+    ASSERT_EQ(ctext.next(ch), 0);
+    ASSERT_EQ(ch, 'l');
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
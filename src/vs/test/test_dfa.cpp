@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include "traits.h"
+#include "engine.h"
+#include "dfa.h"
+#include "syntax_perl.h"
+#include "test_compiled.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using dfa_t = re::re_dfa<ct>;
+
+namespace re {
+    // where the match starting at 0 ends, from the dfa.
+    static int dfa_match(const char *pattern, const char *text) {
+        const auto engine = compiled(pattern);
+        dfa_t dfa(engine.code, false);
+        EXPECT_TRUE(dfa.valid());
+        return dfa.exec(text, 0, strlen(text));
+    }
+
+    // the same, from exec_match with the match vector (so no dfa).
+    static int backtrack_match(const char *pattern, const char *text) {
+        const auto engine = compiled(pattern);
+        ctext<ct> t(text, strlen(text));
+        re_match_vector matches;
+        return engine.exec_match(t, false, matches);
+    }
+
+    TEST(re_dfa, Literal) {
+        ASSERT_EQ(dfa_match("abc", "abcd"), 3);
+        ASSERT_EQ(dfa_match("abc", "abd"), dfa_t::NO_MATCH);
+    }
+
+    TEST(re_dfa, LeftmostFirst) {
+        // the same match exec_match finds, not the longest one.
+        const char *patterns[] = {"a|ab", "ab|a", "a*", "a*?", "(a|ab)(c|bcd)", "a+b?", "[a-c]+?c", "x?"};
+        const char *text = "abcd";
+        for (const char *p: patterns) {
+            ASSERT_EQ(dfa_match(p, "aabcd"), backtrack_match(p, "aabcd")) << p;
+            ASSERT_EQ(dfa_match(p, text), backtrack_match(p, text)) << p;
+        }
+    }
+
+    TEST(re_dfa, Anchors) {
+        ASSERT_EQ(dfa_match("^ab$", "ab"), 2);
+        ASSERT_EQ(dfa_match("ab$", "abc"), dfa_t::NO_MATCH);
+        ASSERT_EQ(dfa_match("a|ab$", "ab"), 1);
+        ASSERT_EQ(dfa_match("ab$|a", "ab"), 2);
+
+        const auto engine = compiled("^b");
+        dfa_t dfa(engine.code, false);
+        ASSERT_EQ(dfa.exec("a\nb", 2, 3), 3);
+        ASSERT_EQ(dfa.exec("aab", 2, 3), dfa_t::NO_MATCH);
+    }
+
+    TEST(re_dfa, Unanchored) {
+        const auto engine = compiled("b+c");
+        dfa_t dfa(engine.code, true);
+        const char *text = "abbbcbc";
+        ASSERT_EQ(dfa.exec(text, 0, 7), 5);
+        ASSERT_EQ(dfa.exec(text, 5, 7), 7);
+        ASSERT_EQ(dfa.exec("abbb", 0, 4), dfa_t::NO_MATCH);
+    }
+
+    TEST(re_dfa, NotEverything) {
+        ASSERT_FALSE(dfa_t(compiled("a{2,3}").code, false).valid());
+        ASSERT_FALSE(dfa_t(compiled("\\bab").code, false).valid());
+        ASSERT_TRUE(dfa_t(compiled("[^ab]+x").code, false).valid());
+    }
+
+    TEST(re_dfa, CacheFlush) {
+        // (a|b)*a(a|b){n} needs 2^n states; a small cache keeps getting thrown
+        // away until the dfa gives up.
+        const auto engine = compiled("(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)c");
+        std::string text;
+        unsigned seed = 1;
+        for (int i = 0; i < 5000; i++) {
+            seed = seed * 1103515245 + 12345;
+            text += (seed >> 16) & 1 ? 'a' : 'b';
+        }
+        dfa_t dfa(engine.code, false, 4096);
+        ASSERT_EQ(dfa.exec(text.c_str(), 0, text.size()), dfa_t::GAVE_UP);
+
+        dfa_t big(engine.code, false);
+        ASSERT_EQ(big.exec(text.c_str(), 0, text.size()), dfa_t::NO_MATCH);
+        ASSERT_GT(big.states(), 100);
+    }
+
+    TEST(re_dfa, EngineUsesIt) {
+        // without a match vector the answers are the same.
+        auto engine = compiled("(\\w+)@ex\\.com|\\d+x");
+        const char *text = "-- 12 ab@ex.co 34x";
+        ctext<ct> t(text, strlen(text));
+        ASSERT_EQ(engine.exec_search(t), 15);
+        re_match_vector matches;
+        ctext<ct> u(text, strlen(text));
+        ASSERT_EQ(engine.exec_search(u, 0, matches), 15);
+        ASSERT_EQ(matches[0], re_match_type(15, 3));
+
+        ctext<ct> v(text, strlen(text));
+        v.start(15);
+        ASSERT_EQ(engine.exec_match(v), 3);
+        ASSERT_EQ(v.position(), 18);
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
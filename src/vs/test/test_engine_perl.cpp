@@ -10,6 +10,8 @@
 using ct = re_char_traits<char>;
 using syntax_perl_t = re::syntax_perl<ct>;
 using re_engine_t = re::re_engine<syntax_perl_t>;
+using wt = re_wide_code_traits<char>;
+using wide_engine_t = re::re_engine<re::syntax_perl<wt> >;
 
 namespace re {
     TEST(re_engine, CompileAndMatch) {
@@ -41,6 +43,319 @@ namespace re {
         re_match_vector matches;
         ASSERT_EQ(engine.exec_match(ct, false, matches), -1);
     }
+
+    TEST(re_engine, ClosureCounts) {
+        // partial matches keep exec_match on the backtracking.
+        re_engine_t engine;
+        const auto pattern = "\\d{1,3}(\\.\\d{1,3}){3}";
+        ASSERT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+        ASSERT_EQ(engine.code.closures(), 3);
+
+        const auto text = "192.168.1.254";
+        ctext<ct> t(text, strlen(text));
+        re_match_vector matches;
+        ASSERT_EQ(engine.exec_match(t, true, matches), 13);
+        ASSERT_EQ(matches, re_match_vector({{0, 13}, {9, 4}}));
+    }
+
+    TEST(re_engine, ClosureCountLeftByFailure) {
+        // the second b fails the third a, the closure is left with a count of 1.
+        re_engine_t engine;
+        const auto pattern = "(a{1,2}b)+";
+        ASSERT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+
+        const auto text = "abaab";
+        ctext<ct> t(text, strlen(text));
+        re_match_vector matches;
+        ASSERT_EQ(engine.exec_match(t, true, matches), 5);
+        ASSERT_EQ(matches, re_match_vector({{0, 5}, {2, 3}}));
+    }
+
+    TEST(re_engine, Classes) {
+        re_engine_t engine;
+        const auto pattern = "[a-c_\\d]+[xy]";
+        ASSERT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+
+        const auto text = "--ab_9cy";
+        ctext<ct> t(text, strlen(text));
+        re_match_vector matches;
+        ASSERT_EQ(engine.exec_search(t, 0, matches), 2);
+        ASSERT_EQ(matches[0], re_match_type(2, 6));
+
+        ASSERT_EQ(engine.exec_compile("[a-c_\\d]", 8), 0);
+        ASSERT_EQ(engine.code[0], OP_CLASS);
+        ASSERT_EQ(engine.code.offset(), 34);
+
+        // a class with one member is left alone.
+        ASSERT_EQ(engine.exec_compile("[a]", 3), 0);
+        ASSERT_EQ(engine.code[0], OP_CHAR);
+    }
+
+    TEST(re_engine, NegatedClasses) {
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile("[^,]", 4), 0);
+        ASSERT_EQ(engine.code[0], OP_NOT_CHAR);
+        ASSERT_EQ(engine.code.offset(), 3);
+        ASSERT_EQ(engine.exec_compile("[^,\\d]", 7), 0);
+        ASSERT_EQ(engine.code[0], OP_NOT_CLASS);
+
+        const auto pattern = "([^,\\n]*),([^\"]*)";
+        ASSERT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+        const auto text = "ab c,de\"f";
+        ctext<ct> t(text, strlen(text));
+        re_match_vector matches;
+        ASSERT_EQ(engine.exec_match(t, true, matches), 7);
+        ASSERT_EQ(matches, re_match_vector({{0, 7}, {0, 4}, {5, 2}}));
+
+        // nothing at the end of the text for it to not be.
+        ctext<ct> end("ab", 2);
+        ASSERT_EQ(engine.exec_compile("ab[^c]", 6), 0);
+        ASSERT_EQ(engine.exec_match(end, false, matches), -1);
+
+        // an escaped character is left out too.
+        ASSERT_EQ(engine.exec_compile("[^\\n]+", 6), 0);
+        ctext<ct> line("ab\nc", 4);
+        ASSERT_EQ(engine.exec_match(line, true, matches), 2);
+    }
+
+    TEST(re_engine, LongRuns) {
+        // a run of one character test is one failure point, not one for each
+        // character, so the failure stack doesn't run out on a 5k line.
+        re_engine_t engine;
+        re_match_vector matches;
+        const std::string line = std::string(5000, 'a') + "=" + std::string(100, 'b') + "=c";
+        ASSERT_EQ(engine.exec_compile(".*", 2), 0);
+        ctext<ct> all(line.c_str(), line.size());
+        ASSERT_EQ(engine.exec_match(all, true, matches), 5103);
+
+        // backtracking into the runs.
+        ASSERT_EQ(engine.exec_compile("(a+)(.*)=", 9), 0);
+        ctext<ct> groups(line.c_str(), line.size());
+        ASSERT_EQ(engine.exec_match(groups, true, matches), 5102);
+        ASSERT_EQ(matches, re_match_vector({{0, 5102}, {0, 5000}, {5000, 101}}));
+
+        ASSERT_EQ(engine.exec_compile("[a=]*a=b", 8), 0);
+        ctext<ct> back(line.c_str(), line.size());
+        ASSERT_EQ(engine.exec_match(back, true, matches), 5002);
+
+        ASSERT_EQ(engine.exec_compile("\\w+d", 4), 0);
+        ctext<ct> none(line.c_str(), line.size());
+        ASSERT_EQ(engine.exec_match(none, false, matches), -1);
+    }
+
+    TEST(re_engine, AtomicGroups) {
+        re_engine_t engine;
+        re_match_vector matches;
+        auto search = [&engine, &matches](const char *pattern, const char *text) {
+            EXPECT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+            ctext<ct> t(text, strlen(text));
+            return engine.exec_search(t, 0, matches);
+        };
+        // nothing's given back once the group has matched.
+        ASSERT_EQ(search("(?>a*)a", "aaa"), -1);
+        ASSERT_EQ(search("a*+a", "aaa"), -1);
+        ASSERT_EQ(search("a?+a", "a"), -1);
+        ASSERT_EQ(search("(?>ab|a)c", "abc ac"), 0);
+        ASSERT_EQ(search("x(?>a|ab)c", "xabc xac"), 5);
+        ASSERT_EQ(search("(\\w)(?>\\d++)(:)", "a12:"), 0);
+        ASSERT_EQ(matches, re_match_vector({{0, 4}, {0, 1}, {3, 1}}));
+
+        // the failure points inside are dropped, so this is linear and not
+        // one try for each way of splitting up the a's.
+        const std::string as(40, 'a');
+        ASSERT_EQ(engine.exec_compile("(?>a+)+b", 8), 0);
+        ctext<ct> t(as.c_str(), as.size());
+        ASSERT_EQ(engine.exec_match(t, true, matches), 40);
+    }
+
+    TEST(re_engine, EmptyLoops) {
+        // the dfa and the pike vm leave anything atomic to the backtracker; a
+        // time round a loop that takes nothing fails, the way they have it.
+        re_engine_t engine;
+        re_match_vector matches;
+        auto compile = [&engine](const char *pattern) {
+            EXPECT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+            engine.exec_optimize();
+        };
+        auto match = [&engine, &matches](const char *text) {
+            ctext<ct> t(text, strlen(text));
+            return engine.exec_match(t, false, matches);
+        };
+        auto search = [&engine](const char *text) {
+            ctext<ct> t(text, strlen(text));
+            return engine.exec_search(t);
+        };
+        compile("(?>x)(a*)*b");
+        ASSERT_EQ(match("xb"), 2);
+        ASSERT_EQ(match("xaab"), 4);
+        compile("(?>a?)*b");
+        ASSERT_EQ(match("aab"), 3);
+        ASSERT_EQ(match("a"), -1);
+        ASSERT_EQ(search("a"), -1);
+        compile("(a?)*+");
+        ASSERT_EQ(match("a"), 1);
+        compile("x(?>a|)*y");
+        ASSERT_EQ(match("xaay"), 4);
+        ASSERT_EQ(search("--xy"), 2);
+
+        // the time round that took nothing failed, so the group's the one
+        // before.
+        compile("(?>x)(ab|a?)*b");
+        ASSERT_EQ(match("xaabb"), 5);
+        ASSERT_EQ(matches, re_match_vector({{0, 5}, {2, 2}}));
+
+        // ecmascript's rule, not perl's; perl leaves the loop when c? takes
+        // nothing, and matches nothing.
+        compile("(c?|\\d)*");
+        ASSERT_EQ(match("1ba"), 1);
+        ASSERT_EQ(matches, re_match_vector({{0, 1}, {0, 1}}));
+        compile("(?>x)(c?|\\d)*");
+        ASSERT_EQ(match("x1ba"), 2);
+        ASSERT_EQ(matches, re_match_vector({{0, 2}, {1, 1}}));
+
+        // lazy loops, and closures once they've got to their minimum.
+        compile("(?>x)(a?)*?b");
+        ASSERT_EQ(match("xc"), -1);
+        ASSERT_EQ(match("xaab"), 4);
+        compile("(?>x)(a?){2,}b");
+        ASSERT_EQ(match("xb"), 2);
+        ASSERT_EQ(match("xaaab"), 5);
+        ASSERT_EQ(match("xc"), -1);
+        compile("(?>x)(b?(a?)*+){1,2}b");
+        ASSERT_EQ(match("xaabab"), 6);
+    }
+
+    TEST(re_engine, MatchContext) {
+        // the buffers are kept from one match to the next, and go from one
+        // engine to another.
+        re_engine_t::match_context context;
+        re_match_vector matches;
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile("(a|b)*c", 7), 0);
+        ctext<ct> t("ababc", 5);
+        ASSERT_EQ(engine.exec_match(t, context, true, matches), 5);
+        const size_t grown = context.failures.capacity();
+        ASSERT_GT(grown, 0u);
+
+        ctext<ct> again("ababc", 5);
+        ASSERT_EQ(engine.exec_match(again, context, true, matches), 5);
+        ASSERT_EQ(matches, re_match_vector({{0, 5}, {3, 1}}));
+        ASSERT_EQ(context.failures.capacity(), grown);
+
+        re_engine_t other;
+        ASSERT_EQ(other.exec_compile("(x)(y)(z)", 9), 0);
+        ctext<ct> xyz("--xyz", 5);
+        ASSERT_EQ(other.exec_search(xyz, context, 0, matches), 2);
+        ASSERT_EQ(matches, re_match_vector({{2, 3}, {2, 1}, {3, 1}, {4, 1}}));
+
+        // short text with the groups goes to re_bitstate first; its bitset
+        // and stack are in the context too, and aren't made again.
+        re_engine_t groups;
+        ASSERT_EQ(groups.exec_compile("(a|ab)(c|bcd)(d*)", 17), 0);
+        ctext<ct> abcd("abcd", 4);
+        ASSERT_EQ(groups.exec_match(abcd, context, false, matches), 4);
+        ASSERT_EQ(matches, re_match_vector({{0, 4}, {0, 1}, {1, 3}, {0, 0}}));
+        ASSERT_GT(context.bitstate.used, 0u);
+        const uint64_t *visited = context.bitstate.visited.data();
+        const auto *stack = context.bitstate.stack.data();
+        for (int i = 0; i < 3; i++) {
+            ctext<ct> u("abcd", 4);
+            ASSERT_EQ(groups.exec_match(u, context, false, matches), 4);
+            ASSERT_EQ(context.bitstate.visited.data(), visited);
+            ASSERT_EQ(context.bitstate.stack.data(), stack);
+        }
+    }
+
+    TEST(re_engine, FailureStack) {
+        ASSERT_EQ(sizeof(re_closure), 16u);
+
+        // the first entries are in the context; a small match doesn't grow it.
+        re_engine_t::match_context context;
+        const size_t inlined = context.failures.capacity();
+        re_engine_t engine;
+        re_match_vector matches;
+        ASSERT_EQ(engine.exec_compile("(a|b){2,5}c", 11), 0);
+        ctext<ct> t("ababc", 5);
+        ASSERT_EQ(engine.exec_match(t, context, true, matches), 5);
+        ASSERT_EQ(context.failures.capacity(), inlined);
+
+        // past them, it grows.
+        const std::string as = std::string(1000, 'a') + "c";
+        ASSERT_EQ(engine.exec_compile("(a|b)*c", 7), 0);
+        ctext<ct> many(as.c_str(), as.size());
+        ASSERT_EQ(engine.exec_match(many, context, true, matches), 1001);
+        ASSERT_GT(context.failures.capacity(), inlined);
+    }
+
+    TEST(re_engine, CapturesPutBack) {
+        re_engine_t engine;
+        re_match_vector matches;
+        auto match = [&engine, &matches](const char *pattern, const char *text) {
+            EXPECT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+            ctext<ct> t(text, strlen(text));
+            return engine.exec_match(t, true, matches);
+        };
+        // the a|ab and c|bcd both get tried twice before it matches.
+        ASSERT_EQ(match("(a|ab)(c|bcd)(d*)", "abcd"), 4);
+        ASSERT_EQ(matches, re_match_vector({{0, 4}, {0, 1}, {1, 3}, {0, 0}}));
+
+        // the failed (a) on the last time around doesn't get left behind.
+        ASSERT_EQ(match("((a)|b)*c", "abbc"), 4);
+        ASSERT_EQ(matches, re_match_vector({{0, 4}, {2, 1}, {0, 1}}));
+
+        // an atomic group drops its failure points but not what it captured.
+        ASSERT_EQ(match("(a)(?>(b)|c)b", "abb"), 3);
+        ASSERT_EQ(matches, re_match_vector({{0, 3}, {0, 1}, {1, 1}}));
+        ASSERT_EQ(match("(a)(?>(b)|c)d", "acd"), 3);
+        ASSERT_EQ(matches, re_match_vector({{0, 3}, {0, 1}, {0, 0}}));
+    }
+
+    TEST(re_engine, LongJumps) {
+        // jumps over a few hundred characters; the low code word of the jump
+        // used to get sign extended.
+        re_engine_t engine;
+        const std::string pattern = "(" + std::string(150, 'q') + "|x)y";
+        ASSERT_EQ(engine.exec_compile(pattern.c_str(), pattern.size()), 0);
+        const auto text = "--xy";
+        ctext<ct> t(text, strlen(text));
+        ASSERT_EQ(engine.exec_search(t), 2);
+    }
+
+    TEST(re_engine, ManyGroups) {
+        std::string pattern;
+        for (int i = 0; i < 200; i++) {
+            pattern += "(a)";
+        }
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile(pattern.c_str(), pattern.size()), 0);
+        const std::string text(200, 'a');
+        ctext<ct> t(text.c_str(), text.size());
+        re_match_vector matches;
+        ASSERT_EQ(engine.exec_match(t, true, matches), 200);
+        ASSERT_EQ(matches.size(), 201u);
+        ASSERT_EQ(matches[200], re_match_type(199, 1));
+
+        const std::string too_many = pattern + pattern;
+        ASSERT_EQ(engine.exec_compile(too_many.c_str(), too_many.size()), BACKREFERENCE_OVERFLOW);
+    }
+
+    TEST(re_engine, WideCode) {
+        // too big for 16 bit jumps, so it needs the wide code words.
+        std::string pattern;
+        for (int i = 0; i < 4000; i++) {
+            pattern += (i ? "|item" : "item") + std::to_string(i) + "x";
+        }
+        re_engine_t narrow;
+        ASSERT_EQ(narrow.exec_compile(pattern.c_str(), pattern.size()), EXPRESSION_TOO_LONG);
+
+        wide_engine_t engine;
+        ASSERT_EQ(engine.exec_compile(pattern.c_str(), pattern.size()), 0);
+        const auto text = "stock: item3999x item12";
+        ctext<wt> t(text, strlen(text));
+        re_match_vector matches;
+        ASSERT_EQ(engine.exec_search(t, 0, matches), 7);
+        ASSERT_EQ(matches[0], re_match_type(7, 9));
+    }
 }
 
 int main(int argc, char **argv) {
@@ -0,0 +1,208 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include "traits.h"
+#include "engine.h"
+#include "syntax_perl.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+
+namespace re {
+    static int search(re_engine_t &engine, const char *text, re_match_vector &matches) {
+        ctext<ct> t(text, strlen(text));
+        return engine.exec_search(t, 0, matches);
+    }
+
+    static int search(const char *pattern, const char *text, re_match_vector &matches) {
+        re_engine_t engine;
+        EXPECT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+        return search(engine, text, matches);
+    }
+
+    static int search(const char *pattern, const char *text) {
+        re_match_vector matches;
+        return search(pattern, text, matches);
+    }
+
+    TEST(exec_search, LiteralFirstByte) {
+        re_match_vector matches;
+        ASSERT_EQ(search("abc", "zzabcz", matches), 2);
+        ASSERT_EQ(matches[0], re_match_type(2, 3));
+        ASSERT_EQ(search("abc", "zzabz"), -1);
+    }
+
+    TEST(exec_search, FollowsAlternation) {
+        ASSERT_EQ(search("cat|dog", "hotdog"), 3);
+        ASSERT_EQ(search("cat|dog", "concat"), 3);
+        ASSERT_EQ(search("cat|dog", "cow"), -1);
+    }
+
+    TEST(exec_search, FollowsClosures) {
+        re_match_vector matches;
+        ASSERT_EQ(search("a*b", "xxaaab", matches), 2);
+        ASSERT_EQ(matches[0], re_match_type(2, 4));
+        ASSERT_EQ(search("x?yz", "..yz"), 2);
+        ASSERT_EQ(search("\\d{2,3}", "ab1234", matches), 2);
+        ASSERT_EQ(matches[0], re_match_type(2, 3));
+    }
+
+    TEST(exec_search, Classes) {
+        ASSERT_EQ(search("[a-c]+", "xxcab"), 2);
+        ASSERT_EQ(search("[^ab]x", "abcx"), 2);
+        ASSERT_EQ(search("\\w+ timeout=\\d+", "-- ab timeout=12"), 3);
+        ASSERT_EQ(search("\\s", "abc d"), 3);
+    }
+
+    TEST(exec_search, Groups) {
+        re_match_vector matches;
+        ASSERT_EQ(search("x(ab)y", "qxaby", matches), 1);
+        ASSERT_EQ(matches[0], re_match_type(1, 4));
+        ASSERT_EQ(matches[1], re_match_type(2, 2));
+    }
+
+    TEST(exec_search, EmptyMatch) {
+        // a* can match nothing, so there is no study map and position 0 matches.
+        re_match_vector matches;
+        ASSERT_EQ(search("a*", "bbb", matches), 0);
+        ASSERT_EQ(matches[0], re_match_type(0, 0));
+    }
+
+    TEST(exec_search, CaseSensitiveByDefault) {
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile("dog", 3), 0);
+        re_match_vector matches;
+        ASSERT_EQ(search(engine, "hotDOG", matches), -1);
+    }
+
+    TEST(exec_search, PureLiteral) {
+        re_match_vector matches;
+        ASSERT_EQ(search("hello", "hellhello", matches), 4);
+        ASSERT_EQ(matches.size(), 1u);
+        ASSERT_EQ(matches[0], re_match_type(4, 5));
+        ASSERT_EQ(search("zz", "z"), -1);
+        ASSERT_EQ(search("abc", "xxab"), -1);
+    }
+
+    TEST(exec_search, OptimizedLiteral) {
+        // the newline has the same value as OP_CHAR.
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile("a\\nb", 4), 0);
+        ASSERT_EQ(engine.exec_optimize(), 1);
+        re_match_vector matches;
+        ASSERT_EQ(search(engine, "xa\nb a\nb", matches), 1);
+        ASSERT_EQ(search(engine, "xa\na\nb", matches), 3);
+        ASSERT_EQ(matches[0], re_match_type(3, 3));
+        ASSERT_EQ(search(engine, "xa\na\n", matches), -1);
+    }
+
+    TEST(exec_search, LiteralPrefix) {
+        re_match_vector matches;
+        ASSERT_EQ(search("ERROR: .*", "x ERRO ERROR: disk", matches), 7);
+        ASSERT_EQ(matches[0], re_match_type(7, 11));
+        ASSERT_EQ(search("ab\\d", "ab ab1 ab2"), 3);
+        ASSERT_EQ(search("ab\\d", "ab ab"), -1);
+        ASSERT_EQ(search("(ab)c", "abac abc", matches), 5);
+        ASSERT_EQ(matches[1], re_match_type(5, 2));
+    }
+
+    TEST(exec_search, InnerLiteral) {
+        re_match_vector matches;
+        ASSERT_EQ(search("\\w+ timeout=\\d+", "a timeout b c timeout=30", matches), 12);
+        ASSERT_EQ(matches[0], re_match_type(12, 12));
+        ASSERT_EQ(search("\\d+@ex\\.com", "12@ex.co 34@ex.com", matches), 9);
+        ASSERT_EQ(matches[0], re_match_type(9, 9));
+        ASSERT_EQ(search("[a-z]+ing", "12 ing sing"), 7);
+        ASSERT_EQ(search("[a-z]+ing", "12 ing"), -1);
+    }
+
+    TEST(exec_search, InnerLiteralWindow) {
+        // the literal is always exactly 2 characters into the match.
+        re_match_vector matches;
+        ASSERT_EQ(search("\\d\\d-\\d\\d", "1-2 -- 12-34", matches), 7);
+        ASSERT_EQ(matches[0], re_match_type(7, 5));
+        ASSERT_EQ(search("(foo|bar)baz", "foobar barbaz", matches), 7);
+        ASSERT_EQ(matches[1], re_match_type(7, 3));
+        ASSERT_EQ(search("x?yz", "y yz", matches), 2);
+        ASSERT_EQ(search("x?yz", "y xyz", matches), 2);
+    }
+
+    TEST(exec_search, ReverseSuffix) {
+        re_match_vector matches;
+        ASSERT_EQ(search("[a-z0-9._]+@example\\.com", "mail: john.doe@example.com", matches), 6);
+        ASSERT_EQ(matches[0], re_match_type(6, 20));
+        ASSERT_EQ(search("[a-z0-9._]+@example\\.com", "a@example.org b@example.com"), 14);
+        ASSERT_EQ(search("[a-z]+@ex\\.com", "--@ex.com ab@ex.com"), 10);
+        ASSERT_EQ(search("[a-z]+@ex\\.com", "AB@ex.com"), -1);
+        ASSERT_EQ(search("[^@ ]+@ex\\.com", "a b@ex.com", matches), 2);
+        ASSERT_EQ(matches[0], re_match_type(2, 8));
+        ASSERT_EQ(search("(\\w+|-)=x", "a =x ab=x", matches), 5);
+        ASSERT_EQ(matches[1], re_match_type(5, 2));
+    }
+
+    TEST(exec_search, ReverseSuffixLeftmost) {
+        // the part in front of the literal can contain its first character, so
+        // a later copy of the literal can end a match that starts earlier.
+        ASSERT_EQ(search("(abb|b)b", "abbb"), 0);
+        ASSERT_EQ(search("a.*b", "xb a b"), 3);
+    }
+
+    TEST(exec_search, AnchoredLine) {
+        re_match_vector matches;
+        ASSERT_EQ(search("^abc", "xabc\nabc", matches), 5);
+        ASSERT_EQ(matches[0], re_match_type(5, 3));
+        ASSERT_EQ(search("^abc", "abc"), 0);
+        ASSERT_EQ(search("^abc", "xabc\nab"), -1);
+        ASSERT_EQ(search("^a|^b", "xa\nyb\nb"), 6);
+        ASSERT_EQ(search("(^a|^b)c", "ac"), 0);
+        ASSERT_EQ(search("^\\w+ timeout", "x\n timeout\nab timeout"), 11);
+        ASSERT_EQ(search("^$", "ab\ncd\n"), 6); // $ is only the end of the buffer
+    }
+
+    TEST(exec_search, AnchoredSomeBranches) {
+        // only one branch is anchored, so the other can match anywhere.
+        ASSERT_EQ(search("^a|b", "xab"), 2);
+        ASSERT_EQ(search("x*^a", "ba"), -1);
+    }
+
+    TEST(exec_search, AnchoredBuffer) {
+        re_match_vector matches;
+        ASSERT_EQ(search("\\Aab", "ab\nab"), 0);
+        ASSERT_EQ(search("\\Aab", "xab\nab"), -1);
+        ASSERT_EQ(search("ab\\z", "ab\nab", matches), 3);
+        ASSERT_EQ(matches[0], re_match_type(3, 2));
+    }
+
+    TEST(exec_search, LongBuffer) {
+        std::string text(1 << 20, '.');
+        text += "needle";
+        re_match_vector matches;
+        ASSERT_EQ(search("ne+dle", text.c_str(), matches), 1 << 20);
+        ASSERT_EQ(matches[0].second, 6);
+        ASSERT_EQ(search("\\w+dle", text.c_str(), matches), 1 << 20);
+        ASSERT_EQ(matches[0].second, 6);
+
+        // lots of words that almost match; only the last one ends in the literal.
+        std::string words;
+        for (int i = 0; i < 2000; i++) {
+            words += std::string(1000, 'w') + ' ';
+        }
+        words += "ww@ex.com";
+        ASSERT_EQ(search("[a-z]+@ex\\.com", words.c_str(), matches), 2000 * 1001);
+        ASSERT_EQ(matches[0].second, 9);
+
+        std::string lines;
+        for (int i = 0; i < 100000; i++) {
+            lines += "a line without it\n";
+        }
+        lines += "ERROR here";
+        ASSERT_EQ(search("^ERROR|^FATAL", lines.c_str(), matches), 100000 * 18);
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
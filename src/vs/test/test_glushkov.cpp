@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include "traits.h"
+#include "engine.h"
+#include "program.h"
+#include "glushkov.h"
+#include "syntax_perl.h"
+#include "test_compiled.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using program_t = re::re_program<ct>;
+using glushkov_t = re::re_glushkov<ct>;
+
+namespace re {
+    static int first_end(const char *pattern, const std::string &text) {
+        const auto engine = compiled(pattern);
+        const program_t program(engine.code, 0);
+        const glushkov_t glushkov(program);
+        EXPECT_TRUE(glushkov.valid());
+        return glushkov.exec(text.c_str(), 0, text.size());
+    }
+
+    TEST(re_glushkov, Positions) {
+        const auto engine = compiled("[A-Z]{3}-\\d{4}");
+        const program_t program(engine.code, 0);
+        const glushkov_t glushkov(program);
+        ASSERT_TRUE(glushkov.valid());
+        ASSERT_EQ(glushkov.positions(), 8);
+        ASSERT_EQ(glushkov.longest(), 8);
+    }
+
+    TEST(re_glushkov, FirstEnd) {
+        ASSERT_EQ(first_end("abc", "xxabcxx"), 5);
+        ASSERT_EQ(first_end("abc", "xxabxx"), glushkov_t::NO_MATCH);
+        ASSERT_EQ(first_end("a|bcd", "xbcda"), 4);
+        ASSERT_EQ(first_end("ab*c", "xabbbbc"), 7);
+        ASSERT_EQ(first_end("[A-Z]{3}-\\d{4}", "ref ABC-123 and XYZ-9876."), 24);
+        ASSERT_EQ(first_end("x*", "abc"), 0);
+    }
+
+    TEST(re_glushkov, Longest) {
+        const auto bounded = compiled("ab?c{1,3}");
+        const program_t p1(bounded.code, 0);
+        ASSERT_EQ(glushkov_t(p1).longest(), 5);
+
+        const auto loops = compiled("ab+c");
+        const program_t p2(loops.code, 0);
+        ASSERT_EQ(glushkov_t(p2).longest(), glushkov_t::UNBOUNDED);
+    }
+
+    TEST(re_glushkov, NotEverything) {
+        for (const char *pattern: {"^abc", "ab$", "\\ba", "(abcdefgh){9}"}) {
+            const auto engine = compiled(pattern);
+            const program_t program(engine.code, 0);
+            EXPECT_FALSE(glushkov_t(program).valid()) << pattern;
+        }
+    }
+
+    TEST(re_glushkov, EngineUsesIt) {
+        // the first end narrows the starts; the answers are the same.
+        re_engine_t engine = compiled("[A-Z]{3}-\\d{4}");
+        const std::string text = "ref ABC-123 and XYZ-9876.";
+        ctext<ct> t(text.c_str(), text.size());
+        ASSERT_EQ(engine.exec_search(t), 16);
+        re_match_vector matches;
+        ctext<ct> u(text.c_str(), text.size());
+        ASSERT_EQ(engine.exec_search(u, 0, matches), 16);
+        ASSERT_EQ(matches[0], re_match_type(16, 8));
+
+        const std::string none = "ref ABC-123";
+        ctext<ct> v(none.c_str(), none.size());
+        ASSERT_EQ(engine.exec_search(v), -1);
+        ctext<ct> w(text.c_str(), text.size());
+        w.start(17);
+        ASSERT_EQ(engine.exec_search(w), -1);
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
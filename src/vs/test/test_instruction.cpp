@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include "traits.h"
+#include "engine.h"
+#include "instruction.h"
+#include "syntax_perl.h"
+#include "test_compiled.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using linked_t = re::linked_code<ct>;
+
+namespace re {
+    TEST(linked_code, Jumps) {
+        const auto engine = compiled("a|bc");
+        const linked_t linked(engine.code);
+        ASSERT_TRUE(linked.valid());
+        ASSERT_EQ(linked.size(), 6);
+
+        ASSERT_EQ(linked[0].op, OP_PUSH_FAILURE);
+        ASSERT_EQ(linked[0].target, 3); // the b
+        ASSERT_EQ(linked[1].op, OP_CHAR);
+        ASSERT_EQ(linked[1].arg1, 'a');
+        ASSERT_EQ(linked[2].op, OP_GOTO);
+        ASSERT_EQ(linked[2].target, 5); // the end
+        ASSERT_EQ(linked[3].arg1, 'b');
+        ASSERT_EQ(linked[5].op, OP_END);
+
+        ASSERT_EQ(linked.index(8), 3);
+        ASSERT_EQ(linked.index(9), -1);
+    }
+
+    TEST(linked_code, Closures) {
+        const auto engine = compiled("x(ab){2,3}y");
+        const linked_t linked(engine.code);
+        ASSERT_TRUE(linked.valid());
+
+        const auto &closure = linked[1];
+        ASSERT_EQ(closure.op, OP_CLOSURE);
+        ASSERT_EQ(closure.arg1, 2);
+        ASSERT_EQ(closure.arg2, 3);
+        ASSERT_EQ(closure.slot, 0);
+        ASSERT_EQ(linked[closure.target].arg1, 'y');
+
+        const auto &inc = linked[6];
+        ASSERT_EQ(inc.op, OP_CLOSURE_INC);
+        ASSERT_EQ(inc.target, 2);
+        ASSERT_EQ(linked[inc.target].op, OP_BACKREF_BEGIN);
+        ASSERT_EQ(linked[inc.target].arg1, 1);
+    }
+
+    // is the way back round the (last) loop one that can take nothing?
+    static bool empty_loop(const char *pattern) {
+        const auto engine = compiled(pattern);
+        const linked_t linked(engine.code);
+        EXPECT_TRUE(linked.valid());
+        for (int i = linked.size() - 1; i >= 0; i--) {
+            const auto &in = linked[i];
+            if (in.op == OP_CLOSURE_INC || ((in.op == OP_GOTO || in.op == OP_PUSH_FAILURE) && in.target < i)) {
+                return in.empty_loop;
+            }
+        }
+        ADD_FAILURE() << "no loop in " << pattern;
+        return false;
+    }
+
+    TEST(linked_code, EmptyLoops) {
+        ASSERT_FALSE(empty_loop("(ab)*"));
+        ASSERT_FALSE(empty_loop("(a|b)+"));
+        ASSERT_FALSE(empty_loop("(ab){2,}"));
+        ASSERT_FALSE(empty_loop("(a?b)*?"));
+        ASSERT_TRUE(empty_loop("(a?)*"));
+        ASSERT_TRUE(empty_loop("(a|)+"));
+        ASSERT_TRUE(empty_loop("(a*b*)*"));
+        ASSERT_TRUE(empty_loop("(a?){2,}"));
+        ASSERT_TRUE(empty_loop("(a?)*?"));
+        ASSERT_TRUE(empty_loop("(?>a?)*"));
+        ASSERT_TRUE(empty_loop("(\\b)*"));
+    }
+
+    TEST(linked_code, Strings) {
+        auto engine = compiled("hello");
+        ASSERT_EQ(engine.exec_optimize(), 1);
+        const linked_t linked(engine.code);
+        ASSERT_TRUE(linked.valid());
+        ASSERT_EQ(linked.size(), 2);
+        ASSERT_EQ(linked[0].op, OP_STRING);
+        ASSERT_EQ(linked[0].arg2, 5);
+        ASSERT_EQ(strncmp(linked.literals(linked[0]), "hello", 5), 0);
+    }
+
+    TEST(linked_code, Repeats) {
+        const auto engine = compiled("a*[0-9]+(bc)*");
+        linked_t linked(engine.code);
+        ASSERT_TRUE(linked.valid());
+        ASSERT_EQ(linked.fuse_repeats(), 2); // not the (bc)*
+
+        ASSERT_EQ(linked[0].op, OP_REPEAT);
+        ASSERT_EQ(linked[0].arg1, 1);
+        ASSERT_EQ(linked[0].arg2, 0);
+        ASSERT_EQ(linked[0].target, 3);
+        ASSERT_EQ(linked[1].op, OP_CHAR); // still there, after the OP_REPEAT
+        ASSERT_EQ(linked[2].op, OP_GOTO);
+
+        // the [0-9]+ is an OP_FAKE_FAILURE_GOTO to the range, then [0-9]*.
+        ASSERT_EQ(linked[3].op, OP_REPEAT);
+        ASSERT_EQ(linked[3].arg2, 1);
+        ASSERT_EQ(linked[3].target, 7);
+        ASSERT_EQ(linked[linked[3].arg1].op, OP_RANGE_CHAR);
+        ASSERT_EQ(linked[4].op, OP_REPEAT);
+        ASSERT_EQ(linked[4].arg2, 0);
+        ASSERT_EQ(linked[7].op, OP_PUSH_FAILURE);
+
+        // nothing after the a* can start with an a.
+        ASSERT_EQ(linked[0].slot, 1);
+        ASSERT_EQ(linked[3].slot, 0); // (bc)* has a failure point first
+        linked_t colon(compiled("\\d+:|\\d+1").code);
+        ASSERT_EQ(colon.fuse_repeats(), 2);
+        ASSERT_EQ(colon[1].slot, 1);
+        ASSERT_EQ(colon[7].slot, 0);
+
+        // lazy loops stay as they are.
+        linked_t lazy(compiled("a*?b").code);
+        ASSERT_EQ(lazy.fuse_repeats(), 0);
+    }
+
+    TEST(linked_code, BadJump) {
+        auto engine = compiled("a|bc");
+        engine.code.put_address(1, 2); // into the middle of the OP_PUSH_FAILURE
+        ASSERT_FALSE(linked_t(engine.code).valid());
+    }
+}
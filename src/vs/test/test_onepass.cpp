@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include "traits.h"
+#include "engine.h"
+#include "program.h"
+#include "onepass.h"
+#include "syntax_perl.h"
+#include "test_compiled.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using program_t = re::re_program<ct>;
+using onepass_t = re::re_onepass<ct>;
+
+namespace re {
+    static bool one_pass(const char *pattern, int groups) {
+        const auto engine = compiled(pattern);
+        const program_t program(engine.code, groups);
+        return onepass_t(program).valid();
+    }
+
+    static std::vector<int> onepass_slots(const char *pattern, int groups, const std::string &text,
+                                          int pos = 0) {
+        const auto engine = compiled(pattern);
+        const program_t program(engine.code, groups);
+        const onepass_t onepass(program);
+        EXPECT_TRUE(onepass.valid());
+        std::vector<int> slots;
+        if (onepass.exec(text.c_str(), pos, text.size(), slots) == onepass_t::NO_MATCH) {
+            slots.clear();
+        }
+        return slots;
+    }
+
+    TEST(re_onepass, Groups) {
+        ASSERT_EQ(onepass_slots("(\\d+)-(\\d+)-(\\w+)", 3, "12-345-abc def"),
+                  std::vector<int>({0, 10, 0, 2, 3, 6, 7, 10}));
+        ASSERT_EQ(onepass_slots("(\\d+)-(\\d+)-(\\w+)", 3, "12-345-"), std::vector<int>());
+        ASSERT_EQ(onepass_slots("(a|b)*c", 1, "abbc"), std::vector<int>({0, 4, 2, 3}));
+        ASSERT_EQ(onepass_slots("(ab){2}", 1, "ababab"), std::vector<int>({0, 4, 2, 4}));
+        ASSERT_EQ(onepass_slots("(a)?(b)?c", 2, "bc"), std::vector<int>({0, 2, -1, -1, 0, 1}));
+    }
+
+    TEST(re_onepass, KeptMatch) {
+        // the way on fails, so it's the match from before it.
+        ASSERT_EQ(onepass_slots("a(bc)?", 1, "abd"), std::vector<int>({0, 1, -1, -1}));
+        ASSERT_EQ(onepass_slots("a(bc)?", 1, "abc"), std::vector<int>({0, 3, 1, 3}));
+        ASSERT_EQ(onepass_slots("(a+)(b+)?", 2, "aac"), std::vector<int>({0, 2, 0, 2, -1, -1}));
+    }
+
+    TEST(re_onepass, Anchors) {
+        ASSERT_EQ(onepass_slots("^(a)", 1, "ba\na", 1), std::vector<int>());
+        ASSERT_EQ(onepass_slots("^(a)", 1, "ba\na", 3), std::vector<int>({3, 4, 3, 4}));
+        ASSERT_EQ(onepass_slots("(a)$", 1, "aa", 0), std::vector<int>());
+        ASSERT_EQ(onepass_slots("(a)$", 1, "aa", 1), std::vector<int>({1, 2, 1, 2}));
+    }
+
+    TEST(re_onepass, NotOnePass) {
+        EXPECT_TRUE(one_pass("(\\d+)-(\\d+)-(\\w+)", 3));
+        EXPECT_TRUE(one_pass("[^a]+", 0));
+        EXPECT_FALSE(one_pass("a|ab", 0));
+        EXPECT_FALSE(one_pass("(a|ab)(c|bcd)?", 2));
+        EXPECT_FALSE(one_pass("1.*a", 0));
+        EXPECT_FALSE(one_pass("\\ba", 0));
+    }
+
+    TEST(re_onepass, EngineUsesIt) {
+        re_engine_t engine = compiled("(\\d+)-(\\d+)-(\\w+)");
+        const char *text = "id 12-345-abc;";
+        re_match_vector matches;
+        ctext<ct> t(text, strlen(text));
+        t.start(3);
+        ASSERT_EQ(engine.exec_match(t, false, matches), 10);
+        ASSERT_EQ(t.position(), 13);
+        ASSERT_EQ(matches, re_match_vector({{3, 10}, {3, 2}, {6, 3}, {10, 3}}));
+
+        ctext<ct> u(text, strlen(text));
+        ASSERT_EQ(engine.exec_search(u, 0, matches), 3);
+        ASSERT_EQ(matches, re_match_vector({{3, 10}, {3, 2}, {6, 3}, {10, 3}}));
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "traits.h"
+#include "engine.h"
+#include "optimizer.h"
+#include "regexp.h"
+#include "syntax_perl.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using code_vector_t = re::compiled_code_vector<ct>;
+using optimizer_t = re::code_optimizer<ct>;
+using regexp_t = re::basic_regular_expression<syntax_perl_t>;
+
+namespace re {
+    static std::vector<char> code_of(const code_vector_t &code) {
+        return std::vector<char>(code.code(), code.code() + code.offset());
+    }
+
+    TEST(code_optimizer, Strings) {
+        re_engine_t engine;
+        const auto pattern = "x(abc){2}yz";
+        ASSERT_EQ(engine.exec_compile(pattern, strlen(pattern)), 0);
+        const optimizer_t optimizer(engine.code);
+        ASSERT_TRUE(optimizer.valid());
+        ASSERT_EQ(optimizer.changes(), 3);
+
+        const linked_code<ct> linked(optimizer.code());
+        ASSERT_TRUE(linked.valid());
+        ASSERT_EQ(linked[3].op, OP_STRING);
+        ASSERT_EQ(std::string(linked.literals(linked[3]), linked[3].arg2), "abc");
+        ASSERT_EQ(linked[6].op, OP_STRING);
+        ASSERT_EQ(std::string(linked.literals(linked[6]), linked[6].arg2), "yz");
+        ASSERT_EQ(linked[1].op, OP_CLOSURE);
+        ASSERT_EQ(linked[1].target, 6);
+        ASSERT_EQ(linked[5].target, 2);
+        ASSERT_EQ(optimizer.code().closures(), 1);
+    }
+
+    TEST(code_optimizer, JumpInTheMiddle) {
+        // the b?'s failure point goes to the c, so the b isn't merged with it.
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile("ab?cd", 5), 0);
+        const linked_code<ct> linked(optimizer_t(engine.code).code());
+        ASSERT_EQ(linked.size(), 5);
+        ASSERT_EQ(linked[1].op, OP_PUSH_FAILURE);
+        ASSERT_EQ(linked[1].target, 3);
+        ASSERT_EQ(linked[2].op, OP_CHAR);
+        ASSERT_EQ(linked[3].op, OP_STRING);
+    }
+
+    TEST(code_optimizer, Jumps) {
+        code_vector_t code;
+        code.store(OP_GOTO); // to the goto at 6
+        code.store(0);
+        code.store(0);
+        code.put_address(1, 6);
+        code.store(OP_CHAR, 'q'); // never got to
+        code.store(OP_NOOP);
+        code.store(OP_GOTO); // to the next instruction
+        code.store(0);
+        code.store(0);
+        code.put_address(7, 9);
+        code.store(OP_CHAR, 'a');
+        code.store(OP_CHAR, 'b');
+        code.store(OP_END);
+
+        const optimizer_t optimizer(code);
+        ASSERT_TRUE(optimizer.valid());
+        ASSERT_EQ(code_of(optimizer.code()), std::vector<char>({OP_STRING, 2, 'a', 'b', OP_END}));
+    }
+
+    TEST(code_optimizer, UnusedFailure) {
+        code_vector_t code;
+        code.store(OP_PUSH_FAILURE);
+        code.store(0);
+        code.store(0);
+        code.put_address(1, 10);
+        code.store(OP_BACKREF_BEGIN, 1);
+        code.store(OP_BACKREF_END, 1);
+        code.store(OP_POP_FAILURE);
+        code.store(OP_CHAR, 'a');
+        code.store(OP_END);
+
+        const optimizer_t optimizer(code);
+        ASSERT_TRUE(optimizer.valid());
+        ASSERT_EQ(code_of(optimizer.code()),
+                  std::vector<char>({OP_BACKREF_BEGIN, 1, OP_BACKREF_END, 1, OP_CHAR, 'a', OP_END}));
+    }
+
+    TEST(code_optimizer, NothingToDo) {
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile("a|b", 3), 0);
+        const optimizer_t optimizer(engine.code);
+        ASSERT_TRUE(optimizer.valid());
+        ASSERT_EQ(optimizer.changes(), 0);
+        ASSERT_EQ(engine.exec_optimize(), 0);
+    }
+
+    TEST(code_optimizer, FoldCases) {
+        re_engine_t engine;
+        ASSERT_EQ(engine.exec_compile("x-1:y", 5), 0);
+        ASSERT_EQ(engine.exec_optimize(), 1);
+        const optimizer_t optimizer(engine.code, true, false);
+        ASSERT_TRUE(optimizer.valid());
+        ASSERT_EQ(optimizer.changes(), 1);
+
+        // the letters are classes of both cases, what's between them a string.
+        const linked_code<ct> linked(optimizer.code());
+        ASSERT_EQ(linked.size(), 4);
+        ASSERT_EQ(linked[0].op, OP_CLASS);
+        ASSERT_TRUE(code_vector_t::class_member(linked.literals(linked[0]), 'X'));
+        ASSERT_TRUE(code_vector_t::class_member(linked.literals(linked[0]), 'x'));
+        ASSERT_FALSE(code_vector_t::class_member(linked.literals(linked[0]), 'y'));
+        ASSERT_EQ(linked[1].op, OP_STRING);
+        ASSERT_EQ(std::string(linked.literals(linked[1]), linked[1].arg2), "-1:");
+        ASSERT_EQ(linked[2].op, OP_CLASS);
+
+        // lower caseless compares only let the upper case in.
+        ASSERT_EQ(engine.exec_compile("[^a1]B", 6), 0);
+        const linked_code<ct> lower(optimizer_t(engine.code, false, true).code());
+        ASSERT_EQ(lower[0].op, OP_NOT_CLASS);
+        ASSERT_FALSE(code_vector_t::class_member(lower.literals(lower[0]), 'A'));
+        ASSERT_TRUE(code_vector_t::class_member(lower.literals(lower[0]), 'b'));
+        ASSERT_EQ(lower[1].op, OP_CHAR);
+
+        // nothing with cases.
+        ASSERT_EQ(engine.exec_compile("\\d+", 3), 0);
+        ASSERT_EQ(optimizer_t(engine.code, true, false).changes(), 0);
+    }
+
+    TEST(code_optimizer, AutoOptimize) {
+        regexp_t re("(foo|bar)baz\\d");
+        re_match_vector matches;
+        ASSERT_EQ(re.search("xxbarbaz1", matches), 2);
+        ASSERT_EQ(matches[1], re_match_type(2, 3));
+
+        // a partial match gets as far as the characters did.
+        regexp_t literal("abcd");
+        ASSERT_EQ(literal.partial_match("abxd"), 2);
+
+        regexp_t plain;
+        plain.auto_optimize(false);
+        ASSERT_EQ(plain.compile("abcd"), 0);
+        ASSERT_EQ(plain.partial_match("abxd"), 2);
+    }
+}
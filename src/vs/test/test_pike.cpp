@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include "traits.h"
+#include "engine.h"
+#include "program.h"
+#include "pike.h"
+#include "syntax_perl.h"
+#include "test_compiled.h"
+
+using ct = re_char_traits<char>;
+using syntax_perl_t = re::syntax_perl<ct>;
+using re_engine_t = re::re_engine<syntax_perl_t>;
+using program_t = re::re_program<ct>;
+using pike_t = re::re_pike<ct>;
+
+namespace re {
+    // the slots from the pike vm, starting at 0 or anywhere up to the end.
+    static std::vector<int> pike_slots(const char *pattern, int groups, const char *text,
+                                       bool search = false) {
+        const auto engine = compiled(pattern);
+        const program_t program(engine.code, groups);
+        EXPECT_TRUE(program.valid());
+        const pike_t pike(program);
+        std::vector<int> slots;
+        const int n = strlen(text);
+        if (pike.exec(text, 0, search ? n : 0, n, false, slots) == pike_t::NO_MATCH) {
+            slots.clear();
+        }
+        return slots;
+    }
+
+    TEST(re_pike, Groups) {
+        ASSERT_EQ(pike_slots("(a|ab)(c|bcd)", 2, "abcd"), std::vector<int>({0, 4, 0, 1, 1, 4}));
+        ASSERT_EQ(pike_slots("(ab)+", 1, "ababa"), std::vector<int>({0, 4, 2, 4}));
+        ASSERT_EQ(pike_slots("x(a)?y", 1, "xy"), std::vector<int>({0, 2, -1, -1}));
+        ASSERT_EQ(pike_slots("(a)b", 1, "ac"), std::vector<int>());
+    }
+
+    TEST(re_pike, Closures) {
+        ASSERT_EQ(pike_slots("a{2,3}", 0, "aaaa"), std::vector<int>({0, 3}));
+        ASSERT_EQ(pike_slots("a{2,3}", 0, "a"), std::vector<int>());
+        ASSERT_EQ(pike_slots("(a){2}b", 1, "aab"), std::vector<int>({0, 3, 1, 2}));
+        ASSERT_EQ(pike_slots("a{2,}b", 0, "aaaab"), std::vector<int>({0, 5}));
+        ASSERT_EQ(pike_slots("(a{1,2}b)+", 1, "abaab"), std::vector<int>({0, 5, 2, 5}));
+    }
+
+    TEST(re_pike, Search) {
+        // the leftmost match, and the first of the ones starting there.
+        ASSERT_EQ(pike_slots("b+|ab", 0, "xabb", true), std::vector<int>({1, 3}));
+        ASSERT_EQ(pike_slots("^b", 0, "a\nb", true), std::vector<int>({2, 3}));
+        ASSERT_EQ(pike_slots("a$", 0, "aab", true), std::vector<int>());
+    }
+
+    TEST(re_pike, NotEverything) {
+        ASSERT_FALSE(program_t(compiled("\\bab").code, 0).valid());
+        ASSERT_TRUE(program_t(compiled("[^ab]+x").code, 0).valid());
+        ASSERT_TRUE(program_t(compiled("\\<ab").code, 0).valid());
+    }
+
+    TEST(re_pike, Buffers) {
+        // kept from one exec to the next, and from one program to another; what
+        // the bigger program left in the lists mustn't show up in the smaller.
+        const auto big = compiled("(a{1,9}b{1,9}c{1,9}){1,9}e");
+        const program_t big_program(big.code, 1);
+        ASSERT_TRUE(big_program.valid());
+        const auto small = compiled("(a|ab)(c|bcd)");
+        const program_t small_program(small.code, 2);
+
+        pike_t::buffers work;
+        std::vector<int> slots;
+        ASSERT_EQ(pike_t(big_program).exec("abce", 0, 0, 4, false, work, slots), 0);
+        ASSERT_EQ(slots, std::vector<int>({0, 4, 0, 3}));
+        for (int i = 0; i < 2; i++) {
+            ASSERT_EQ(pike_t(small_program).exec("abcd", 0, 0, 4, false, work, slots), 0);
+            ASSERT_EQ(slots, std::vector<int>({0, 4, 0, 1, 1, 4}));
+            ASSERT_EQ(pike_t(small_program).exec("xabcd", 0, 0, 5, false, work, slots), pike_t::NO_MATCH);
+        }
+        ASSERT_EQ(pike_t(big_program).exec("xaabbce", 0, 7, 7, false, work, slots), 1);
+        ASSERT_EQ(slots, std::vector<int>({1, 7, 1, 6}));
+    }
+
+    TEST(re_pike, Pathological) {
+        // exponential for the backtracking, one pass for the pike vm.
+        const std::string text(20000, 'x');
+        EXPECT_EQ(pike_slots("(x+x+)+y", 1, text.c_str(), true), std::vector<int>());
+        EXPECT_EQ(pike_slots("(a*)*b", 1, text.c_str(), true), std::vector<int>());
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "traits.h"
+#include "regexp.h"
+#include "syntax_perl.h"
+
+using ct = re_char_traits<char>;
+using regexp_t = re::basic_regular_expression<re::syntax_perl<ct> >;
+
+// every allocation in the program, for NoAllocations.
+static size_t allocations = 0;
+
+void *operator new(size_t n) {
+    allocations++;
+    if (void *p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace re {
+    TEST(basic_regular_expression, MatchAndSearch) {
+        const regexp_t re(std::string("[a-z]+@ex\\.com"));
+        ASSERT_EQ(re.match(std::string("ab@ex.com!")), 9);
+        ASSERT_EQ(re.match(std::string("-ab@ex.com")), -1);
+        ASSERT_EQ(re.search(std::string("mail: ab@ex.com")), 6);
+        ASSERT_EQ(re.search(std::string("mail: ab@ex.co")), -1);
+
+        re_match_vector matches;
+        ASSERT_EQ(re.search(std::string("mail: ab@ex.com"), matches), 6);
+        ASSERT_EQ(matches[0], re_match_type(6, 9));
+    }
+
+    TEST(basic_regular_expression, Window) {
+        const regexp_t re("b+", 2);
+        const std::string text("abbbc");
+        ASSERT_EQ(re.match(text, 1), 3);
+        ASSERT_EQ(re.match(text, 1, 2), 2);
+        ASSERT_EQ(re.search(text.c_str(), text.size()), 1);
+    }
+
+    TEST(basic_regular_expression, LinearMatches) {
+        regexp_t re(std::string("(x+x+)+y"));
+        re.linear_matches(true);
+        const std::string text(5000, 'x');
+        ASSERT_EQ(re.search(text), -1);
+        ASSERT_EQ(re.match(text + "y"), 5001);
+
+        re_match_vector matches;
+        ASSERT_EQ(re.search(std::string("--xxxy"), matches), 2);
+        ASSERT_EQ(matches[0], re_match_type(2, 4));
+        ASSERT_EQ(matches[1], re_match_type(2, 3));
+        ASSERT_TRUE(re.linear_matches());
+        re.linear_matches(false);
+        ASSERT_FALSE(re.linear_matches());
+    }
+
+    TEST(basic_regular_expression, LinearFallback) {
+        // the counts make too many keys for the pike vm, so it's backtracked.
+        regexp_t re(std::string("(a{1,9}b{1,9}c{1,9}d{1,9}){1,9}e"));
+        re.linear_matches(true);
+        ASSERT_FALSE(re.linear_matches());
+        re_match_vector matches;
+        ASSERT_EQ(re.match(std::string("abcdaabbccdde"), matches), 13);
+        ASSERT_EQ(matches[1], re_match_type(4, 8));
+    }
+
+    TEST(basic_regular_expression, NoAllocations) {
+        // once the thread's buffers have grown, matching and searching again
+        // doesn't allocate, whichever way it goes: re_bitstate, re_onepass,
+        // the reversed suffix, the pike vm.
+        struct {
+            const char *pattern, *text;
+            bool search, linear;
+        } tries[] = {
+            {"(a|ab)(c|bcd)(d*)", "abcd", false, false},
+            {"(a*)(ab)*b", "aaabab", false, false},
+            {"(\\w+)\\s(\\w+)", "hello world", false, false},
+            {"(\\w+)\\s(\\w+)", "hello world", true, false},
+            {"(\\w+)@(\\w+)\\.com", "to: ab@cd.com", true, false},
+            {"(a|ab)(c|bcd)(d*)", "abcd", false, true},
+            {"(\\w+)\\s(\\w+)", "hello world", true, true},
+            {"(a{1,9}b{1,9}c{1,9}){1,9}e", "abce", false, true},
+        };
+        re_match_vector matches;
+        for (const auto &t: tries) {
+            regexp_t re(std::string(t.pattern));
+            re.linear_matches(t.linear);
+            const std::string text(t.text);
+            // a couple of goes for the buffers to get as big as they'll get.
+            int found = -1;
+            for (int i = 0; i < 3; i++) {
+                found = t.search ? re.search(text, matches) : re.match(text, matches);
+            }
+            ASSERT_GE(found, 0) << t.pattern;
+            const size_t before = allocations;
+            for (int i = 0; i < 10; i++) {
+                ASSERT_EQ(t.search ? re.search(text, matches) : re.match(text, matches), found);
+            }
+            ASSERT_EQ(allocations, before) << t.pattern;
+        }
+    }
+
+    TEST(basic_regular_expression, ClosureStack) {
+        // the limit is in bytes of failure stack entries; each a leaves a few.
+        regexp_t re(std::string("(a|b)*c"));
+        const std::string text = std::string(1000, 'a') + "c";
+        ASSERT_EQ(re.partial_match(text), 1001);
+        const size_t limit = re.maximum_closure_stack();
+        re.maximum_closure_stack(100 * sizeof(re_closure));
+        ASSERT_EQ(re.partial_match(text), -2);
+        re.maximum_closure_stack(limit);
+        ASSERT_EQ(re.partial_match(text), 1001);
+    }
+
+    TEST(basic_regular_expression, Caseless) {
+        regexp_t re(std::string("abc"));
+        ASSERT_EQ(re.search(std::string("xABC")), -1);
+        re.caseless_compares(true);
+        ASSERT_EQ(re.search(std::string("xABC")), 1);
+    }
+
+    TEST(basic_regular_expression, CaselessClass) {
+        // the whole class is caseless, ranges too.
+        regexp_t re(std::string("[a-cx]+"));
+        ASSERT_EQ(re.match(std::string("AbCX")), -1);
+        re.caseless_compares(true);
+        ASSERT_EQ(re.match(std::string("AbCX")), 4);
+        ASSERT_EQ(re.partial_match(std::string("AbCX")), 4);
+
+        // a negated one leaves out every case.
+        regexp_t negated(std::string("[^a-c,]+"));
+        negated.caseless_compares(true);
+        ASSERT_EQ(negated.match(std::string("xyB")), 2);
+    }
+
+    TEST(basic_regular_expression, LowerCaseless) {
+        // a lower case letter takes either case, an upper case one only itself.
+        regexp_t re(std::string("Aa+"));
+        re.lower_caseless_compares(true);
+        ASSERT_EQ(re.match(std::string("AaA")), 3);
+        ASSERT_EQ(re.match(std::string("aa")), -1);
+        ASSERT_EQ(re.search(std::string("xx aAAa")), 4);
+
+        regexp_t word(std::string("hello"));
+        word.caseless_compares(true);
+        ASSERT_EQ(word.search(std::string("say HeLLo")), 4);
+        ASSERT_EQ(word.partial_match(std::string("HELp")), 3);
+        word.caseless_compares(false);
+        ASSERT_EQ(word.search(std::string("say HeLLo")), -1);
+
+        // one range, and one character left out.
+        regexp_t range(std::string("[a-z]+[^x]"));
+        range.caseless_compares(true);
+        ASSERT_EQ(range.match(std::string("DisK1")), 5);
+        ASSERT_EQ(range.match(std::string("DX")), -1);
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -62,6 +62,27 @@ namespace re {
         cs.input.get(cs.ch);
         ASSERT_EQ(syntax.translate_char_class_escaped_op(cs), 0);
     }
+
+    TEST(syntax_perl, AtomicGroups) {
+        re_engine<syntax_perl_t> engine;
+        ASSERT_EQ(engine.exec_compile("(?>a)(b)", 8), 0);
+        const char *code = engine.code.code();
+        ASSERT_EQ(std::vector<char>(code, code + engine.code.offset()),
+                  std::vector<char>({OP_ATOMIC_BEGIN, OP_CHAR, 'a', OP_ATOMIC_END,
+                      OP_BACKREF_BEGIN, 1, OP_CHAR, 'b', OP_BACKREF_END, 1, OP_END}));
+
+        // a possessive quantifier is the same as an atomic group around it.
+        re_engine<syntax_perl_t> possessive;
+        ASSERT_EQ(possessive.exec_compile("a*+", 3), 0);
+        ASSERT_EQ(engine.exec_compile("(?>a*)", 6), 0);
+        ASSERT_EQ(possessive.code.offset(), engine.code.offset());
+        ASSERT_EQ(memcmp(possessive.code.code(), engine.code.code(), engine.code.offset()), 0);
+        ASSERT_EQ(possessive.code.code()[0], OP_ATOMIC_BEGIN);
+
+        // (? without the > isn't anything new.
+        ASSERT_EQ(engine.exec_compile("(?a)", 4), 0);
+        ASSERT_EQ(engine.code.code()[0], OP_BACKREF_BEGIN);
+    }
 }
 
 int main(int argc, char **argv) {